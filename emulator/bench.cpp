@@ -0,0 +1,304 @@
+#include "e_base.h"
+#include "e_asm.h"
+#include "e_asm_parallel.h"
+#include "e_predecode.h"
+#include "e_jit.h"
+#include "e_tier.h"
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+/*
+ * BENCHMARKS:
+ *   emulator_bench [--json <file>] [--filter <substring>] [--min-time <seconds>]
+ *   - every opcode of opcode_descriptions in a 1000 word unrolled body, a beq counter loop
+ *     and an lw / sw kernel, on emu_process, emu_execute_predecoded (plain and after emu_fuse),
+ *     emu_execute_tiered_for and (for programs that halt) emu_execute_jit, reported as
+ *     instructions per second
+ *   - emu_asm and emu_asm_parallel on synthetic sources of 1k / 10k / 100k lines, reported as
+ *     lines per second
+ *   - each case repeats until --min-time has passed, resetting the state / program between
+ *     repetitions is not timed, output is the google benchmark JSON layout
+ */
+
+using EBenchClock = std::chrono::steady_clock;
+
+struct EBenchResult
+{
+	std::string name_;
+	u64 iterations_;
+	u64 items_;
+	double seconds_;
+};
+
+struct EBenchOptions
+{
+	const char* json_path_ = nullptr;
+	const char* filter_ = nullptr;
+	double min_time_ = 0.2;
+};
+
+// runs setup then body until body took min_time, only body is timed, it returns the number
+// of items it processed
+template <typename Setup, typename Body>
+void
+emu_bench_run(
+	const EBenchOptions& options,
+	std::vector<EBenchResult>& results,
+	const std::string& name,
+	Setup setup,
+	Body body)
+{
+	if (options.filter_ && name.find(options.filter_) == std::string::npos)
+		return;
+
+	EBenchResult r = { name, 0, 0, 0.0 };
+	do
+	{
+		setup();
+		auto begin = EBenchClock::now();
+		r.items_ += body();
+		r.seconds_ += std::chrono::duration<double>(EBenchClock::now() - begin).count();
+		r.iterations_++;
+	} while (r.seconds_ < options.min_time_);
+
+	printf("%-40s %12llu iterations %10.2f M items/s\n", name.c_str(), (unsigned long long)r.iterations_, r.items_ / r.seconds_ / 1e6);
+	results.push_back(r);
+}
+
+// a machine that runs the same instruction forever, none of them can fault
+EState
+emu_bench_opcode_program(
+	const EOpcodeDesc& desc)
+{
+	constexpr u32 body = 1000;
+	constexpr u32 data = 1020;
+
+	EState state = {};
+	for (u32 i = 0; i < REGISTERS_COUNT; i++)
+		state.r_[i] = (ERegister)(3 + i);
+
+	EInstruction word = {};
+	switch (desc.opcode_)
+	{
+	case E_LW:   word = EInstruction::create_ra_rb_offset(E_LW, 0, 1, data - 4); break;
+	case E_SW:   word = EInstruction::create_ra_rb_offset(E_SW, 0, 1, data); break;
+	case E_BEQ:  word = EInstruction::create_ra_rb_offset(E_BEQ, 0, 1, 0); break;
+	case E_JMA:  word = EInstruction::create_ra_rb_offset(E_JMA, 0, 1, 0); break;
+	case E_JMBE: word = EInstruction::create_ra_rb_offset(E_JMBE, 1, 0, 0); break;
+	case E_INC:  word = EInstruction::create_ra_rb_rr(E_INC, 2, 0, 0); break;
+	// jumps to itself through r7, the return address goes to ram_[r6]
+	case E_JALR: state.r_[6] = data; state.r_[7] = 0; word = EInstruction::create_ra_rb_rr(E_JALR, 6, 7, 0); break;
+	default:     word = EInstruction::create_ra_rb_rr(desc.opcode_, 1, 2, 3); break;
+	}
+
+	for (u32 i = 0; i < body; i++)
+		state.ram_[i] = word;
+	state.ram_[body] = EInstruction::create_ra_rb_offset(E_BEQ, 0, 0, (u32)(-(i32)body - 1) & BITS_12_MASK);
+	return state;
+}
+
+// inc r0, beq r0 r1 1, beq r2 r2 -3, halt: 3 * 60000 + 1 steps
+EState
+emu_bench_counter_program()
+{
+	EState state = {};
+	state.r_[1] = 60000;
+	state.ram_[0] = EInstruction::create_ra_rb_rr(E_INC, 0, 0, 0);
+	state.ram_[1] = EInstruction::create_ra_rb_offset(E_BEQ, 0, 1, 1);
+	state.ram_[2] = EInstruction::create_ra_rb_offset(E_BEQ, 2, 2, (u32)-3 & BITS_12_MASK);
+	state.ram_[3] = EInstruction::create_ra_rb_rr(E_HALT, 0, 0, 0);
+	return state;
+}
+
+// sums 512 words with lw and stores every partial sum with sw: 5 * 512 + 1 steps
+EState
+emu_bench_memory_program()
+{
+	EState state = {};
+	state.r_[6] = 512;
+	state.ram_[0] = EInstruction::create_ra_rb_offset(E_LW, 3, 4, 500);
+	state.ram_[1] = EInstruction::create_ra_rb_rr(E_ADD, 3, 5, 5);
+	state.ram_[2] = EInstruction::create_ra_rb_offset(E_SW, 0, 5, 1020);
+	state.ram_[3] = EInstruction::create_ra_rb_rr(E_INC, 4, 0, 0);
+	state.ram_[4] = EInstruction::create_ra_rb_offset(E_JMA, 6, 4, (u32)-5 & BITS_12_MASK);
+	state.ram_[5] = EInstruction::create_ra_rb_rr(E_HALT, 0, 0, 0);
+	for (u32 i = 0; i < 512; i++)
+		state.ram_[500 + i].set_value(i);
+	return state;
+}
+
+std::string
+emu_bench_source(
+	u32 lines)
+{
+	static const char* const body[] = {
+		"\tlw r0 $a 0 ; load",
+		"\tadd r0 r1 r2",
+		"\tnand r2 r3 r4",
+		"\tbeq r4 r5 -3",
+		"",
+		"\timul r1 r2 r3",
+		"\tsw $b r3 12",
+		"\tcmp r3 r4",
+		"; a comment line",
+		"\tjmbe r1 r2 2",
+	};
+
+	std::string source = "$a .fill dec 5\n$b .fill dec 7\n";
+	for (u32 i = 2; i < lines; i++)
+	{
+		source += body[i % ARRAY_SIZE(body)];
+		source += '\n';
+	}
+	return source;
+}
+
+void
+emu_bench_engines(
+	const EBenchOptions& options,
+	std::vector<EBenchResult>& results,
+	const std::string& name,
+	const EState& image,
+	u64 steps,
+	bool halts)
+{
+	auto state = std::make_unique<EState>();
+	auto program = std::make_unique<EDecodedProgram>();
+	auto decoded = std::make_unique<EDecodedProgram>();
+	emu_predecode(*decoded, image);
+	auto fused = std::make_unique<EDecodedProgram>(*decoded);
+	emu_fuse(*fused);
+	auto tier = std::make_unique<ETier>();
+
+	// a run of 0 steps only threads, the copies below then start out threaded
+	*state = image;
+	emu_execute_predecoded(*state, *decoded, nullptr, 0);
+	emu_execute_predecoded(*state, *fused, nullptr, 0);
+
+	// putting the state and program back is not part of what is measured
+	const auto reset = [&]() { *state = image; };
+
+	emu_bench_run(options, results, name + "/emu_process", reset, [&]() -> u64 {
+		u64 retired = 0;
+		for (; retired < steps && !state->halt_; retired++)
+		{
+			emu_load_next(*state);
+			emu_process(*state);
+		}
+		return retired;
+	});
+
+	emu_bench_run(options, results, name + "/predecoded", [&]() { reset(); *program = *decoded; }, [&]() -> u64 {
+		u64 retired = 0;
+		emu_execute_predecoded(*state, *program, &retired, steps);
+		return retired;
+	});
+
+	emu_bench_run(options, results, name + "/fused", [&]() { reset(); *program = *fused; }, [&]() -> u64 {
+		u64 retired = 0;
+		emu_execute_predecoded(*state, *program, &retired, steps);
+		return retired;
+	});
+
+	emu_bench_run(options, results, name + "/tiered", [&]() { reset(); emu_tier_reset(*tier); }, [&]() -> u64 {
+		u64 retired = 0;
+		emu_execute_tiered_for(*state, *tier, steps, &retired);
+		return retired;
+	});
+
+#if EMU_JIT_AVAILABLE
+	if (halts)
+	{
+		EJitContext jit;
+		// emu_execute_jit doesn't count, programs that halt are given with their exact step count
+		emu_bench_run(options, results, name + "/jit", reset, [&]() -> u64 {
+			emu_execute_jit(*state, jit);
+			return steps;
+		});
+	}
+#else
+	(void)halts;
+#endif
+}
+
+void
+emu_bench_write_json(
+	const char* path,
+	const std::vector<EBenchResult>& results)
+{
+	FILE* f = fopen(path, "w");
+	if (!f)
+	{
+		LOG("Can't write %s", path);
+		return;
+	}
+
+	fprintf(f, "{\n  \"context\": { \"library\": \"emulator_bench\", \"jit\": %s },\n  \"benchmarks\": [\n", EMU_JIT_AVAILABLE ? "true" : "false");
+	for (size_t i = 0; i < results.size(); i++)
+	{
+		const auto& r = results[i];
+		fprintf(f, "    { \"name\": \"%s\", \"iterations\": %llu, \"real_time\": %.3f, \"time_unit\": \"ns\", \"items_per_second\": %.1f }%s\n",
+			r.name_.c_str(), (unsigned long long)r.iterations_, r.seconds_ * 1e9 / r.iterations_, r.items_ / r.seconds_,
+			i + 1 < results.size() ? "," : "");
+	}
+	fprintf(f, "  ]\n}\n");
+	fclose(f);
+}
+
+i32
+main(
+	i32 argc,
+	char** argv)
+{
+	EBenchOptions options;
+	for (i32 i = 1; i + 1 < argc; i += 2)
+	{
+		std::string_view arg = argv[i];
+		if (arg == "--json")
+			options.json_path_ = argv[i + 1];
+		else if (arg == "--filter")
+			options.filter_ = argv[i + 1];
+		else if (arg == "--min-time")
+			options.min_time_ = atof(argv[i + 1]);
+		else
+		{
+			LOG("usage: %s [--json <file>] [--filter <substring>] [--min-time <seconds>]", argv[0]);
+			return -1;
+		}
+	}
+
+	std::vector<EBenchResult> results;
+
+	for (const auto& desc : opcode_descriptions)
+	{
+		if (desc.opcode_ == E_HALT)
+			continue;
+		emu_bench_engines(options, results, "opcode/" + std::string(desc.asm_name_), emu_bench_opcode_program(desc), 100'000, false);
+	}
+
+	emu_bench_engines(options, results, "loop/beq_counter", emu_bench_counter_program(), 3 * 60000 + 1, true);
+	emu_bench_engines(options, results, "memory/lw_sw_sum", emu_bench_memory_program(), 5 * 512 + 1, true);
+
+	for (u32 lines : { 1'000u, 10'000u, 100'000u })
+	{
+		std::string source = emu_bench_source(lines);
+		auto data = std::make_unique<EAsmCompillerDataT<1u << 17, REGISTERS_COUNT>>();
+		const auto nothing = []() {};
+		emu_bench_run(options, results, "asm/lines:" + std::to_string(lines), nothing, [&]() -> u64 {
+			emu_asm(*data, source);
+			return lines;
+		});
+		emu_bench_run(options, results, "asm_parallel/lines:" + std::to_string(lines), nothing, [&]() -> u64 {
+			emu_asm_parallel(*data, source);
+			return lines;
+		});
+	}
+
+	if (options.json_path_)
+		emu_bench_write_json(options.json_path_, results);
+
+	return 0;
+}
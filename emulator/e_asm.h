@@ -1,307 +1,479 @@
 #pragma once
 #include "e_base.h"
+#include "e_lexer.h"
 
-constexpr EOpcodeDesc FIND_OPCODE_BY_NAME(const std::string_view name)
+#include <string>
+#include <vector>
+
+[[nodiscard]] constexpr const EOpcodeDesc*
+emu_asm_find_opcode(
+	std::string_view name)
 {
-	for (size_t i = 0; i < ARRAY_SIZE(opcode_descriptions); i++)
+	for (const auto& desc : opcode_descriptions)
+	{
+		if (desc.asm_name_ == name)
+			return &desc;
+	}
+	return nullptr;
+}
+
+// r0..r<registers_count - 1>, -1 if the word is not a register
+[[nodiscard]] constexpr i32
+emu_asm_register(
+	std::string_view name,
+	u32 registers_count = REGISTERS_COUNT)
+{
+	if (name.size() < 2 || name.size() > 3 || name[0] != 'r' || (name.size() == 3 && name[1] == '0'))
+		return -1;
+
+	u32 index = 0;
+	for (char c : name.substr(1))
 	{
-		if (opcode_descriptions[i].asm_name_ == name)
-			return opcode_descriptions[i];
+		if (!emu_lex_is_digit(c))
+			return -1;
+		index = index * 10 + (c - '0');
 	}
-	ASSERT(false && "Not found!");
+	return index < registers_count ? (i32)index : -1;
 }
 
-static const std::map<std::string, EOpcodeDesc> instr_to_opcode = {
-	{ "add"  , FIND_OPCODE_BY_NAME("add") },
-	{ "nand" , FIND_OPCODE_BY_NAME("nand") },
-	{ "lw"   , FIND_OPCODE_BY_NAME("lw") },
-	{ "sw"   , FIND_OPCODE_BY_NAME("sw") },
-	{ "beq"  , FIND_OPCODE_BY_NAME("beq") },
-	{ "jalr" , FIND_OPCODE_BY_NAME("jalr") },
-	{ "halt" , FIND_OPCODE_BY_NAME("halt") },
-	{ "noop" , FIND_OPCODE_BY_NAME("noop") },
-	{ "inc"  , FIND_OPCODE_BY_NAME("inc") },
-	{ "idiv" , FIND_OPCODE_BY_NAME("idiv") },
-	{ "imul" , FIND_OPCODE_BY_NAME("imul") },
-	{ "and"  , FIND_OPCODE_BY_NAME("and") },
-	{ "xor"  , FIND_OPCODE_BY_NAME("xor") },
-	{ "shr"  , FIND_OPCODE_BY_NAME("shr") },
-	{ "jma"  , FIND_OPCODE_BY_NAME("jma") },
-	{ "jmbe" , FIND_OPCODE_BY_NAME("jmbe") },
-	{ "adc"  , FIND_OPCODE_BY_NAME("adc") },
-	{ "sbb"  , FIND_OPCODE_BY_NAME("sbb") },
-	{ "cmp"  , FIND_OPCODE_BY_NAME("cmp") },
-	{ ".fill", {}}
+/*
+ * ASSEMBLER:
+ *   - pass one lexes the source once, interns every label into a hashed symbol table and
+ *     emits the words, a reference to a label that is not defined yet leaves the field at 0
+ *     and records a fixup
+ *   - pass two patches the fixups, anything still undefined is reported
+ *   - errors are collected into diagnostics_ (line:column), the bad line is skipped and
+ *     emu_asm returns FAILURE, nothing is printed, that is up to the caller
+ *   - a label names the address of the next emitted word, direct operands are 4 bit fields so
+ *     a label used as an operand must be at 0..15
+ */
+
+struct EAsmSymbol
+{
+	u32 name_offset_; // into EAsmSymbolTable::names_
+	u32 name_size_;
+	u32 hash_;
+	u32 address_;
+	bool defined_;
 };
 
-static const std::map<std::string, u32> reg_name_to_reg_index = {
-	{ "r0", 0 },
-	{ "r1", 1 },
-	{ "r2", 2 },
-	{ "r3", 3 },
-	{ "r4", 4 },
-	{ "r5", 5 },
-	{ "r6", 6 },
-	{ "r7", 7 }
+struct EAsmSymbolTable
+{
+	std::string names_;              // interned names back to back
+	std::vector<EAsmSymbol> symbols_;
+	std::vector<u32> slots_;         // open addressing, symbol index + 1, 0 is empty
 };
 
-struct EAsmCompillerData
+struct EAsmFixup
 {
-	std::map<std::string, u32> labels_;
-	EInstruction compilled_code[RAM_SIZE / sizeof(EInstruction)] = {};
+	u32 word_;
+	u32 shift_; // 17 regA, 12 regB
+	u32 symbol_;
+	u32 line_;
+	u32 column_;
 };
 
-[[ no_discard ]] std::vector<std::string>
-str_split(
-	std::string s,
-	std::string delimiter)
+struct EAsmDiagnostic
 {
-	size_t pos_start = 0, pos_end, delim_len = delimiter.length();
-	std::string token;
-	std::vector<std::string> res;
-
-	while ((pos_end = s.find(delimiter, pos_start)) != std::string::npos) {
-		token = s.substr(pos_start, pos_end - pos_start);
-		pos_start = pos_end + delim_len;
-		res.push_back(token);
+	u32 line_;
+	u32 column_;
+	std::string message_;
+};
+
+template <u32 RAM_WORDS, u32 REG_COUNT>
+struct EAsmCompillerDataT
+{
+	static constexpr u32 ram_words_ = RAM_WORDS;
+	static constexpr u32 registers_count_ = REG_COUNT;
+
+	EAsmSymbolTable symbols_;
+	std::vector<EAsmDiagnostic> diagnostics_;
+	EInstruction compilled_code[RAM_WORDS] = {};
+};
+
+using EAsmCompillerData = EAsmCompillerDataT<EState::ram_words_, EState::registers_count_>;
+
+// FNV-1a
+[[nodiscard]] constexpr u32
+emu_asm_hash(
+	std::string_view s)
+{
+	u32 hash = 2166136261u;
+	for (char c : s)
+	{
+		hash ^= (u8)c;
+		hash *= 16777619u;
 	}
+	return hash;
+}
 
-	res.push_back(s.substr(pos_start));
-	return res;
+[[nodiscard]] inline std::string_view
+emu_asm_symbol_name(
+	const EAsmSymbolTable& table,
+	const EAsmSymbol& symbol)
+{
+	return std::string_view(table.names_).substr(symbol.name_offset_, symbol.name_size_);
 }
 
-[[no_discard]] std::string
-str_concat(
-	const std::vector<std::string>& strings,
-	const std::string& endl = "\n")
+// slot holding the name, or the empty slot it would go to
+[[nodiscard]] u32
+emu_asm_symbol_slot(
+	const EAsmSymbolTable& table,
+	std::string_view name,
+	u32 hash)
 {
-	std::string ret;
-	for (const auto& s : strings)
-		ret += s + endl;
-	return ret;
+	const u32 mask = (u32)table.slots_.size() - 1;
+	for (u32 slot = hash & mask;; slot = (slot + 1) & mask)
+	{
+		u32 index = table.slots_[slot];
+		if (index == 0)
+			return slot;
+
+		const EAsmSymbol& symbol = table.symbols_[index - 1];
+		if (symbol.hash_ == hash && emu_asm_symbol_name(table, symbol) == name)
+			return slot;
+	}
+}
+
+[[nodiscard]] const EAsmSymbol*
+emu_asm_symbol_find(
+	const EAsmSymbolTable& table,
+	std::string_view name)
+{
+	if (table.slots_.empty())
+		return nullptr;
+
+	u32 index = table.slots_[emu_asm_symbol_slot(table, name, emu_asm_hash(name))];
+	return index ? &table.symbols_[index - 1] : nullptr;
 }
 
-void
-str_strip(
-	std::string& str)
+// index of the symbol, added undefined on first sight
+u32
+emu_asm_symbol_intern(
+	EAsmSymbolTable& table,
+	std::string_view name)
 {
-	if (str.length() != 0)
+	// keep the load under one half
+	if ((table.symbols_.size() + 1) * 2 > table.slots_.size())
 	{
-		auto w = std::string(" ");
-		auto n = std::string("\n");
-		auto r = std::string("\t");
-		auto t = std::string("\r");
-		auto v = std::string(1, str.front());
-		while ((v == w) || (v == t) || (v == r) || (v == n))
+		table.slots_.assign(std::max<size_t>(64, table.slots_.size() * 2), 0);
+		for (u32 i = 0; i < table.symbols_.size(); i++)
 		{
-			str.erase(str.begin());
-			v = std::string(1, str.front());
-		}
-		v = std::string(1, str.back());
-		while ((v == w) || (v == t) || (v == r) || (v == n))
-		{
-			str.erase(str.end() - 1);
-			v = std::string(1, str.back());
+			const EAsmSymbol& symbol = table.symbols_[i];
+			table.slots_[emu_asm_symbol_slot(table, emu_asm_symbol_name(table, symbol), symbol.hash_)] = i + 1;
 		}
 	}
+
+	u32 hash = emu_asm_hash(name);
+	u32 slot = emu_asm_symbol_slot(table, name, hash);
+	if (table.slots_[slot])
+		return table.slots_[slot] - 1;
+
+	table.symbols_.push_back({ (u32)table.names_.size(), (u32)name.size(), hash, 0, false });
+	table.names_ += name;
+	table.slots_[slot] = (u32)table.symbols_.size();
+	return (u32)table.symbols_.size() - 1;
 }
 
-void
-str_replace(
-	std::string& in,
-	const std::regex& re,
-	const std::string& replace_with)
+// one source line, a line never has more than a label, a mnemonic and three operands
+struct EAsmLine
 {
-	while (std::regex_search(in, re)) {
-		in = std::regex_replace(in, re, replace_with);
-	}
-}
+	EToken tokens_[8];
+	u32 count_;
+	EToken end_; // the newline (or end) that closed the line
+};
 
-[[ no_discard ]] u32
-emu_asm_offset(
-	const std::string& s
-)
+[[nodiscard]] constexpr bool
+emu_asm_read_line(
+	ELexer& lexer,
+	EAsmLine& line)
 {
-	return std::stoi(s);
+	line.count_ = 0;
+	for (;;)
+	{
+		EToken token = emu_lex_next(lexer);
+		if (token.kind_ == ETOKEN_NEWLINE || token.kind_ == ETOKEN_END)
+		{
+			line.end_ = token;
+			return token.kind_ == ETOKEN_NEWLINE || line.count_ != 0;
+		}
+
+		// overlong lines keep their last token slot overwritten, the count tells the parser
+		line.tokens_[std::min<u32>(line.count_, ARRAY_SIZE(line.tokens_) - 1)] = token;
+		line.count_++;
+	}
 }
 
-Status
-emu_asm_preprocess(
-	EAsmCompillerData& compiller_data,
-	std::string& code)
+// the word of one line (tokens from t on, after its label), false if the line is bad
+// label operands are left at 0 and come back in refs, symbol_of maps a label token to its symbol
+// index (UINT32_MAX if it can't be used), report_at(token, message) gets every error
+template <u32 REG_COUNT, typename SymbolOf, typename Report>
+[[nodiscard]] constexpr bool
+emu_asm_encode_line(
+	const EAsmLine& line,
+	u32 t,
+	u32 word,
+	EInstruction& out,
+	EAsmFixup (&refs)[2],
+	u32& refs_count,
+	SymbolOf&& symbol_of,
+	Report&& report_at)
 {
-	// remove comments
-	str_replace(code, std::regex(R"(\;(.*))"), "");
+	refs_count = 0;
+	out = {};
 
-	// remove empty lines
-	str_replace(code, std::regex(R"(^\s*$\n)"), "");
+	if (line.count_ > ARRAY_SIZE(line.tokens_))
+	{
+		report_at(line.tokens_[ARRAY_SIZE(line.tokens_) - 1], "Too many operands");
+		return false;
+	}
 
-	// replace multi space with a single space
-	str_replace(code, std::regex(R"([\r\t\f ]{2,})"), " ");
+	const EToken& head = line.tokens_[t++];
+	const EToken* args = line.tokens_ + t;
+	const u32 args_count = line.count_ - t;
 
-	// remove spaces before the text and after in a line and spaces between instruction params
-	auto code_lines = str_split(code, "\n");
-	for (auto& s : code_lines)
+	bool bad_token = false;
+	for (u32 a = 0; a < args_count; a++)
 	{
-		// idk from where do i get \t string ? 
-		if (s == "\t")
+		if (args[a].kind_ == ETOKEN_INVALID)
 		{
-			s = "";
-			continue;
+			report_at(args[a], "Bad token");
+			bad_token = true;
 		}
-
-		if (!s.empty())
-			str_strip(s);
 	}
+	if (bad_token)
+		return false;
 
-
-	// process labels - they start with $
-	u32 ref_line = 0;
-	for (auto& s : code_lines)
+	if (head.kind_ == ETOKEN_DIRECTIVE && head.text_ == ".fill")
 	{
-		auto line = str_split(s, " ");
-		if (std::regex_match(line[0], std::regex(R"(\$\w+)")))
+		if (args_count != 2 || args[0].kind_ != ETOKEN_WORD || args[1].kind_ != ETOKEN_NUMBER)
 		{
-			compiller_data.labels_[line[0]] = ref_line;
-
-			// remove label - we don't need it anymore
-			line.erase(line.begin());
+			report_at(head, "Expected '.fill dec <number>' at");
+			return false;
+		}
+		if (args[0].text_ != "dec")
+		{
+			report_at(args[0], "Bad value desc");
+			return false;
 		}
 
-		s = str_concat(line, " ");
+		out.set_value((u32)args[1].value_);
+		return true;
+	}
 
-		ref_line++;
+	const EOpcodeDesc* desc = head.kind_ == ETOKEN_WORD ? emu_asm_find_opcode(head.text_) : nullptr;
+	if (!desc)
+	{
+		report_at(head, "Unknown instruction");
+		return false;
+	}
+
+	u32 expected = 0;
+	switch (desc->args_type_)
+	{
+	case EARGS_NONE: expected = 0; break;
+	case EARGS_A: expected = 1; break;
+	case EARGS_A_B: expected = 2; break;
+	case EARGS_A_B_R:
+	case EARGS_A_B_OFFSET: expected = 3; break;
+	default: {
+		ASSERT(false && "Opcode Type is not found!");
+	} break;
 	}
 
-	code = str_concat(code_lines);
+	if (args_count != expected)
+	{
+		report_at(head, "Wrong number of operands for");
+		return false;
+	}
 
-	// remove empty lines
-	str_replace(code, std::regex(R"(^\s*$\n)"), "");
-	code_lines = str_split(code, "\n");
-	std::remove_if(code_lines.begin(), code_lines.end(), [](const std::string& s) {return s.empty(); });
-	code = str_concat(code_lines);
+	// { register index or label address, is direct }
+	std::pair<u32, bool> operands[3] = {};
+	for (u32 a = 0; a < args_count; a++)
+	{
+		const EToken& arg = args[a];
+		const bool is_third = a == 2;
+		if (is_third && desc->args_type_ == EARGS_A_B_OFFSET)
+		{
+			if (arg.kind_ != ETOKEN_NUMBER)
+				report_at(arg, "Offset is not a number");
+			else if (!IN_RANGE_E(arg.value_, -2048, 2047))
+				report_at(arg, "Offset does not fit 12 bits");
+			else
+			{
+				operands[a] = { (u32)arg.value_ & BITS_12_MASK, false };
+				continue;
+			}
+			return false;
+		}
+		else if (arg.kind_ == ETOKEN_LABEL && !is_third)
+		{
+			u32 symbol = symbol_of(arg);
+			if (symbol == UINT32_MAX)
+			{
+				report_at(arg, "Unresolved label");
+				return false;
+			}
+			refs[refs_count++] = { word, a == 0 ? 17u : 12u, symbol, arg.line_, arg.column_ };
+			operands[a] = { 0, true };
+		}
+		else if (arg.kind_ == ETOKEN_WORD && emu_asm_register(arg.text_, REG_COUNT) >= 0)
+		{
+			operands[a] = { (u32)emu_asm_register(arg.text_, REG_COUNT), false };
+		}
+		else
+		{
+			report_at(arg, is_third ? "destReg is not a register" : "Arg is not valid");
+			return false;
+		}
+	}
 
-	LOG("\nCode:\n\n%s\n", code.c_str());
-	return SUCCESS;
+	auto& [ra, rb, rr] = operands;
+	u32 opcode = desc->opcode_;
+	if (desc->args_type_ == EARGS_A_B_OFFSET)
+		out = EInstruction::create_ra_rb_offset(opcode, ra.first, rb.first, rr.first, ra.second, rb.second);
+	else
+		out = EInstruction::create_ra_rb_rr(opcode, ra.first, rb.first, rr.first, ra.second, rb.second);
+	return true;
 }
 
-Status
-emu_asm(
-	EAsmCompillerData& compiller_data,
-	const std::string& asm_code)
+// ORs the label address into the word, false if a direct operand can't hold it
+[[nodiscard]] constexpr bool
+emu_asm_patch(
+	EInstruction& word,
+	const EAsmFixup& fixup,
+	u32 address)
 {
-	std::string code = asm_code;
+	if (address > 0b1111)
+		return false;
+	word.set_value(word.get_value() | (address << fixup.shift_));
+	return true;
+}
 
-	emu_asm_preprocess(compiller_data, code);
+inline void
+emu_asm_report(
+	std::vector<EAsmDiagnostic>& diagnostics,
+	u32 line,
+	u32 column,
+	const char* what,
+	std::string_view text)
+{
+	diagnostics.push_back({ line, column, std::string(what) + " '" + std::string(text) + "'" });
+}
 
-	u32 code_line = 0;
-	auto instructions = str_split(code, "\n");
-	for (auto& i_line : instructions)
+// pass one for a single line: define its label, emit its word, record forward references
+// false once ram is full, nothing after that is assembled
+template <u32 RAM_WORDS, u32 REG_COUNT>
+[[nodiscard]] bool
+emu_asm_line(
+	EAsmCompillerDataT<RAM_WORDS, REG_COUNT>& compiller_data,
+	const EAsmLine& line,
+	u32& code_line,
+	std::vector<EAsmFixup>& fixups)
+{
+	auto& symbols = compiller_data.symbols_;
+	auto& diagnostics = compiller_data.diagnostics_;
+
+	const auto report_at = [&](const EToken& at, const char* what) {
+		emu_asm_report(diagnostics, at.line_, at.column_, what, at.text_);
+	};
+	const auto intern = [&](const EToken& label) {
+		return emu_asm_symbol_intern(symbols, label.text_);
+	};
+
+	u32 t = 0;
+	if (line.count_ != 0 && line.tokens_[0].kind_ == ETOKEN_LABEL)
 	{
-		if (i_line.empty())
+		const EToken& label = line.tokens_[0];
+		EAsmSymbol& symbol = symbols.symbols_[emu_asm_symbol_intern(symbols, label.text_)];
+		// the first definition keeps the label, every later one is only reported
+		if (symbol.defined_)
+			report_at(label, "Label is defined twice");
+		else
 		{
-			LOG("Skipping one line");
-			continue;
+			symbol.address_ = code_line;
+			symbol.defined_ = true;
 		}
+		t = 1;
+	}
 
-		auto i = str_split(i_line, " ");
-		auto opcode_str = i[0];
-
-		auto it = instr_to_opcode.find(opcode_str);
-		if (it == instr_to_opcode.end())
-		{
-			LOG("Failure on line: %s", i_line.c_str());
-			ASSERT(false);
-			return FAILURE;
-		}
+	if (t == line.count_)
+		return true;
 
-		const auto get_arg = [&](const std::string& arg) -> std::pair<u32, bool> {
-			if (std::regex_match(arg, std::regex(R"(\$\w+)")))
-			{
-				// label
-				return { compiller_data.labels_[arg], true };
-			}
-			else if (std::regex_match(arg, std::regex(R"(r[0-8])")))
-			{
-				// register
-				return { reg_name_to_reg_index.at(arg), false};
-			}
-			
-			LOG("Arg is not valid: %s", arg.c_str());
-			ASSERT(false && "Argument is not valid!");
-			return { 0, false };
-		};
+	// the word is taken even if the line is bad, so later labels stay where they belong
+	const u32 word = code_line++;
+	if (word >= RAM_WORDS)
+	{
+		report_at(line.tokens_[t], "Too much code, ram is full at");
+		return false;
+	}
 
-		// a b r
-		EInstruction compilled_instruction = {};
+	EInstruction compilled_instruction = {};
+	EAsmFixup refs[2];
+	u32 refs_count = 0;
+	if (!emu_asm_encode_line<REG_COUNT>(line, t, word, compilled_instruction, refs, refs_count, intern, report_at))
+		return true;
 
-		if (opcode_str == ".fill")
+	// backward references are patched right away
+	bool bad_label = false;
+	for (u32 i = 0; i < refs_count; i++)
+	{
+		const EAsmSymbol& symbol = symbols.symbols_[refs[i].symbol_];
+		if (!symbol.defined_)
+			fixups.push_back(refs[i]);
+		else if (!emu_asm_patch(compilled_instruction, refs[i], symbol.address_))
 		{
-			auto type = i[1];
-			auto value = emu_asm_offset(i[2]);
-
-			if (type == "dec")
-				compilled_instruction.set_value(value);
-			else
-				ASSERT(false && "Bad value desc!");
+			emu_asm_report(diagnostics, refs[i].line_, refs[i].column_, "Label is past word 15, a direct operand can't hold", emu_asm_symbol_name(symbols, symbol));
+			bad_label = true;
 		}
-		else
-		{
+	}
 
-			u32 opcode = it->second.opcode_;
-			switch (it->second.args_type_)
-			{
-			case EARGS_NONE: {
-				compilled_instruction = EInstruction::create_ra_rb_rr(opcode, 0, 0, 0);
-			} break;
-			case EARGS_A: {
-				auto ra = get_arg(i[1]);
-
-				compilled_instruction = EInstruction::create_ra_rb_rr(opcode, ra.first, 0, 0, ra.second, 0);
-			} break;
-			case EARGS_A_B: {
-				auto ra = get_arg(i[1]);
-				auto rb = get_arg(i[2]);
-
-				compilled_instruction = EInstruction::create_ra_rb_rr(opcode, ra.first, rb.first, 0, ra.second, rb.second);
-			} break;
-			case EARGS_A_B_R: {
-				auto ra = get_arg(i[1]);
-				auto rb = get_arg(i[2]);
-				auto rr = get_arg(i[3]);
-
-				compilled_instruction = EInstruction::create_ra_rb_rr(opcode, ra.first, rb.first, rr.first, ra.second, rb.second);
-			} break;
-			case EARGS_A_B_OFFSET: {
-				auto ra = get_arg(i[1]);
-				auto rb = get_arg(i[2]);
-				auto offset = emu_asm_offset(i[3]);
-
-				compilled_instruction = EInstruction::create_ra_rb_offset(opcode, ra.first, rb.first, offset, ra.second, rb.second);
-			} break;
-			default: {
-				ASSERT(false && "Opcode Type is not found!");
-			} break;
-			}
-		}
+	if (!bad_label)
+		compiller_data.compilled_code[word] = compilled_instruction;
+	return true;
+}
 
-		compiller_data.compilled_code[code_line] = compilled_instruction;
-		code_line++;
+// pass two: forward references
+template <u32 RAM_WORDS, u32 REG_COUNT>
+Status
+emu_asm_resolve(
+	EAsmCompillerDataT<RAM_WORDS, REG_COUNT>& compiller_data,
+	const std::vector<EAsmFixup>& fixups)
+{
+	auto& symbols = compiller_data.symbols_;
+	auto& diagnostics = compiller_data.diagnostics_;
 
-		if (code_line > ARRAY_SIZE(compiller_data.compilled_code))
-			ASSERT(false && "too much code!");
+	for (const auto& fixup : fixups)
+	{
+		const EAsmSymbol& symbol = symbols.symbols_[fixup.symbol_];
+		std::string_view name = emu_asm_symbol_name(symbols, symbol);
+		if (!symbol.defined_)
+			emu_asm_report(diagnostics, fixup.line_, fixup.column_, "Unresolved label", name);
+		else if (!emu_asm_patch(compiller_data.compilled_code[fixup.word_], fixup, symbol.address_))
+			emu_asm_report(diagnostics, fixup.line_, fixup.column_, "Label is past word 15, a direct operand can't hold", name);
 	}
 
+	return diagnostics.empty() ? SUCCESS : FAILURE;
+}
 
-	return SUCCESS;
-
+template <u32 RAM_WORDS, u32 REG_COUNT>
+Status
+emu_asm(
+	EAsmCompillerDataT<RAM_WORDS, REG_COUNT>& compiller_data,
+	std::string_view asm_code)
+{
+	compiller_data.symbols_ = {};
+	compiller_data.diagnostics_.clear();
 
-	LOG("Compilled: ");
-	for (size_t i = 0; i < ARRAY_SIZE(compiller_data.compilled_code); i++)
+	std::vector<EAsmFixup> fixups;
+	ELexer lexer = { asm_code };
+	EAsmLine line = {};
+	u32 code_line = 0;
+	while (emu_asm_read_line(lexer, line))
 	{
-		LOG("%s", std::bitset<32>(compiller_data.compilled_code[i].get_value()).to_string().c_str());
+		if (!emu_asm_line(compiller_data, line, code_line, fixups))
+			break;
 	}
-	
 
-	return SUCCESS;
-}
\ No newline at end of file
+	return emu_asm_resolve(compiller_data, fixups);
+}
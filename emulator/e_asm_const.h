@@ -0,0 +1,162 @@
+#pragma once
+#include "e_base.h"
+#include "e_asm.h"
+
+#include <array>
+#include <string_view>
+
+/*
+ * COMPILE TIME ASSEMBLER:
+ *   - emu_asm_const<R"(...)">() is consteval and gives std::array<EInstruction, N>, N being
+ *     the words the source emits, nothing is left to do at startup
+ *   - the same constexpr lexer, emu_asm_encode_line and opcode_descriptions as emu_asm, so the
+ *     words are exactly what emu_asm produces
+ *   - pass one counts the words and collects at most EMU_ASM_CONST_LABELS labels, pass two
+ *     encodes with every label already known
+ *   - any error calls emu_asm_const_error, which is not constexpr, so the build fails there, the
+ *     compiler's trace goes through the report_at in emu_asm_encode_line (or the check here)
+ *     that names the error, the same source built with emu_asm prints it with line:column
+ */
+
+#define EMU_ASM_CONST_LABELS 64
+
+template <size_t N>
+struct EAsmLiteral
+{
+	char text_[N] = {};
+
+	consteval
+	EAsmLiteral(
+		const char (&text)[N])
+	{
+		for (size_t i = 0; i < N; i++)
+			text_[i] = text[i];
+	}
+
+	[[nodiscard]] constexpr std::string_view
+	view() const
+	{
+		return { text_, N - 1 };
+	}
+};
+
+struct EAsmConstLabels
+{
+	std::string_view names_[EMU_ASM_CONST_LABELS] = {};
+	u32 addresses_[EMU_ASM_CONST_LABELS] = {};
+	u32 count_ = 0;
+};
+
+// deliberately not constexpr, reaching it while assembling at compile time is the compile error
+inline void
+emu_asm_const_error(
+	const char* what,
+	std::string_view text,
+	u32 line,
+	u32 column)
+{
+	LOG("%u:%u: %s '%.*s'", line, column, what, (int)text.size(), text.data());
+}
+
+[[nodiscard]] constexpr u32
+emu_asm_const_find(
+	const EAsmConstLabels& labels,
+	std::string_view name)
+{
+	for (u32 i = 0; i < labels.count_; i++)
+	{
+		if (labels.names_[i] == name)
+			return i;
+	}
+	return UINT32_MAX;
+}
+
+// pass one: labels and the number of words
+[[nodiscard]] constexpr u32
+emu_asm_const_labels(
+	std::string_view source,
+	EAsmConstLabels& labels)
+{
+	ELexer lexer = { source };
+	EAsmLine line = {};
+	u32 words = 0;
+	while (emu_asm_read_line(lexer, line))
+	{
+		if (line.count_ != 0 && line.tokens_[0].kind_ == ETOKEN_LABEL)
+		{
+			const EToken& label = line.tokens_[0];
+			if (emu_asm_const_find(labels, label.text_) != UINT32_MAX)
+				emu_asm_const_error("Label is defined twice", label.text_, label.line_, label.column_);
+			// at run time the error returns, names_ has no room for another one
+			if (labels.count_ == EMU_ASM_CONST_LABELS)
+			{
+				emu_asm_const_error("More than EMU_ASM_CONST_LABELS labels at", label.text_, label.line_, label.column_);
+				return words;
+			}
+
+			labels.names_[labels.count_] = label.text_;
+			labels.addresses_[labels.count_++] = words;
+		}
+
+		words += line.count_ > (line.count_ != 0 && line.tokens_[0].kind_ == ETOKEN_LABEL);
+	}
+	return words;
+}
+
+[[nodiscard]] constexpr u32
+emu_asm_const_words(
+	std::string_view source)
+{
+	EAsmConstLabels labels;
+	return emu_asm_const_labels(source, labels);
+}
+
+// pass two
+template <u32 WORDS, u32 REG_COUNT>
+[[nodiscard]] constexpr std::array<EInstruction, WORDS>
+emu_asm_const_encode(
+	std::string_view source)
+{
+	EAsmConstLabels labels;
+	(void)emu_asm_const_labels(source, labels);
+
+	const auto report_at = [](const EToken& at, const char* what) {
+		emu_asm_const_error(what, at.text_, at.line_, at.column_);
+	};
+	const auto find = [&](const EToken& label) {
+		return emu_asm_const_find(labels, label.text_);
+	};
+
+	std::array<EInstruction, WORDS> code = {};
+	ELexer lexer = { source };
+	EAsmLine line = {};
+	u32 word = 0;
+	while (emu_asm_read_line(lexer, line))
+	{
+		u32 t = line.count_ != 0 && line.tokens_[0].kind_ == ETOKEN_LABEL;
+		if (t == line.count_)
+			continue;
+
+		const u32 w = word++;
+		EAsmFixup refs[2] = {};
+		u32 refs_count = 0;
+		if (!emu_asm_encode_line<REG_COUNT>(line, t, w, code[w], refs, refs_count, find, report_at))
+			continue;
+
+		for (u32 i = 0; i < refs_count; i++)
+		{
+			if (!emu_asm_patch(code[w], refs[i], labels.addresses_[refs[i].symbol_]))
+				emu_asm_const_error("Label is past word 15, a direct operand can't hold", labels.names_[refs[i].symbol_], refs[i].line_, refs[i].column_);
+		}
+	}
+	return code;
+}
+
+template <EAsmLiteral SOURCE, u32 RAM_WORDS = EState::ram_words_, u32 REG_COUNT = EState::registers_count_>
+[[nodiscard]] consteval auto
+emu_asm_const()
+{
+	constexpr u32 words = emu_asm_const_words(SOURCE.view());
+	static_assert(words <= RAM_WORDS, "Too much code, ram is full");
+	return emu_asm_const_encode<words, REG_COUNT>(SOURCE.view());
+}
@@ -0,0 +1,348 @@
+#pragma once
+#include "e_base.h"
+#include "e_asm.h"
+
+#include <string>
+#include <vector>
+
+/*
+ * INCREMENTAL ASSEMBLER:
+ *   - EAsmIncremental keeps every source line with what emu_asm made of it (label, encoded
+ *     word with the label operands left at 0, label references, error) plus the symbol table
+ *     and the words
+ *   - emu_asm_edit replaces a range of lines: only the new lines are lexed and encoded, the
+ *     words after them move as a block, and the only other lines touched are the users of
+ *     labels that were removed, added or moved, which get their label operands patched again
+ *   - for a source without errors code_ is exactly the compilled_code of emu_asm on the same
+ *     text, errors are kept per line (emu_asm_incremental_diagnostics numbers them)
+ *   - a label defined twice is an error on every definition but the first in source order, the
+ *     first one gives the label its address, edits anywhere move the error along like emu_asm
+ *     would on the new text
+ *   - only the new lines are lexed and encoded, but code_ and order_ are flat vectors: an edit
+ *     memmoves everything after it, and if it changes the number of words every later line is
+ *     shifted and the users of every later label are patched again, so an edit costs O(lines
+ *     after it), it is not independent of the program size
+ */
+
+struct EAsmIncLine
+{
+	std::string text_;
+	u32 word_ = 0;            // word the line emits, or the next one if it emits nothing
+	bool emits_ = false;
+	u32 label_ = UINT32_MAX;  // symbol the line defines
+	u32 label_column_ = 0;
+	bool label_twice_ = false; // an earlier line defines the label too
+	EInstruction base_ = {};  // encoded word, label operands at 0
+	EAsmFixup refs_[2] = {};
+	u32 refs_count_ = 0;
+	std::string error_;       // lexing / encoding error, empty if none
+	u32 error_column_ = 0;
+	bool label_error_ = false; // a referenced label is undefined or past word 15
+};
+
+template <u32 RAM_WORDS, u32 REG_COUNT>
+struct EAsmIncrementalT
+{
+	static constexpr u32 ram_words_ = RAM_WORDS;
+	static constexpr u32 registers_count_ = REG_COUNT;
+
+	std::vector<EAsmIncLine> lines_;        // by line id, ids are stable across edits
+	std::vector<u32> order_;                // source order of the line ids
+	std::vector<u32> free_;                 // ids of deleted lines
+	EAsmSymbolTable symbols_;
+	std::vector<std::vector<u32>> definers_; // line ids defining each symbol, the first in source order counts
+	std::vector<std::vector<u32>> users_;   // line ids referencing each symbol
+	std::vector<EInstruction> code_;
+	u32 errors_ = 0;                        // lines with an error
+	u32 encoded_ = 0;                       // lines lexed and encoded by the last edit
+};
+
+using EAsmIncremental = EAsmIncrementalT<EState::ram_words_, EState::registers_count_>;
+
+template <u32 RAM_WORDS, u32 REG_COUNT>
+u32
+emu_asm_inc_intern(
+	EAsmIncrementalT<RAM_WORDS, REG_COUNT>& inc,
+	std::string_view name)
+{
+	u32 symbol = emu_asm_symbol_intern(inc.symbols_, name);
+	if (symbol >= inc.definers_.size())
+	{
+		inc.definers_.resize(symbol + 1);
+		inc.users_.resize(symbol + 1);
+	}
+	return symbol;
+}
+
+[[nodiscard]] inline bool
+emu_asm_inc_has_error(
+	const EAsmIncLine& line)
+{
+	return !line.error_.empty() || line.label_error_ || line.label_twice_;
+}
+
+inline void
+emu_asm_inc_unlink(
+	std::vector<u32>& ids,
+	u32 id)
+{
+	auto it = std::find(ids.begin(), ids.end(), id);
+	if (it != ids.end())
+	{
+		*it = ids.back();
+		ids.pop_back();
+	}
+}
+
+// the first definition in source order gives the label its address, the others are errors,
+// positions (line id to source line) is filled on the first duplicate of an edit
+template <u32 RAM_WORDS, u32 REG_COUNT>
+void
+emu_asm_inc_define(
+	EAsmIncrementalT<RAM_WORDS, REG_COUNT>& inc,
+	u32 symbol,
+	std::vector<u32>& positions)
+{
+	const auto& definers = inc.definers_[symbol];
+	EAsmSymbol& s = inc.symbols_.symbols_[symbol];
+	s.defined_ = !definers.empty();
+	if (definers.empty())
+		return;
+
+	u32 first = definers[0];
+	if (definers.size() > 1)
+	{
+		if (positions.empty())
+		{
+			positions.resize(inc.lines_.size());
+			for (u32 i = 0; i < inc.order_.size(); i++)
+				positions[inc.order_[i]] = i;
+		}
+		for (u32 id : definers)
+			first = positions[id] < positions[first] ? id : first;
+	}
+
+	s.address_ = inc.lines_[first].word_;
+	for (u32 id : definers)
+	{
+		EAsmIncLine& line = inc.lines_[id];
+		bool had_error = emu_asm_inc_has_error(line);
+		line.label_twice_ = id != first;
+		inc.errors_ += (u32)emu_asm_inc_has_error(line) - (u32)had_error;
+	}
+}
+
+// patches the label operands of the line into code_
+template <u32 RAM_WORDS, u32 REG_COUNT>
+void
+emu_asm_inc_resolve(
+	EAsmIncrementalT<RAM_WORDS, REG_COUNT>& inc,
+	u32 id)
+{
+	EAsmIncLine& line = inc.lines_[id];
+	if (!line.emits_ || !line.error_.empty())
+		return;
+
+	bool had_error = emu_asm_inc_has_error(line);
+	EInstruction word = line.base_;
+	line.label_error_ = false;
+	for (u32 i = 0; i < line.refs_count_; i++)
+	{
+		const EAsmSymbol& symbol = inc.symbols_.symbols_[line.refs_[i].symbol_];
+		if (!symbol.defined_ || !emu_asm_patch(word, line.refs_[i], symbol.address_))
+			line.label_error_ = true;
+	}
+
+	// like emu_asm, a bad line leaves its word at 0
+	inc.code_[line.word_] = line.label_error_ ? EInstruction{} : word;
+	inc.errors_ += (u32)emu_asm_inc_has_error(line) - (u32)had_error;
+}
+
+// lexes and encodes text into line id at word, the label and its operands are resolved later
+template <u32 RAM_WORDS, u32 REG_COUNT>
+void
+emu_asm_inc_encode(
+	EAsmIncrementalT<RAM_WORDS, REG_COUNT>& inc,
+	u32 id,
+	u32 word,
+	std::vector<u32>& changed)
+{
+	EAsmIncLine& line = inc.lines_[id];
+	line.word_ = word;
+	inc.encoded_++;
+
+	const auto report_at = [&](const EToken& at, const char* what) {
+		if (!line.error_.empty())
+			return;
+		line.error_ = std::string(what) + " '" + std::string(at.text_) + "'";
+		line.error_column_ = at.column_;
+	};
+	const auto intern = [&](const EToken& label) {
+		return emu_asm_inc_intern(inc, label.text_);
+	};
+
+	ELexer lexer = { line.text_ };
+	EAsmLine tokens = {};
+	if (!emu_asm_read_line(lexer, tokens))
+		return;
+
+	u32 t = 0;
+	if (tokens.count_ != 0 && tokens.tokens_[0].kind_ == ETOKEN_LABEL)
+	{
+		line.label_ = emu_asm_inc_intern(inc, tokens.tokens_[0].text_);
+		line.label_column_ = tokens.tokens_[0].column_;
+		inc.definers_[line.label_].push_back(id);
+		changed.push_back(line.label_);
+		t = 1;
+	}
+
+	line.emits_ = t < tokens.count_;
+	if (line.emits_ && !emu_asm_encode_line<REG_COUNT>(tokens, t, word, line.base_, line.refs_, line.refs_count_, intern, report_at))
+		line.refs_count_ = 0;
+
+	for (u32 i = 0; i < line.refs_count_; i++)
+		inc.users_[line.refs_[i].symbol_].push_back(id);
+}
+
+// drops line id, its label and its references
+template <u32 RAM_WORDS, u32 REG_COUNT>
+void
+emu_asm_inc_release(
+	EAsmIncrementalT<RAM_WORDS, REG_COUNT>& inc,
+	u32 id,
+	std::vector<u32>& changed)
+{
+	EAsmIncLine& line = inc.lines_[id];
+	inc.errors_ -= emu_asm_inc_has_error(line);
+
+	if (line.label_ != UINT32_MAX)
+	{
+		emu_asm_inc_unlink(inc.definers_[line.label_], id);
+		changed.push_back(line.label_);
+	}
+
+	for (u32 i = 0; i < line.refs_count_; i++)
+		emu_asm_inc_unlink(inc.users_[line.refs_[i].symbol_], id);
+
+	line = {};
+	inc.free_.push_back(id);
+}
+
+// replaces lines [first, first + removed) with the lines of text ('\n' separated, "" inserts none)
+template <u32 RAM_WORDS, u32 REG_COUNT>
+Status
+emu_asm_edit(
+	EAsmIncrementalT<RAM_WORDS, REG_COUNT>& inc,
+	u32 first,
+	u32 removed,
+	std::string_view text)
+{
+	if (first > inc.order_.size() || removed > inc.order_.size() - first)
+		return FAILURE;
+
+	inc.encoded_ = 0;
+	std::vector<u32> changed;
+
+	// the words of the range
+	const u32 base = first < inc.order_.size() ? inc.lines_[inc.order_[first]].word_ : (u32)inc.code_.size();
+	u32 old_words = 0;
+	for (u32 i = first; i < first + removed; i++)
+	{
+		old_words += inc.lines_[inc.order_[i]].emits_;
+		emu_asm_inc_release(inc, inc.order_[i], changed);
+	}
+
+	std::vector<u32> ids;
+	std::vector<EInstruction> words;
+	for (size_t begin = 0; !text.empty() && begin <= text.size();)
+	{
+		size_t end = text.find('\n', begin);
+		end = end == std::string_view::npos ? text.size() : end;
+
+		u32 id = 0;
+		if (!inc.free_.empty())
+		{
+			id = inc.free_.back();
+			inc.free_.pop_back();
+		}
+		else
+		{
+			id = (u32)inc.lines_.size();
+			inc.lines_.emplace_back();
+		}
+
+		inc.lines_[id].text_ = text.substr(begin, end - begin);
+		emu_asm_inc_encode(inc, id, base + (u32)words.size(), changed);
+
+		const EAsmIncLine& line = inc.lines_[id];
+		inc.errors_ += !line.error_.empty();
+		if (line.emits_)
+			words.push_back(line.error_.empty() ? line.base_ : EInstruction{});
+		ids.push_back(id);
+		begin = end + 1;
+	}
+
+	inc.code_.erase(inc.code_.begin() + base, inc.code_.begin() + base + old_words);
+	inc.code_.insert(inc.code_.begin() + base, words.begin(), words.end());
+	inc.order_.erase(inc.order_.begin() + first, inc.order_.begin() + first + removed);
+	inc.order_.insert(inc.order_.begin() + first, ids.begin(), ids.end());
+
+	// everything after the range moves as a block, labels with it
+	const i32 delta = (i32)words.size() - (i32)old_words;
+	if (delta != 0)
+	{
+		for (size_t i = first + ids.size(); i < inc.order_.size(); i++)
+		{
+			EAsmIncLine& line = inc.lines_[inc.order_[i]];
+			line.word_ += delta;
+			if (line.label_ != UINT32_MAX)
+				changed.push_back(line.label_);
+		}
+	}
+
+	std::vector<u32> positions;
+	for (u32 symbol : changed)
+		emu_asm_inc_define(inc, symbol, positions);
+
+	for (u32 id : ids)
+		emu_asm_inc_resolve(inc, id);
+	for (u32 symbol : changed)
+	{
+		for (u32 id : inc.users_[symbol])
+			emu_asm_inc_resolve(inc, id);
+	}
+
+	return inc.errors_ == 0 && inc.code_.size() <= RAM_WORDS ? SUCCESS : FAILURE;
+}
+
+// the errors with their current line numbers (1 based, like the lexer)
+template <u32 RAM_WORDS, u32 REG_COUNT>
+[[nodiscard]] std::vector<EAsmDiagnostic>
+emu_asm_incremental_diagnostics(
+	const EAsmIncrementalT<RAM_WORDS, REG_COUNT>& inc)
+{
+	std::vector<EAsmDiagnostic> diagnostics;
+	for (u32 i = 0; i < inc.order_.size(); i++)
+	{
+		const EAsmIncLine& line = inc.lines_[inc.order_[i]];
+		if (line.label_twice_)
+			diagnostics.push_back({ i + 1, line.label_column_, "Label is defined twice '" + std::string(emu_asm_symbol_name(inc.symbols_, inc.symbols_.symbols_[line.label_])) + "'" });
+		if (!line.error_.empty())
+			diagnostics.push_back({ i + 1, line.error_column_, line.error_ });
+		if (!line.label_error_)
+			continue;
+
+		for (u32 r = 0; r < line.refs_count_; r++)
+		{
+			const EAsmSymbol& symbol = inc.symbols_.symbols_[line.refs_[r].symbol_];
+			const char* what = !symbol.defined_ ? "Unresolved label" : symbol.address_ > 0b1111 ? "Label is past word 15, a direct operand can't hold" : nullptr;
+			if (what)
+				diagnostics.push_back({ i + 1, line.refs_[r].column_, std::string(what) + " '" + std::string(emu_asm_symbol_name(inc.symbols_, symbol)) + "'" });
+		}
+	}
+
+	if (inc.code_.size() > RAM_WORDS)
+		diagnostics.push_back({ (u32)inc.order_.size(), 0, "Too much code, ram is full" });
+
+	return diagnostics;
+}
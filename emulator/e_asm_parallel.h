@@ -0,0 +1,188 @@
+#pragma once
+#include "e_base.h"
+#include "e_asm.h"
+
+#include <atomic>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+ * PARALLEL ASSEMBLER:
+ *   - pass one is sequential and cheap: per line only the first two tokens are lexed (is
+ *     there a label, does the line emit a word), then memchr skips to the next '\n' (a comment
+ *     can't hide one), labels are defined and the source is cut into chunks of
+ *     EMU_ASM_CHUNK_LINES lines, each knowing its first line and its first word
+ *   - pass two encodes the chunks on all cores with emu_asm_encode_line, every label is known
+ *     by then so the label operands are patched on the spot, each chunk writes only its own
+ *     range of compilled_code
+ *   - diagnostics are collected per chunk and come out in source order; for a source without
+ *     errors compilled_code is exactly what emu_asm produces, with errors the same lines are
+ *     reported, a label defined twice keeps its first address like in emu_asm
+ *   - with one thread it is just emu_asm
+ */
+
+#define EMU_ASM_CHUNK_LINES 4096
+
+struct EAsmChunk
+{
+	size_t begin_;  // byte offset of the first line
+	size_t end_;
+	u32 line_;      // 1 based, like the lexer
+	u32 word_;      // first word the chunk emits
+	std::vector<EAsmDiagnostic> diagnostics_;
+};
+
+template <u32 RAM_WORDS, u32 REG_COUNT>
+Status
+emu_asm_parallel(
+	EAsmCompillerDataT<RAM_WORDS, REG_COUNT>& compiller_data,
+	std::string_view asm_code,
+	u32 threads = 0)
+{
+	if (threads == 0)
+		threads = std::max(1u, std::thread::hardware_concurrency());
+
+	// pass one would be pure overhead on one core
+	if (threads == 1)
+		return emu_asm(compiller_data, asm_code);
+
+	auto& symbols = compiller_data.symbols_;
+	auto& diagnostics = compiller_data.diagnostics_;
+	symbols = {};
+	diagnostics.clear();
+
+	const auto diagnostic = [](const EToken& at, const char* what) -> EAsmDiagnostic {
+		return { at.line_, at.column_, std::string(what) + " '" + std::string(at.text_) + "'" };
+	};
+
+	// pass one: labels, words and chunks
+	std::vector<EAsmChunk> chunks;
+	std::vector<EAsmDiagnostic> labels_diagnostics;
+	size_t pos = 0;
+	u32 line = 1;
+	u32 word = 0;
+	while (pos < asm_code.size())
+	{
+		if ((line - 1) % EMU_ASM_CHUNK_LINES == 0)
+		{
+			if (!chunks.empty())
+				chunks.back().end_ = pos;
+			chunks.push_back({ pos, asm_code.size(), line, word, {} });
+		}
+
+		const char* eol = (const char*)memchr(asm_code.data() + pos, '\n', asm_code.size() - pos);
+		const size_t end = eol ? (size_t)(eol - asm_code.data()) : asm_code.size();
+
+		ELexer lexer = { asm_code.substr(0, end), pos, pos, line };
+		EToken first = emu_lex_next(lexer);
+		EToken second = first.kind_ == ETOKEN_LABEL ? emu_lex_next(lexer) : first;
+		if (first.kind_ == ETOKEN_LABEL)
+		{
+			EAsmSymbol& symbol = symbols.symbols_[emu_asm_symbol_intern(symbols, first.text_)];
+			if (symbol.defined_)
+				labels_diagnostics.push_back(diagnostic(first, "Label is defined twice"));
+			else
+			{
+				symbol.address_ = word;
+				symbol.defined_ = true;
+			}
+		}
+
+		if (second.kind_ != ETOKEN_END)
+		{
+			// like emu_asm, nothing after the word that doesn't fit is looked at
+			if (word >= RAM_WORDS)
+			{
+				labels_diagnostics.push_back(diagnostic(second, "Too much code, ram is full at"));
+				chunks.back().end_ = pos;
+				break;
+			}
+			word++;
+		}
+
+		pos = end + 1;
+		line++;
+	}
+
+	// pass two: encode, symbols_ is only read from here on
+	std::atomic<u32> next = 0;
+	const auto worker = [&]() {
+		for (u32 c = next++; c < chunks.size(); c = next++)
+		{
+			EAsmChunk& chunk = chunks[c];
+			const auto report_at = [&](const EToken& at, const char* what) {
+				chunk.diagnostics_.push_back(diagnostic(at, what));
+			};
+			// an undefined label gets an index past the table so the line is still checked
+			std::vector<std::string_view> undefined;
+			const auto find = [&](const EToken& label) {
+				const EAsmSymbol* symbol = emu_asm_symbol_find(symbols, label.text_);
+				if (symbol)
+					return (u32)(symbol - symbols.symbols_.data());
+				undefined.push_back(label.text_);
+				return (u32)(symbols.symbols_.size() + undefined.size() - 1);
+			};
+
+			ELexer lexer = { asm_code.substr(0, chunk.end_), chunk.begin_, chunk.begin_, chunk.line_ };
+			EAsmLine tokens = {};
+			u32 code_line = chunk.word_;
+			while (emu_asm_read_line(lexer, tokens))
+			{
+				u32 t = tokens.count_ != 0 && tokens.tokens_[0].kind_ == ETOKEN_LABEL;
+				if (t == tokens.count_)
+					continue;
+
+				const u32 w = code_line++;
+				EInstruction compilled_instruction = {};
+				EAsmFixup refs[2];
+				u32 refs_count = 0;
+				if (!emu_asm_encode_line<REG_COUNT>(tokens, t, w, compilled_instruction, refs, refs_count, find, report_at))
+					continue;
+
+				bool bad_label = false;
+				for (u32 i = 0; i < refs_count; i++)
+				{
+					if (refs[i].symbol_ >= symbols.symbols_.size())
+					{
+						chunk.diagnostics_.push_back({ refs[i].line_, refs[i].column_,
+							"Unresolved label '" + std::string(undefined[refs[i].symbol_ - symbols.symbols_.size()]) + "'" });
+						bad_label = true;
+						continue;
+					}
+
+					const EAsmSymbol& symbol = symbols.symbols_[refs[i].symbol_];
+					if (!emu_asm_patch(compilled_instruction, refs[i], symbol.address_))
+					{
+						chunk.diagnostics_.push_back({ refs[i].line_, refs[i].column_,
+							"Label is past word 15, a direct operand can't hold '" + std::string(emu_asm_symbol_name(symbols, symbol)) + "'" });
+						bad_label = true;
+					}
+				}
+				if (!bad_label)
+					compiller_data.compilled_code[w] = compilled_instruction;
+			}
+		}
+	};
+
+	std::vector<std::thread> pool;
+	for (u32 t = 1; t < std::min<u32>(threads, (u32)chunks.size()); t++)
+		pool.emplace_back(worker);
+	worker();
+	for (auto& t : pool)
+		t.join();
+
+	// source order, the label errors of pass one go in by line
+	for (auto& chunk : chunks)
+		diagnostics.insert(diagnostics.end(), chunk.diagnostics_.begin(), chunk.diagnostics_.end());
+	if (!labels_diagnostics.empty())
+	{
+		diagnostics.insert(diagnostics.end(), labels_diagnostics.begin(), labels_diagnostics.end());
+		std::stable_sort(diagnostics.begin(), diagnostics.end(), [](const EAsmDiagnostic& a, const EAsmDiagnostic& b) {
+			return a.line_ != b.line_ ? a.line_ < b.line_ : a.column_ < b.column_;
+		});
+	}
+
+	return diagnostics.empty() ? SUCCESS : FAILURE;
+}
@@ -0,0 +1,157 @@
+#pragma once
+#include "e_base.h"
+#include "e_asm.h"
+
+#include <cerrno>
+#include <cstring>
+#include <istream>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <unistd.h>
+#define EMU_ASM_STREAM_FD 1
+#else
+#define EMU_ASM_STREAM_FD 0
+#endif
+
+/*
+ * STREAMING ASSEMBLER:
+ *   - emu_asm_stream reads the source through read(buffer, capacity) -> bytes (0 at the end) in
+ *     EMU_ASM_STREAM_CHUNK byte blocks, the complete lines of a block go through emu_asm_line
+ *     (the same pass one emu_asm runs, words are emitted straight into compilled_code) and the
+ *     unfinished last line is moved to the front of the buffer for the next read
+ *   - forward references wait in the fixup list, emu_asm_resolve patches them at the end
+ *   - memory is the buffer (one chunk, more only for a line longer than that), the symbol
+ *     table and the fixups, the source is never held whole
+ *   - emu_asm_stream_fd / emu_asm_stream_istream / emu_asm_stream_file wrap the usual sources,
+ *     a failed read (read() error, ferror, a bad stream) ends the source there and sticks: the
+ *     result is FAILURE whatever the lines read before it assembled to
+ */
+
+#define EMU_ASM_STREAM_CHUNK (64 * 1024)
+
+template <u32 RAM_WORDS, u32 REG_COUNT, typename Read>
+Status
+emu_asm_stream(
+	EAsmCompillerDataT<RAM_WORDS, REG_COUNT>& compiller_data,
+	Read&& read)
+{
+	compiller_data.symbols_ = {};
+	compiller_data.diagnostics_.clear();
+
+	std::vector<EAsmFixup> fixups;
+	std::vector<char> buffer(EMU_ASM_STREAM_CHUNK);
+	size_t kept = 0;   // unfinished line at the front of buffer
+	u32 line_number = 1;
+	u32 code_line = 0;
+	bool full = false;
+
+	for (bool end = false; !end && !full;)
+	{
+		if (kept == buffer.size())
+			buffer.resize(buffer.size() * 2);
+
+		size_t got = read(buffer.data() + kept, buffer.size() - kept);
+		end = got == 0;
+		size_t size = kept + got;
+
+		// only whole lines, unless this is the end of the source
+		size_t lines_end = size;
+		if (!end)
+		{
+			while (lines_end && buffer[lines_end - 1] != '\n')
+				lines_end--;
+		}
+
+		ELexer lexer = { std::string_view(buffer.data(), lines_end), 0, 0, line_number };
+		EAsmLine line = {};
+		while (!full && emu_asm_read_line(lexer, line))
+			full = !emu_asm_line(compiller_data, line, code_line, fixups);
+		line_number = lexer.line_;
+
+		kept = size - lines_end;
+		std::memmove(buffer.data(), buffer.data() + lines_end, kept);
+	}
+
+	return emu_asm_resolve(compiller_data, fixups);
+}
+
+template <u32 RAM_WORDS, u32 REG_COUNT>
+Status
+emu_asm_stream_istream(
+	EAsmCompillerDataT<RAM_WORDS, REG_COUNT>& compiller_data,
+	std::istream& in)
+{
+	bool failed = false;
+	Status status = emu_asm_stream(compiller_data, [&](char* out, size_t capacity) -> size_t {
+		if (failed)
+			return 0;
+		in.read(out, (std::streamsize)capacity);
+		failed = in.bad();
+		return (size_t)in.gcount();
+	});
+	return failed ? FAILURE : status;
+}
+
+#if EMU_ASM_STREAM_FD
+
+// the fd is read to its end but not closed
+template <u32 RAM_WORDS, u32 REG_COUNT>
+Status
+emu_asm_stream_fd(
+	EAsmCompillerDataT<RAM_WORDS, REG_COUNT>& compiller_data,
+	i32 fd)
+{
+	bool failed = false;
+	Status status = emu_asm_stream(compiller_data, [&](char* out, size_t capacity) -> size_t {
+		while (!failed)
+		{
+			ssize_t got = ::read(fd, out, capacity);
+			if (got >= 0)
+				return (size_t)got;
+			if (errno != EINTR)
+			{
+				LOG("Read failed: %s", strerror(errno));
+				failed = true;
+			}
+		}
+		return 0;
+	});
+	return failed ? FAILURE : status;
+}
+
+#endif
+
+// "-" is stdin
+template <u32 RAM_WORDS, u32 REG_COUNT>
+Status
+emu_asm_stream_file(
+	EAsmCompillerDataT<RAM_WORDS, REG_COUNT>& compiller_data,
+	const char* filepath)
+{
+	const bool is_stdin = std::string_view(filepath) == "-";
+	FILE* f = is_stdin ? stdin : fopen(filepath, "rb");
+	if (!f)
+	{
+		LOG("Can't open file: %s", filepath);
+		return FILE_NOT_FOUND;
+	}
+
+	bool failed = false;
+	Status status = emu_asm_stream(compiller_data, [&](char* out, size_t capacity) -> size_t {
+		if (failed)
+			return 0;
+		size_t got = fread(out, 1, capacity, f);
+		if (got < capacity && ferror(f))
+		{
+			LOG("Read failed: %s: %s", filepath, strerror(errno));
+			failed = true;
+		}
+		return got;
+	});
+
+	if (!is_stdin)
+		fclose(f);
+	return failed ? FAILURE : status;
+}
@@ -5,8 +5,8 @@
 /*
  * ARCH:
  *   - bus 24
- *   - RAM 4096
- *   - registers 8
+ *   - RAM 4096 bytes (RAM_SIZE), EStateT<words, registers> sizes it anywhere up to the 24 bit bus
+ *   - registers 9 (REGISTERS_COUNT, r0..r8), up to 16 fit the 4 bit register fields
  * ARITHMETIC:
  *   - INC regA ; increment by one
  *   - IDIV regA regB destReg ; sign division destReg=regA/regB
@@ -18,6 +18,7 @@
  * FLOW CONTROL:
  *   - JMA regA regB offSet ; no sign if (regA> regB) PC=PC+1+offSet
  *   - JMBE regA regB offSet ; no sign if (regA<= regB) PC=PC+1+offSet
+ *   - offSet is a signed 12 bit field (-2048..2047), so branches can go backwards
  * FLAGS:
  *   - CF
  *   - ADC regA regB destReg ; addition with CF: destReg=regA+regB+CF
@@ -31,23 +32,21 @@
  *   - Direct (using operands)
  */
 
-#include <map>
-#include <regex>
-#include <bitset>
 #include <sstream>
 #include <algorithm>
-#include <unordered_map>
 
 #include <cstdio>
+#include <cstring>
 #include <cstdint>
 #include <cassert>
+#include <type_traits>
 
 #define RAM_SIZE 4096
 #define REGISTERS_COUNT 9
 
 #define ARRAY_SIZE(x) (sizeof(x)/sizeof(x[0]))
 #define CONCAT(x, y) x ## y
-#define LOG(fmt, ...) printf(__FILE__ ": " fmt "\n", __VA_ARGS__)
+#define LOG(fmt, ...) printf(__FILE__ ": " fmt "\n" __VA_OPT__(,) __VA_ARGS__)
 #define ASSERT assert
 #define IN_RANGE(val, min, max) (min < val && val < max)
 #define IN_RANGE_E(val, min, max) (min <= val && val <= max)
@@ -63,6 +62,8 @@ using u16 = uint16_t;
 using i16 = int16_t;
 using u32 = uint32_t;
 using i32 = int32_t;
+using u64 = uint64_t;
+using i64 = int64_t;
 using i8 = int8_t;
 using u8 = uint8_t;
 
@@ -141,13 +142,13 @@ static constexpr EOpcodeDesc opcode_descriptions[] = {
 using ERegister = u16;
 struct EBusBase
 {
-	[[nodiscard]] u32
-		get_value()
+	[[nodiscard]] constexpr u32
+		get_value() const
 	{
 		return BITS_MASKED_COPY(data, BITS_27_MASK);
 	}
 
-	void
+	constexpr void
 		set_value(u32 v)
 	{
 		data = BITS_MASKED_COPY(v, BITS_27_MASK);
@@ -167,37 +168,44 @@ struct EBusBase
 
 struct EInstruction : EBusBase
 {
-	[[ no_discard ]] u32
-		get_opcode()
+	[[ no_discard ]] constexpr u32
+		get_opcode() const
 	{
 		return BITS_MASKED_COPY(get_value(), 0b11111 << 22) >> 22;
 	}
 
-	[[ no_discard ]] std::pair<u32, bool>
-		get_reg_a()
+	[[ no_discard ]] constexpr std::pair<u32, bool>
+		get_reg_a() const
 	{
 		return { BITS_MASKED_COPY(get_value(), 0b1111 << 17) >> 17, BITS_MASKED_COPY(get_value(), 0b1 << 21) >> 21 };
 	}
 
-	[[ no_discard ]] std::pair<u32, bool>
-		get_reg_b()
+	[[ no_discard ]] constexpr std::pair<u32, bool>
+		get_reg_b() const
 	{
 		return { BITS_MASKED_COPY(get_value(), 0b1111 << 12) >> 12, BITS_MASKED_COPY(get_value(), 0b1 << 16) >> 16 };
 	}
 
-	[[ no_discard ]] u32
-		get_reg_r()
+	[[ no_discard ]] constexpr u32
+		get_reg_r() const
 	{
 		return BITS_MASKED_COPY(get_value(), 0b1111);
 	}
 
-	[[ no_discard ]] u32
-		get_operand()
+	[[ no_discard ]] constexpr u32
+		get_operand() const
 	{
 		return BITS_MASKED_COPY(get_value(), BITS_12_MASK);
 	}
 
-	static EInstruction create_ra_rb_rr(u32 opcode, u32 ra, u32 rb, u32 rr, u32 ra_direct = 0, u32 rb_direct = 0)
+	// operand field as a signed 12 bit offset (two's complement)
+	[[ no_discard ]] constexpr i32
+		get_offset() const
+	{
+		return (i32)(get_operand() << 20) >> 20;
+	}
+
+	static constexpr EInstruction create_ra_rb_rr(u32 opcode, u32 ra, u32 rb, u32 rr, u32 ra_direct = 0, u32 rb_direct = 0)
 	{
 		ASSERT(IN_RANGE_E(opcode, 0, 0b11111));
 		ASSERT(IN_RANGE_E(ra, 0, 0b1111));
@@ -238,7 +246,7 @@ struct EInstruction : EBusBase
 		return ret;
 	}
 
-	static EInstruction create_ra_rb_offset(u32 opcode, u32 ra, u32 rb, u32 offset, u32 ra_direct = 0, u32 rb_direct = 0)
+	static constexpr EInstruction create_ra_rb_offset(u32 opcode, u32 ra, u32 rb, u32 offset, u32 ra_direct = 0, u32 rb_direct = 0)
 	{
 		ASSERT(IN_RANGE_E(offset, 0, BITS_12_MASK));
 		ASSERT(IN_RANGE_E(opcode, 0, 0b11111));
@@ -269,7 +277,7 @@ struct EInstruction : EBusBase
 
 		to_set ^= offset;
 
-		LOG("Curr: %s", std::bitset<32>(to_set).to_string().c_str());
+		//LOG("Curr: %s", std::bitset<32>(to_set).to_string().c_str());
 
 		EInstruction ret = {};
 		ret.set_value(to_set);
@@ -296,20 +304,37 @@ struct EFlags
 };
 
 
-struct EState
+#define EMU_BUS_WORDS (1u << 24)
+
+// the program counter is 16 bit like the registers unless ram_ has more words than that
+template <u32 RAM_WORDS>
+using EProgramCounter = std::conditional_t<(RAM_WORDS > 0x10000), u32, ERegister>;
+
+template <u32 RAM_WORDS, u32 REG_COUNT>
+struct EStateT
 {
+	static_assert(IN_RANGE_E(RAM_WORDS, 1u, EMU_BUS_WORDS), "ram_ has to fit the 24 bit bus");
+	static_assert(IN_RANGE_E(REG_COUNT, 1u, 16u), "register fields are 4 bit");
+
+	static constexpr u32 ram_words_ = RAM_WORDS;
+	static constexpr u32 registers_count_ = REG_COUNT;
+	using pc_t = EProgramCounter<RAM_WORDS>;
+
 	EInstruction command_register_;
-	ERegister program_counter_;
+	pc_t program_counter_;
 
-	ERegister r_[REGISTERS_COUNT];
+	ERegister r_[REG_COUNT];
 	EFlags f_;
 
-	EInstruction ram_[RAM_SIZE / sizeof(EInstruction)] = {};
+	EInstruction ram_[RAM_WORDS] = {};
 
 	bool halt_; // TODO - think maybe it should be a flag ?
 	bool no_pc_increment_;
 };
 
+// the default machine, big configs (up to EMU_BUS_WORDS) belong on the heap
+using EState = EStateT<RAM_SIZE / sizeof(EInstruction), REGISTERS_COUNT>;
+
 
 [[nodiscard]] size_t
 get_file_size(
@@ -321,29 +346,35 @@ get_file_size(
 	return sz;
 }
 
+template <u32 RAM_WORDS, u32 REG_COUNT>
 Status
 emu_load_image(
-	EState& state,
+	EStateT<RAM_WORDS, REG_COUNT>& state,
 	const char* filepath)
 {
 	FILE* f = fopen(filepath, "rb");
 	if (!f)
 	{
 		LOG("Image not found!");
-		ASSERT(false);
 		return FILE_NOT_FOUND;
 	}
 
+	// a raw dump of the whole ram_, see e_image.h for the format with a header
 	size_t filesize = get_file_size(f);
-	if (filesize != ARRAY_SIZE(state.ram_))
+	if (filesize != sizeof(state.ram_))
 	{
 		LOG("Invalid file!");
-		ASSERT(false);
+		fclose(f);
 		return INVALID_FILE;
 	}
 
-	fread_s(&state.ram_, ARRAY_SIZE(state.ram_), sizeof(*state.ram_), ARRAY_SIZE(state.ram_), f);
+	size_t read = fread(&state.ram_, sizeof(*state.ram_), ARRAY_SIZE(state.ram_), f);
 	fclose(f);
+	if (read != ARRAY_SIZE(state.ram_))
+	{
+		LOG("Image read failed!");
+		return INVALID_FILE;
+	}
 
 	state.command_register_ = { 0 };
 	state.program_counter_ = { 0 };
@@ -351,9 +382,10 @@ emu_load_image(
 	return SUCCESS;
 }
 
+template <u32 RAM_WORDS, u32 REG_COUNT>
 inline Status
 emu_load_next(
-	EState& state)
+	EStateT<RAM_WORDS, REG_COUNT>& state)
 {
 	state.command_register_ = state.ram_[state.program_counter_];
 
@@ -364,11 +396,14 @@ emu_load_next(
 
 #define EARG(x) ((x).second ? (x).first : &s->r_[(x).first])
 
+template <u32 RAM_WORDS, u32 REG_COUNT>
 Status
 emu_process(
-	EState& state)
+	EStateT<RAM_WORDS, REG_COUNT>& state)
 {
-	const auto emu_add = [](EState* s) {
+	using S = EStateT<RAM_WORDS, REG_COUNT>;
+
+	const auto emu_add = [](S* s) {
 		// destReg = regA + regB
 		auto i = s->command_register_;
 		auto rr = i.get_reg_r();
@@ -382,7 +417,7 @@ emu_process(
 		*arg_r = arg_a + arg_b;
 	};
 
-	const auto emu_nand = [](EState* s) {
+	const auto emu_nand = [](S* s) {
 		// destReg = !(regA && regB)
 		auto i = s->command_register_;
 
@@ -397,47 +432,47 @@ emu_process(
 		*arg_r = ~(arg_a & arg_b);
 	};
 
-	const auto emu_lw = [](EState* s) {
+	const auto emu_lw = [](S* s) {
 		// destReg = load from memory by OPERAND/LABEL
 		auto i = s->command_register_;
 		auto ra = i.get_reg_a();
 		auto rb = i.get_reg_b();
-		auto offset = i.get_operand();
+		auto offset = i.get_offset();
 		auto arg_a = ra.first;
 		auto arg_b = rb.second ? rb.first : s->r_[rb.first];
 		s->r_[arg_a] = (ERegister)s->ram_[arg_b + offset].get_value();
 	};
 
-	const auto emu_sw = [](EState* s) {
+	const auto emu_sw = [](S* s) {
 		// save to memory from regR by OPERAND/LABEL
 		auto i = s->command_register_;
 		auto ra = i.get_reg_a();
 		auto rb = i.get_reg_b();
-		auto offset = i.get_operand();
+		auto offset = i.get_offset();
 		auto arg_a = ra.first;
 		auto arg_b = rb.second ? rb.first : s->r_[rb.first];
 		s->ram_[arg_a + offset].set_value(arg_b);
 	};
 
-	const auto emu_beq = [](EState* s) {
+	const auto emu_beq = [](S* s) {
 		// if regR == regA goto ProgramCounter + 1 + shiftamount, in PC is saved addr of current instruction
 		auto i = s->command_register_;
 		auto ra = i.get_reg_a();
 		auto rb = i.get_reg_b();
-		auto offset = i.get_operand();
+		auto offset = i.get_offset();
 		auto arg_a = ra.second ? ra.first : s->r_[ra.first];
 		auto arg_b = rb.second ? rb.first : s->r_[rb.first];
 		if (arg_a == arg_b)
 			s->program_counter_ += offset;
 	};
 
-	const auto emu_jalr = [](EState* s) {
+	const auto emu_jalr = [](S* s) {
 		// saves PC+1 into regR. in PC is saved addr of current instruction. 
 		// Goto regA addr. if regR and regA is same register then first write PC + 1 and then goto PC + 1.
 		auto i = s->command_register_;
 		auto ra = i.get_reg_a();
 		auto rb = i.get_reg_b();
-		auto offset = i.get_operand();
+		auto offset = i.get_offset();
 		auto arg_b = rb.second ? rb.first : s->r_[rb.first];
 		
 		if (ra.second)
@@ -449,15 +484,15 @@ emu_process(
 		s->no_pc_increment_ = true;
 	};
 
-	const auto emu_halt = [](EState* s) {
+	const auto emu_halt = [](S* s) {
 		// PC + 1 and then STOP. Show message about emu stop
 		s->halt_ = true;
 	};
-	const auto emu_nop = [](EState* s) {
+	const auto emu_nop = [](S* s) {
 		// no operation
 	};
 
-	const auto emu_inc = [](EState* s) {
+	const auto emu_inc = [](S* s) {
 		// -INC regA; increment by one
 		auto i = s->command_register_;
 		auto ra = i.get_reg_a();
@@ -467,7 +502,7 @@ emu_process(
 			s->r_[ra.first]++;
 	};
 
-	const auto emu_idiv = [](EState* s) {
+	const auto emu_idiv = [](S* s) {
 		// * -IDIV regA regB destReg; sign division destReg = regA / regB
 		auto i = s->command_register_;
 
@@ -482,7 +517,7 @@ emu_process(
 		*arg_r = arg_a / arg_b;
 	};
 
-	const auto emu_imul = [](EState* s) {
+	const auto emu_imul = [](S* s) {
 		// * -IMUL regA regB destReg; sign multiplication destReg = regA * regB
 		auto i = s->command_register_;
 		auto rr = i.get_reg_r();
@@ -496,7 +531,7 @@ emu_process(
 		*arg_r = arg_a * arg_b;
 	};
 
-	const auto emu_and = [](EState* s) {
+	const auto emu_and = [](S* s) {
 		// *-AND regA regB destReg; destReg = regA & regB
 		auto i = s->command_register_;
 		auto rr = i.get_reg_r();
@@ -509,7 +544,7 @@ emu_process(
 
 		*arg_r = arg_a & arg_b;
 	};
-	const auto emu_xor = [](EState* s) {
+	const auto emu_xor = [](S* s) {
 		// * -XOR regA regB destReg; addition by module 2: destReg = regA # regB
 		auto i = s->command_register_;
 		auto rr = i.get_reg_r();
@@ -522,7 +557,7 @@ emu_process(
 
 		*arg_r = arg_a ^ arg_b;
 	};
-	const auto emu_shr = [](EState* s) {
+	const auto emu_shr = [](S* s) {
 		// * -SHR regA regB destReg; logic shift right destReg = regA >> regB
 		auto i = s->command_register_;
 		auto rr = i.get_reg_r();
@@ -536,7 +571,31 @@ emu_process(
 		*arg_r = arg_a >> arg_b;
 	};
 
-	const auto emu_adc = [](EState* s) {
+	const auto emu_jma = [](S* s) {
+		// * -JMA regA regB offSet; no sign if (regA > regB) PC = PC + 1 + offSet
+		auto i = s->command_register_;
+		auto ra = i.get_reg_a();
+		auto rb = i.get_reg_b();
+		auto offset = i.get_offset();
+		auto arg_a = ra.second ? ra.first : s->r_[ra.first];
+		auto arg_b = rb.second ? rb.first : s->r_[rb.first];
+		if (arg_a > arg_b)
+			s->program_counter_ += offset;
+	};
+
+	const auto emu_jmbe = [](S* s) {
+		// * -JMBE regA regB offSet; no sign if (regA <= regB) PC = PC + 1 + offSet
+		auto i = s->command_register_;
+		auto ra = i.get_reg_a();
+		auto rb = i.get_reg_b();
+		auto offset = i.get_offset();
+		auto arg_a = ra.second ? ra.first : s->r_[ra.first];
+		auto arg_b = rb.second ? rb.first : s->r_[rb.first];
+		if (arg_a <= arg_b)
+			s->program_counter_ += offset;
+	};
+
+	const auto emu_adc = [](S* s) {
 		// -ADC regA regB destReg; addition with CF : destReg = regA + regB + CF
 		auto i = s->command_register_;
 
@@ -552,7 +611,7 @@ emu_process(
 
 	};
 
-	const auto emu_sbb = [](EState* s) {
+	const auto emu_sbb = [](S* s) {
 		// * -SBB regA regB destReg; subtraction with CF : destReg = regA - regB - СF
 		auto i = s->command_register_;
 
@@ -567,7 +626,7 @@ emu_process(
 		*arg_r = arg_a - arg_b - s->f_.СF_;
 	};
 
-	const auto emu_cmp = [](EState* s) {
+	const auto emu_cmp = [](S* s) {
 		// *-CMP regA regB; cmp regA regBand set flags
 		// 	*             СF SF ZF
 		// 	* regA < regB 1  1  0
@@ -588,27 +647,28 @@ emu_process(
 			s->f_ = { .СF_ = false, .SF_ = false, .ZF_ = false };
 	};
 
-	using instruction_executor_t = void(*)(EState*);
-	static const std::unordered_map<u32, instruction_executor_t> cmd_executor = {
-		{ E_ADD,  emu_add  },
-		{ E_NAND, emu_nand },
-		{ E_LW,	  emu_lw   },
-		{ E_SW,	  emu_sw   },
-		{ E_BEQ,  emu_beq  },
-		{ E_JALR, emu_jalr },
-		{ E_HALT, emu_halt },
-		{ E_NOOP, emu_nop  },
-		{ E_INC,  emu_inc  },
-		{ E_IDIV, emu_idiv },
-		{ E_IMUL, emu_imul },
-		{ E_AND,  emu_and  },
-		{ E_XOR,  emu_xor  },
-		{ E_SHR,  emu_shr  },
-		{ E_JMA,  emu_nop  },
-		{ E_JMBE, emu_nop  },
-		{ E_ADC,  emu_adc  },
-		{ E_SBB,  emu_sbb  },
-		{ E_CMP,  emu_cmp  }
+	using instruction_executor_t = void(*)(S*);
+	// indexed by opcode - the table is hit on every step, so no hashing here
+	static const instruction_executor_t cmd_executor[__ECOMMAND_MAX] = {
+		/* E_ADD  */ emu_add,
+		/* E_NAND */ emu_nand,
+		/* E_LW   */ emu_lw,
+		/* E_SW   */ emu_sw,
+		/* E_BEQ  */ emu_beq,
+		/* E_JALR */ emu_jalr,
+		/* E_HALT */ emu_halt,
+		/* E_NOOP */ emu_nop,
+		/* E_INC  */ emu_inc,
+		/* E_IDIV */ emu_idiv,
+		/* E_IMUL */ emu_imul,
+		/* E_AND  */ emu_and,
+		/* E_XOR  */ emu_xor,
+		/* E_SHR  */ emu_shr,
+		/* E_JMA  */ emu_jma,
+		/* E_JMBE */ emu_jmbe,
+		/* E_ADC  */ emu_adc,
+		/* E_SBB  */ emu_sbb,
+		/* E_CMP  */ emu_cmp
 	};
 
 	auto i = state.command_register_;
@@ -619,9 +679,10 @@ emu_process(
 	ASSERT(IN_RANGE_E(opcode, 0, __ECOMMAND_LAST) && "Opcode is not found!");
 	ASSERT(IN_RANGE_E(state.program_counter_, 0, ARRAY_SIZE(state.ram_)) && "Error: program_counter inval");
 
-	auto it = cmd_executor.at(opcode);
+	if (opcode > __ECOMMAND_LAST)
+		return FAILURE;
 
-	it(&state);
+	cmd_executor[opcode](&state);
 
 	if (!state.no_pc_increment_)
 		state.program_counter_++;
@@ -631,22 +692,26 @@ emu_process(
 	return SUCCESS;
 }
 
+template <u32 RAM_WORDS, u32 REG_COUNT>
 Status
 emu_execute(
-	EState& state)
+	EStateT<RAM_WORDS, REG_COUNT>& state)
 {
 	while (!state.halt_)
 	{
 		emu_load_next(state);
-		emu_process(state);
+		// a bad opcode leaves the pc where it is, running on would never end
+		if (emu_process(state) != SUCCESS)
+			return FAILURE;
 	}
 
 	return SUCCESS;
 }
 
+template <u32 RAM_WORDS, u32 REG_COUNT>
 Status
 emu_show_state(
-	EState& state)
+	EStateT<RAM_WORDS, REG_COUNT>& state)
 {
 	LOG("");
 	LOG("Emulator state:");
@@ -0,0 +1,178 @@
+#pragma once
+#include "e_base.h"
+#include "e_asm.h"
+#include "e_predecode.h"
+#include "e_exec.h"
+
+#include <deque>
+#include <mutex>
+#include <memory>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+/*
+ * BATCH RUNNER:
+ *   - runs one assembled program for many seeds on all cores
+ *   - every seed is a job, jobs are dealt out to per worker deques in contiguous chunks,
+ *     a worker takes from the back of its own deque and steals from the front of the others
+ *     once it runs dry, so seeds that halt after 10 steps don't leave cores idle
+ *   - jobs run on the predecoded interpreter, the program is decoded once, every worker copies
+ *     it once and after each job puts back only the slots the job changed (the seed's words and
+ *     the range the interpreter re-decoded for stores)
+ *   - every job runs at most max_steps, exec_ says if it halted, ran out of budget or faulted,
+ *     so a seed that never halts costs its budget and nothing else
+ */
+
+#define EMU_BATCH_MAX_STEPS (1ull << 32)
+
+struct EBatchSeed
+{
+	ERegister r_[REGISTERS_COUNT] = {};
+	EFlags f_ = {};
+	std::vector<std::pair<u32, u32>> ram_; // { address, value } written over the program image
+};
+
+struct EBatchResult
+{
+	EState state_;
+	u64 steps_;
+	Status status_;     // FAILURE for a fault or a seed writing out of ram
+	EExecStatus exec_;
+};
+
+struct EBatchQueue
+{
+	std::mutex lock_;
+	std::deque<u32> jobs_;
+};
+
+[[nodiscard]] inline bool
+emu_batch_take(
+	std::vector<EBatchQueue>& queues,
+	u32 worker,
+	u32& job)
+{
+	{
+		auto& own = queues[worker];
+		std::lock_guard lock(own.lock_);
+		if (!own.jobs_.empty())
+		{
+			job = own.jobs_.back();
+			own.jobs_.pop_back();
+			return true;
+		}
+	}
+
+	for (size_t i = 1; i < queues.size(); i++)
+	{
+		auto& victim = queues[(worker + i) % queues.size()];
+		std::lock_guard lock(victim.lock_);
+		if (!victim.jobs_.empty())
+		{
+			job = victim.jobs_.front();
+			victim.jobs_.pop_front();
+			return true;
+		}
+	}
+
+	// nothing is ever queued after the start, so empty everywhere means done
+	return false;
+}
+
+Status
+emu_batch_execute(
+	const EAsmCompillerData& program,
+	const std::vector<EBatchSeed>& seeds,
+	std::vector<EBatchResult>& results,
+	u32 threads = 0,
+	u64 max_steps = EMU_BATCH_MAX_STEPS)
+{
+	constexpr u32 ram_size = ARRAY_SIZE(program.compilled_code);
+
+	if (threads == 0)
+		threads = std::max(1u, std::thread::hardware_concurrency());
+	threads = std::max(1u, std::min<u32>(threads, (u32)seeds.size()));
+
+	results.clear();
+	results.resize(seeds.size());
+
+	EState image = {};
+	std::memcpy(image.ram_, program.compilled_code, sizeof(image.ram_));
+
+	auto decoded = std::make_unique<EDecodedProgram>();
+	emu_predecode(*decoded, image);
+
+	std::vector<EBatchQueue> queues(threads);
+	size_t chunk = (seeds.size() + threads - 1) / std::max(threads, 1u);
+	for (u32 i = 0; i < seeds.size(); i++)
+		queues[i / chunk].jobs_.push_back(i);
+
+	const auto worker = [&](u32 id) {
+		auto local = std::make_unique<EDecodedProgram>(*decoded);
+		const auto restore = [&](u32 first, u32 end) {
+			std::copy(decoded->code_ + first, decoded->code_ + end, local->code_ + first);
+			emu_predecode_touch(*local, first, end - first);
+		};
+
+		u32 job = 0;
+		while (emu_batch_take(queues, id, job))
+		{
+			const auto& seed = seeds[job];
+			auto& result = results[job];
+
+			EState& state = result.state_;
+			state = image;
+			std::memcpy(state.r_, seed.r_, sizeof(state.r_));
+			state.f_ = seed.f_;
+
+			result.status_ = SUCCESS;
+			result.exec_ = EEXEC_FAULT;
+			result.steps_ = 0;
+			for (const auto& [addr, value] : seed.ram_)
+			{
+				if (addr >= ram_size)
+				{
+					LOG("Seed %u writes out of ram: %u", job, addr);
+					result.status_ = FAILURE;
+					break;
+				}
+				state.ram_[addr].set_value(value);
+				local->code_[addr] = emu_decode(state.ram_[addr]);
+				emu_predecode_touch(*local, addr);
+			}
+
+			if (result.status_ == SUCCESS)
+			{
+				result.exec_ = emu_execute_predecoded_for(state, *local, max_steps, &result.steps_);
+				if (result.exec_ == EEXEC_FAULT)
+					result.status_ = FAILURE;
+			}
+
+			// the next job starts from the decoded image again
+			for (const auto& [addr, value] : seed.ram_)
+			{
+				if (addr < ram_size)
+					restore(addr, addr + 1);
+			}
+			if (local->stored_begin_ < local->stored_end_)
+				restore(local->stored_begin_, local->stored_end_);
+			local->stored_begin_ = local->stored_end_ = 0;
+		}
+	};
+
+	std::vector<std::thread> pool;
+	for (u32 i = 1; i < threads; i++)
+		pool.emplace_back(worker, i);
+	worker(0);
+	for (auto& t : pool)
+		t.join();
+
+	for (const auto& r : results)
+	{
+		if (r.status_ != SUCCESS)
+			return FAILURE;
+	}
+
+	return SUCCESS;
+}
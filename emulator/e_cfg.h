@@ -0,0 +1,446 @@
+#pragma once
+#include "e_base.h"
+
+#include <algorithm>
+#include <vector>
+
+/*
+ * CONTROL FLOW GRAPH:
+ *   - emu_cfg_build follows the image from entry: beq / jma / jmbe go to pc + 1 and
+ *     pc + 1 + offset, jalr to its regB (a constant when direct), halt and unknown opcodes end
+ *     the path, everything else falls through (the same pc arithmetic as emu_process, a 16 bit
+ *     program_counter_)
+ *   - a jalr through a register can go anywhere, it is taken to return to the word after any
+ *     jalr (the link it saves), dynamic_jumps_ counts them so callers know the result leans on
+ *     that
+ *   - blocks_ are the straight line runs of reachable words, a block ends after a jump / halt
+ *     or before a word something jumps to, block_of_ maps every word to its block
+ *   - loops_ are the natural loops (a back edge to a block that dominates its source, loops
+ *     sharing a header are one loop), nested by body, depth 1 is outermost, irreducible cycles
+ *     are not loops
+ *   - data_ marks words read or written at a constant address (lw with a direct regB, sw, inc
+ *     and jalr links with a direct regA, add with either operand direct); emu_cfg_dead words are neither code nor data,
+ *     emu_cfg_strip zeroes them so emu_image_build leaves them out (only when the program has
+ *     no loads or jumps through registers)
+ *   - stores into code are not followed, a self modifying program needs the runtime engines
+ */
+
+#define ECFG_NONE UINT32_MAX
+#define ECFG_MAX_WORDS (1u << 16) // program_counter_ is 16 bit
+
+struct ECfgBlock
+{
+	u32 begin_;
+	u32 end_;           // one past the last word
+	u32 succ_[2];
+	u32 succ_count_;
+	bool exits_;        // a jump leaves the image or the last word faults
+	u32 loop_;          // innermost loop, ECFG_NONE outside loops
+};
+
+struct ECfgLoop
+{
+	u32 header_;        // block
+	u32 parent_;        // enclosing loop, ECFG_NONE for an outermost one
+	u32 depth_;
+	u32 blocks_;
+	u32 words_;
+};
+
+struct ECfg
+{
+	u32 words_ = 0;
+	u32 entry_ = 0;
+	std::vector<ECfgBlock> blocks_;   // address order
+	std::vector<ECfgLoop> loops_;     // outer loops before the loops inside them
+	std::vector<u32> block_of_;       // per word, ECFG_NONE if unreachable
+	std::vector<u8> data_;            // per word, 1 if read or written at a constant address
+	u32 dynamic_jumps_ = 0;           // reachable jalr through a register
+	u32 dynamic_loads_ = 0;           // reachable lw through a register
+};
+
+[[nodiscard]] inline bool
+emu_cfg_is_jump(
+	u32 opcode)
+{
+	return opcode == E_BEQ || opcode == E_JMA || opcode == E_JMBE || opcode == E_JALR || opcode == E_HALT || opcode > __ECOMMAND_LAST;
+}
+
+// successors of the word at w, ECFG_NONE for a path that leaves the image
+u32
+emu_cfg_successors(
+	const EInstruction* code,
+	u32 words,
+	u32 w,
+	u32 (&out)[2],
+	bool& dynamic)
+{
+	const EInstruction word = code[w];
+	const u32 opcode = word.get_opcode();
+	const auto in_image = [&](u32 pc) { return pc < words ? pc : ECFG_NONE; };
+
+	dynamic = false;
+	switch (opcode)
+	{
+	case E_HALT: {
+		return 0;
+	}
+	case E_BEQ:
+	case E_JMA:
+	case E_JMBE: {
+		out[0] = in_image((u16)(w + 1));
+		out[1] = in_image((u16)(w + 1 + word.get_offset()));
+		return out[0] == out[1] ? 1 : 2;
+	}
+	case E_JALR: {
+		auto rb = word.get_reg_b();
+		dynamic = !rb.second;
+		if (dynamic)
+			return 0;
+		out[0] = in_image(rb.first);
+		return 1;
+	}
+	default: {
+		if (opcode > __ECOMMAND_LAST)
+			return 0;
+		out[0] = in_image((u16)(w + 1));
+		return 1;
+	}
+	}
+}
+
+Status
+emu_cfg_build(
+	ECfg& cfg,
+	const EInstruction* code,
+	u32 words,
+	u32 entry = 0)
+{
+	if (words == 0 || words > ECFG_MAX_WORDS || entry >= words)
+		return FAILURE;
+
+	cfg = {};
+	cfg.words_ = words;
+	cfg.entry_ = entry;
+	cfg.data_.assign(words, 0);
+
+	// reachable words and block leaders, register jalr come back after any jalr
+	std::vector<u8> reachable(words, 0);
+	std::vector<u8> leader(words, 0);
+	std::vector<u32> work = { entry };
+	std::vector<u32> links;
+	reachable[entry] = 1;
+	leader[entry] = 1;
+
+	const auto reach = [&](u32 w, bool is_leader) {
+		if (w == ECFG_NONE)
+			return;
+		leader[w] |= is_leader;
+		if (!reachable[w])
+		{
+			reachable[w] = 1;
+			work.push_back(w);
+		}
+	};
+
+	for (;;)
+	{
+		while (!work.empty())
+		{
+			u32 w = work.back();
+			work.pop_back();
+
+			u32 succ[2];
+			bool dynamic = false;
+			u32 count = emu_cfg_successors(code, words, w, succ, dynamic);
+			bool jump = emu_cfg_is_jump(code[w].get_opcode());
+			for (u32 i = 0; i < count; i++)
+				reach(succ[i], jump);
+			if (jump && w + 1 < words)
+				leader[w + 1] = 1;
+
+			cfg.dynamic_jumps_ += dynamic;
+			if (code[w].get_opcode() == E_JALR && w + 1 < words)
+				links.push_back(w + 1);
+		}
+
+		if (cfg.dynamic_jumps_ == 0)
+			break;
+		for (u32 link : links)
+			reach(link, true);
+		links.clear();
+		if (work.empty())
+			break;
+	}
+
+	// blocks
+	cfg.block_of_.assign(words, ECFG_NONE);
+	for (u32 w = 0; w < words;)
+	{
+		if (!reachable[w])
+		{
+			w++;
+			continue;
+		}
+
+		ECfgBlock block = { w, w, {}, 0, false, ECFG_NONE };
+		do
+		{
+			cfg.block_of_[w] = (u32)cfg.blocks_.size();
+			block.end_ = ++w;
+		} while (w < words && reachable[w] && !leader[w] && !emu_cfg_is_jump(code[w - 1].get_opcode()));
+		cfg.blocks_.push_back(block);
+	}
+
+	std::vector<std::vector<u32>> preds(cfg.blocks_.size());
+	std::vector<u32> roots = { cfg.block_of_[entry] };
+	for (u32 b = 0; b < cfg.blocks_.size(); b++)
+	{
+		ECfgBlock& block = cfg.blocks_[b];
+		u32 last = block.end_ - 1;
+
+		u32 succ[2];
+		bool dynamic = false;
+		u32 count = emu_cfg_successors(code, words, last, succ, dynamic);
+		u32 opcode = code[last].get_opcode();
+		block.exits_ = opcode > __ECOMMAND_LAST;
+		for (u32 i = 0; i < count; i++)
+		{
+			if (succ[i] == ECFG_NONE)
+			{
+				block.exits_ = true;
+				continue;
+			}
+			block.succ_[block.succ_count_++] = cfg.block_of_[succ[i]];
+			preds[cfg.block_of_[succ[i]]].push_back(b);
+		}
+
+		// link words are entered from the dynamic jumps, roots for the dominators
+		if (cfg.dynamic_jumps_ && opcode == E_JALR && block.end_ < words && reachable[block.end_])
+			roots.push_back(cfg.block_of_[block.end_]);
+
+		for (u32 w = block.begin_; w < block.end_; w++)
+		{
+			EInstruction word = code[w];
+			auto ra = word.get_reg_a();
+			auto rb = word.get_reg_b();
+			u32 address = ECFG_NONE;
+			switch (word.get_opcode())
+			{
+			case E_LW: {
+				if (rb.second)
+					address = rb.first + word.get_offset();
+				else
+					cfg.dynamic_loads_++;
+			} break;
+			case E_SW: address = ra.first + word.get_offset(); break;
+			case E_INC: address = ra.second ? ra.first : ECFG_NONE; break;
+			case E_JALR: address = ra.second ? ra.first : ECFG_NONE; break;
+			case E_ADD: {
+				// both operands can be words
+				if (ra.second && ra.first < words)
+					cfg.data_[ra.first] = 1;
+				address = rb.second ? rb.first : ECFG_NONE;
+			} break;
+			default: break;
+			}
+			if (address < words)
+				cfg.data_[address] = 1;
+		}
+	}
+
+	// dominators (Cooper, Harvey, Kennedy) under a virtual root above the roots
+	const u32 n = (u32)cfg.blocks_.size();
+	const u32 root = n;
+	std::vector<u32> order;          // reverse postorder
+	std::vector<u32> rpo(n + 1, ECFG_NONE);
+	{
+		std::vector<u8> seen(n, 0);
+		std::vector<std::pair<u32, u32>> stack;
+		for (u32 r : roots)
+		{
+			if (seen[r])
+				continue;
+			seen[r] = 1;
+			stack.push_back({ r, 0 });
+			while (!stack.empty())
+			{
+				auto& [b, next] = stack.back();
+				if (next < cfg.blocks_[b].succ_count_)
+				{
+					u32 s = cfg.blocks_[b].succ_[next++];
+					if (!seen[s])
+					{
+						seen[s] = 1;
+						stack.push_back({ s, 0 });
+					}
+					continue;
+				}
+				order.push_back(b);
+				stack.pop_back();
+			}
+		}
+		order.push_back(root);
+		std::reverse(order.begin(), order.end());
+		for (u32 i = 0; i < order.size(); i++)
+			rpo[order[i]] = i;
+	}
+
+	std::vector<u32> idom(n + 1, ECFG_NONE);
+	idom[root] = root;
+	for (u32 r : roots)
+		preds[r].push_back(root);
+	preds.emplace_back();
+
+	const auto intersect = [&](u32 a, u32 b) {
+		while (a != b)
+		{
+			while (rpo[a] > rpo[b])
+				a = idom[a];
+			while (rpo[b] > rpo[a])
+				b = idom[b];
+		}
+		return a;
+	};
+
+	for (bool changed = true; changed;)
+	{
+		changed = false;
+		for (u32 i = 1; i < order.size(); i++)
+		{
+			u32 b = order[i];
+			u32 dom = ECFG_NONE;
+			for (u32 p : preds[b])
+			{
+				if (idom[p] == ECFG_NONE)
+					continue;
+				dom = dom == ECFG_NONE ? p : intersect(p, dom);
+			}
+			if (dom != idom[b])
+			{
+				idom[b] = dom;
+				changed = true;
+			}
+		}
+	}
+
+	const auto dominates = [&](u32 a, u32 b) {
+		for (; b != root; b = idom[b])
+		{
+			if (b == a)
+				return true;
+		}
+		return false;
+	};
+
+	// natural loops, one per header
+	std::vector<std::vector<u8>> bodies;
+	std::vector<u32> headers;
+	std::vector<u32> loop_of_header(n, ECFG_NONE);
+	for (u32 b = 0; b < n; b++)
+	{
+		for (u32 i = 0; i < cfg.blocks_[b].succ_count_; i++)
+		{
+			u32 h = cfg.blocks_[b].succ_[i];
+			if (!dominates(h, b))
+				continue;
+
+			if (loop_of_header[h] == ECFG_NONE)
+			{
+				loop_of_header[h] = (u32)bodies.size();
+				headers.push_back(h);
+				bodies.emplace_back(n, 0);
+				bodies.back()[h] = 1;
+			}
+
+			std::vector<u8>& body = bodies[loop_of_header[h]];
+			std::vector<u32> stack = { b };
+			while (!stack.empty())
+			{
+				u32 x = stack.back();
+				stack.pop_back();
+				if (body[x])
+					continue;
+				body[x] = 1;
+				for (u32 p : preds[x])
+				{
+					if (p != root && !body[p])
+						stack.push_back(p);
+				}
+			}
+		}
+	}
+
+	// outer loops first: a loop contains every loop whose header is in its body
+	std::vector<u32> by_size(bodies.size());
+	std::vector<u32> sizes(bodies.size(), 0);
+	for (u32 l = 0; l < bodies.size(); l++)
+	{
+		by_size[l] = l;
+		for (u32 b = 0; b < n; b++)
+			sizes[l] += bodies[l][b];
+	}
+	std::stable_sort(by_size.begin(), by_size.end(), [&](u32 a, u32 b) { return sizes[a] > sizes[b]; });
+
+	for (u32 i = 0; i < by_size.size(); i++)
+	{
+		const u32 l = by_size[i];
+		const u32 header = headers[l];
+
+		// the smallest loop so far holding the header is the one around this one
+		ECfgLoop loop = { header, cfg.blocks_[header].loop_, 1, sizes[l], 0 };
+		if (loop.parent_ != ECFG_NONE)
+			loop.depth_ = cfg.loops_[loop.parent_].depth_ + 1;
+
+		for (u32 b = 0; b < n; b++)
+		{
+			if (!bodies[l][b])
+				continue;
+			loop.words_ += cfg.blocks_[b].end_ - cfg.blocks_[b].begin_;
+			cfg.blocks_[b].loop_ = i;
+		}
+		cfg.loops_.push_back(loop);
+	}
+
+	return SUCCESS;
+}
+
+// [begin, end) runs of words that are neither reachable code nor constant address data
+[[nodiscard]] std::vector<std::pair<u32, u32>>
+emu_cfg_dead(
+	const ECfg& cfg)
+{
+	std::vector<std::pair<u32, u32>> dead;
+	for (u32 w = 0; w < cfg.words_; w++)
+	{
+		if (cfg.block_of_[w] != ECFG_NONE || cfg.data_[w])
+			continue;
+		if (!dead.empty() && dead.back().second == w)
+			dead.back().second++;
+		else
+			dead.push_back({ w, w + 1 });
+	}
+	return dead;
+}
+
+// zeroes the dead words, returns how many, 0 (and nothing changes) if a register jump or load
+// could reach them
+u32
+emu_cfg_strip(
+	const ECfg& cfg,
+	EInstruction* code)
+{
+	if (cfg.dynamic_jumps_ || cfg.dynamic_loads_)
+		return 0;
+
+	u32 stripped = 0;
+	for (auto [begin, end] : emu_cfg_dead(cfg))
+	{
+		for (u32 w = begin; w < end; w++)
+		{
+			stripped += code[w].data != 0;
+			code[w] = {};
+		}
+	}
+	return stripped;
+}
@@ -0,0 +1,227 @@
+#pragma once
+#include "e_base.h"
+#include "e_predecode.h"
+#include "e_exec.h"
+
+#include <chrono>
+
+/*
+ * BREAKPOINTS AND WATCHPOINTS:
+ *   - EDebugT keeps one flag byte per ram word (breakpoint, read watch, write watch) and a mask
+ *     of watched registers, emu_debug_break / emu_debug_watch / emu_debug_watch_register arm and
+ *     disarm them, ranges included
+ *   - emu_execute_debug_for picks its loop once per call: with nothing armed it is
+ *     emu_execute_for itself, not a copy with the checks switched off, so a debugger can stay
+ *     attached to every state and costs one branch per call until something is armed
+ *   - the armed loop reuses the emu_step_effects the plain loop already computes for faults,
+ *     every step costs a few flag lookups on top of that
+ *   - a breakpoint stops before its instruction runs, continuing from it runs the instruction
+ *   - a watchpoint stops after the access: read and write watches on any lw / sw / jalr / inc /
+ *     direct add operand that touches the range, a register watch only when the value changes
+ *   - the stop is EEXEC_BREAK with hit_ saying why (one hit per step: write, read, register)
+ */
+
+enum EDebugFlags
+{
+	EDEBUG_BREAK = 1 << 0,
+	EDEBUG_WATCH_READ = 1 << 1,
+	EDEBUG_WATCH_WRITE = 1 << 2,
+	EDEBUG_WATCH_REGISTER = 1 << 3   // only in EDebugHit::kind_
+};
+
+struct EDebugHit
+{
+	u32 kind_;   // one of EDebugFlags, 0 if the last run did not stop on one
+	u32 pc_;     // of the instruction, a breakpoint stops before it runs, a watch after
+	u32 where_;  // ram word or register
+	u32 old_;    // value before the instruction, the same as new_ for a breakpoint or a plain read
+	u32 new_;
+};
+
+template <u32 RAM_WORDS>
+struct EDebugT
+{
+	u32 armed_ = 0;          // ram words with any flag set
+	u16 registers_ = 0;      // watched registers, bit per register
+	EDebugHit hit_ = {};
+	u8 flags_[RAM_WORDS] = {};
+};
+
+using EDebug = EDebugT<EState::ram_words_>;
+
+template <u32 RAM_WORDS>
+[[nodiscard]] inline bool
+emu_debug_armed(
+	const EDebugT<RAM_WORDS>& debug)
+{
+	return debug.armed_ != 0 || debug.registers_ != 0;
+}
+
+template <u32 RAM_WORDS>
+Status
+emu_debug_set(
+	EDebugT<RAM_WORDS>& debug,
+	u32 first,
+	u32 count,
+	u32 flags,
+	bool on)
+{
+	if (first >= RAM_WORDS || count > RAM_WORDS - first)
+		return FAILURE;
+
+	for (u32 w = first; w < first + count; w++)
+	{
+		const u8 before = debug.flags_[w];
+		const u8 after = on ? (u8)(before | flags) : (u8)(before & ~flags);
+		debug.armed_ += (after != 0) - (before != 0);
+		debug.flags_[w] = after;
+	}
+	return SUCCESS;
+}
+
+template <u32 RAM_WORDS>
+Status
+emu_debug_break(
+	EDebugT<RAM_WORDS>& debug,
+	u32 pc,
+	bool on = true)
+{
+	return emu_debug_set(debug, pc, 1, EDEBUG_BREAK, on);
+}
+
+// flags: EDEBUG_WATCH_READ and / or EDEBUG_WATCH_WRITE
+template <u32 RAM_WORDS>
+Status
+emu_debug_watch(
+	EDebugT<RAM_WORDS>& debug,
+	u32 first,
+	u32 count,
+	u32 flags,
+	bool on = true)
+{
+	if (flags & ~(u32)(EDEBUG_WATCH_READ | EDEBUG_WATCH_WRITE))
+		return FAILURE;
+
+	return emu_debug_set(debug, first, count, flags, on);
+}
+
+template <u32 RAM_WORDS>
+Status
+emu_debug_watch_register(
+	EDebugT<RAM_WORDS>& debug,
+	u32 reg,
+	bool on = true)
+{
+	if (reg >= 16)
+		return FAILURE;
+
+	if (on)
+		debug.registers_ |= (u16)(1u << reg);
+	else
+		debug.registers_ &= (u16)~(1u << reg);
+	return SUCCESS;
+}
+
+template <u32 RAM_WORDS>
+void
+emu_debug_clear(
+	EDebugT<RAM_WORDS>& debug)
+{
+	std::fill(std::begin(debug.flags_), std::end(debug.flags_), 0);
+	debug.armed_ = 0;
+	debug.registers_ = 0;
+	debug.hit_ = {};
+}
+
+template <u32 RAM_WORDS, u32 REG_COUNT>
+EExecStatus
+emu_execute_debug_for(
+	EStateT<RAM_WORDS, REG_COUNT>& state,
+	EDebugT<RAM_WORDS>& debug,
+	u64 max_steps,
+	u64* steps = nullptr)
+{
+	const bool resume = debug.hit_.kind_ == EDEBUG_BREAK && debug.hit_.pc_ == state.program_counter_;
+	debug.hit_ = {};
+
+	if (!emu_debug_armed(debug))
+		return emu_execute_for(state, max_steps, steps);
+
+	u64 retired = 0;
+	EExecStatus status = EEXEC_BUDGET;
+
+	while (retired < max_steps)
+	{
+		if (state.halt_)
+		{
+			status = EEXEC_HALTED;
+			break;
+		}
+
+		// continuing from a breakpoint runs its instruction
+		const u32 pc = state.program_counter_;
+		if (pc < RAM_WORDS && (debug.flags_[pc] & EDEBUG_BREAK) && !(resume && retired == 0))
+		{
+			debug.hit_ = { EDEBUG_BREAK, pc, pc, pc, pc };
+			status = EEXEC_BREAK;
+			break;
+		}
+
+		EStepEffects effects = emu_step_effects(state);
+		if (effects.fault_)
+		{
+			status = EEXEC_FAULT;
+			break;
+		}
+
+		// an add can read two words, the first watched one is the hit
+		const auto watched_read = [&](u32 address) {
+			return address != EMU_NO_ADDRESS && (debug.flags_[address] & EDEBUG_WATCH_READ);
+		};
+		const u32 read = watched_read(effects.mem_read_) ? effects.mem_read_ : watched_read(effects.mem_read_b_) ? effects.mem_read_b_ : EMU_NO_ADDRESS;
+
+		// new_ is filled in once the instruction ran
+		EDebugHit hit = {};
+		if (effects.mem_write_ != EMU_NO_ADDRESS && (debug.flags_[effects.mem_write_] & EDEBUG_WATCH_WRITE))
+			hit = { EDEBUG_WATCH_WRITE, pc, effects.mem_write_, state.ram_[effects.mem_write_].get_value(), 0 };
+		else if (read != EMU_NO_ADDRESS)
+			hit = { EDEBUG_WATCH_READ, pc, read, state.ram_[read].get_value(), 0 };
+		else if (effects.dest_reg_ < REG_COUNT && (debug.registers_ & (1u << effects.dest_reg_)))
+			hit = { EDEBUG_WATCH_REGISTER, pc, effects.dest_reg_, state.r_[effects.dest_reg_], 0 };
+
+		emu_load_next(state);
+		emu_process(state);
+		retired++;
+
+		if (hit.kind_ == 0)
+			continue;
+
+		hit.new_ = hit.kind_ == EDEBUG_WATCH_REGISTER ? (u32)state.r_[hit.where_] : state.ram_[hit.where_].get_value();
+		if (hit.kind_ == EDEBUG_WATCH_REGISTER && hit.new_ == hit.old_)
+			continue;
+
+		debug.hit_ = hit;
+		status = EEXEC_BREAK;
+		break;
+	}
+
+	// the budget may run out right on the halt
+	if (status == EEXEC_BUDGET && state.halt_)
+		status = EEXEC_HALTED;
+
+	if (steps)
+		*steps += retired;
+
+	return status;
+}
+
+template <u32 RAM_WORDS, u32 REG_COUNT>
+EExecStatus
+emu_execute_debug_until(
+	EStateT<RAM_WORDS, REG_COUNT>& state,
+	EDebugT<RAM_WORDS>& debug,
+	std::chrono::steady_clock::time_point deadline,
+	u64* steps = nullptr)
+{
+	return emu_execute_sliced(deadline, [&](u64 slice) { return emu_execute_debug_for(state, debug, slice, steps); });
+}
@@ -0,0 +1,341 @@
+#pragma once
+#include "e_base.h"
+#include "e_asm.h"
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+ * DISASSEMBLER:
+ *   - emu_disasm_word turns one word back into the text emu_asm reads, mnemonics and operand
+ *     layouts come from opcode_descriptions
+ *   - a word is an instruction only if emu_asm could have produced it: known opcode, bits
+ *     outside the operand layout are 0 and registers are below registers_count, anything
+ *     else comes out as ".fill dec <value>" so the bits survive the trip back
+ *   - emu_asm has no numeric direct operands, a direct operand n prints as label $w<n> and
+ *     emu_disasm_image defines $w<n> on word n (padding the image with zero words up to the
+ *     highest one used)
+ *   - emu_disasm_round_trip checks word -> text -> emu_asm -> word on random 16 word images
+ *     on all cores
+ */
+
+#define EMU_DISASM_LINE 32 // longest line is ".fill dec 134217727" or "jmbe $w15 $w15 -2048"
+#define EMU_DISASM_BLOCK 16
+
+// value bits each operand layout uses
+constexpr u32 EMU_DISASM_MASKS[] = {
+	/* EARGS_INVAL      */ 0,
+	/* EARGS_NONE       */ 0b11111u << 22,
+	/* EARGS_A          */ 0b11111u << 22 | 0b11111u << 17,
+	/* EARGS_A_B        */ 0b11111u << 22 | 0b11111u << 17 | 0b11111u << 12,
+	/* EARGS_A_B_R      */ 0b11111u << 22 | 0b11111u << 17 | 0b11111u << 12 | 0b1111u,
+	/* EARGS_A_B_OFFSET */ 0b11111u << 22 | 0b11111u << 17 | 0b11111u << 12 | BITS_12_MASK
+};
+
+struct EDisasmRoundTrip
+{
+	u64 words_ = 0;
+	u64 mismatches_ = 0;
+	u32 first_bad_ = UINT32_MAX; // the lowest word that did not come back, UINT32_MAX if none
+};
+
+[[nodiscard]] inline char*
+emu_disasm_put_u32(
+	char* out,
+	u32 v)
+{
+	char digits[10];
+	u32 n = 0;
+	do
+	{
+		digits[n++] = (char)('0' + v % 10);
+		v /= 10;
+	} while (v);
+
+	while (n)
+		*out++ = digits[--n];
+	return out;
+}
+
+[[nodiscard]] inline char*
+emu_disasm_put_text(
+	char* out,
+	std::string_view text)
+{
+	std::memcpy(out, text.data(), text.size());
+	return out + text.size();
+}
+
+[[nodiscard]] inline char*
+emu_disasm_put_operand(
+	char* out,
+	std::pair<u32, bool> operand)
+{
+	*out++ = ' ';
+	out = emu_disasm_put_text(out, operand.second ? "$w" : "r");
+	return emu_disasm_put_u32(out, operand.first);
+}
+
+// true if emu_asm can produce the word
+[[nodiscard]] inline bool
+emu_disasm_is_instruction(
+	EInstruction word,
+	u32 registers_count = REGISTERS_COUNT)
+{
+	u32 value = word.get_value();
+	u32 opcode = word.get_opcode();
+	if (opcode > __ECOMMAND_LAST)
+		return false;
+
+	EArgsType args = opcode_descriptions[opcode].args_type_;
+	if (value & ~EMU_DISASM_MASKS[args])
+		return false;
+
+	auto ra = word.get_reg_a();
+	auto rb = word.get_reg_b();
+	bool uses_b = args == EARGS_A_B || args == EARGS_A_B_R || args == EARGS_A_B_OFFSET;
+	if (args != EARGS_NONE && !ra.second && ra.first >= registers_count)
+		return false;
+	if (uses_b && !rb.second && rb.first >= registers_count)
+		return false;
+	if (args == EARGS_A_B_R && word.get_reg_r() >= registers_count)
+		return false;
+
+	return true;
+}
+
+// writes at most EMU_DISASM_LINE chars (0 terminated) into out, returns the length
+u32
+emu_disasm_word(
+	EInstruction word,
+	char* out,
+	u32 registers_count = REGISTERS_COUNT)
+{
+	char* p = out;
+	if (!emu_disasm_is_instruction(word, registers_count))
+	{
+		p = emu_disasm_put_text(p, ".fill dec ");
+		p = emu_disasm_put_u32(p, word.get_value());
+		*p = 0;
+		return (u32)(p - out);
+	}
+
+	const EOpcodeDesc& desc = opcode_descriptions[word.get_opcode()];
+	p = emu_disasm_put_text(p, desc.asm_name_);
+
+	switch (desc.args_type_)
+	{
+	case EARGS_A: {
+		p = emu_disasm_put_operand(p, word.get_reg_a());
+	} break;
+	case EARGS_A_B: {
+		p = emu_disasm_put_operand(p, word.get_reg_a());
+		p = emu_disasm_put_operand(p, word.get_reg_b());
+	} break;
+	case EARGS_A_B_R: {
+		p = emu_disasm_put_operand(p, word.get_reg_a());
+		p = emu_disasm_put_operand(p, word.get_reg_b());
+		p = emu_disasm_put_operand(p, { word.get_reg_r(), false });
+	} break;
+	case EARGS_A_B_OFFSET: {
+		p = emu_disasm_put_operand(p, word.get_reg_a());
+		p = emu_disasm_put_operand(p, word.get_reg_b());
+		i32 offset = word.get_offset();
+		p = emu_disasm_put_text(p, offset < 0 ? " -" : " ");
+		p = emu_disasm_put_u32(p, (u32)(offset < 0 ? -offset : offset));
+	} break;
+	default: {
+	} break;
+	}
+
+	*p = 0;
+	return (u32)(p - out);
+}
+
+// one line per word, source for emu_asm that gives back the same words
+[[nodiscard]] std::string
+emu_disasm_image(
+	const EInstruction* words,
+	u32 count,
+	u32 registers_count = REGISTERS_COUNT)
+{
+	// direct operands only reach words 0..15
+	u32 labels = 0;
+	for (u32 i = 0; i < count; i++)
+	{
+		if (!emu_disasm_is_instruction(words[i], registers_count))
+			continue;
+		EInstruction w = words[i];
+		EArgsType args = opcode_descriptions[w.get_opcode()].args_type_;
+		if (args != EARGS_NONE && w.get_reg_a().second)
+			labels |= 1u << w.get_reg_a().first;
+		if (args != EARGS_NONE && args != EARGS_A && w.get_reg_b().second)
+			labels |= 1u << w.get_reg_b().first;
+	}
+
+	u32 padded = count;
+	for (u32 i = count; i < 16; i++)
+		padded = (labels >> i) ? i + 1 : padded;
+
+	std::string text;
+	text.reserve((size_t)padded * 24);
+
+	char line[EMU_DISASM_LINE + 8];
+	for (u32 i = 0; i < padded; i++)
+	{
+		char* p = line;
+		if (i < 16 && (labels >> i) & 1)
+		{
+			p = emu_disasm_put_text(p, "$w");
+			p = emu_disasm_put_u32(p, i);
+		}
+		*p++ = '\t';
+
+		EInstruction zero = {};
+		p += emu_disasm_word(i < count ? words[i] : zero, p, registers_count);
+		*p++ = '\n';
+		text.append(line, p - line);
+	}
+
+	return text;
+}
+
+// a raw image as emu_load_image reads it: little endian u32 words
+Status
+emu_disasm_file(
+	const char* filepath,
+	std::string& text,
+	u32 registers_count = REGISTERS_COUNT)
+{
+	FILE* f = fopen(filepath, "rb");
+	if (!f)
+	{
+		LOG("Can't open file: %s", filepath);
+		return FILE_NOT_FOUND;
+	}
+
+	size_t filesize = get_file_size(f);
+	if (filesize % sizeof(EInstruction) || filesize / sizeof(EInstruction) > EMU_BUS_WORDS)
+	{
+		LOG("Invalid file size: %zu", filesize);
+		fclose(f);
+		return INVALID_FILE;
+	}
+
+	std::vector<EInstruction> words(filesize / sizeof(EInstruction));
+	size_t read = fread(words.data(), 1, filesize, f);
+	fclose(f);
+	if (read != filesize)
+		return INVALID_FILE;
+
+	text = emu_disasm_image(words.data(), (u32)words.size(), registers_count);
+	return SUCCESS;
+}
+
+[[nodiscard]] inline u64
+emu_disasm_splitmix(
+	u64& x)
+{
+	u64 z = (x += 0x9E3779B97F4A7C15ull);
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+	return z ^ (z >> 31);
+}
+
+// 3 in 4 are instructions emu_asm can produce, the rest are any 27 bit value
+[[nodiscard]] inline EInstruction
+emu_disasm_random_word(
+	u64& rng)
+{
+	u64 r = emu_disasm_splitmix(rng);
+	if ((r & 3) == 0)
+	{
+		EInstruction raw = {};
+		raw.set_value((u32)(r >> 32));
+		return raw;
+	}
+
+	const EOpcodeDesc& desc = opcode_descriptions[(r >> 2) % (__ECOMMAND_LAST + 1)];
+	u32 ra_direct = (r >> 8) & 1;
+	u32 rb_direct = (r >> 9) & 1;
+	u32 ra = (u32)(r >> 10) % (ra_direct ? 16 : REGISTERS_COUNT);
+	u32 rb = (u32)(r >> 16) % (rb_direct ? 16 : REGISTERS_COUNT);
+	u32 rr = (u32)(r >> 22) % REGISTERS_COUNT;
+	u32 offset = (u32)(r >> 28) & BITS_12_MASK;
+
+	EInstruction word = desc.args_type_ == EARGS_A_B_OFFSET
+		? EInstruction::create_ra_rb_offset(desc.opcode_, ra, rb, offset, ra_direct, rb_direct)
+		: EInstruction::create_ra_rb_rr(desc.opcode_, ra, rb, rr, ra_direct, rb_direct);
+	word.set_value(word.get_value() & EMU_DISASM_MASKS[desc.args_type_]);
+	return word;
+}
+
+// blocks of EMU_DISASM_BLOCK words seeded from seed + block, the result does not depend on threads
+Status
+emu_disasm_round_trip(
+	u64 words,
+	u64 seed,
+	EDisasmRoundTrip& result,
+	u32 threads = 0)
+{
+	if (threads == 0)
+		threads = std::max(1u, std::thread::hardware_concurrency());
+
+	const u64 blocks = (words + EMU_DISASM_BLOCK - 1) / EMU_DISASM_BLOCK;
+	constexpr u64 chunk = 64;
+
+	std::atomic<u64> next = 0;
+	std::atomic<u64> mismatches = 0;
+	std::atomic<u64> first_bad = UINT64_MAX; // lowest failing word index, not whoever got there first
+
+	const auto worker = [&]() {
+		auto data = std::make_unique<EAsmCompillerDataT<EMU_DISASM_BLOCK, REGISTERS_COUNT>>();
+		EInstruction block[EMU_DISASM_BLOCK];
+
+		for (u64 begin = next.fetch_add(chunk); begin < blocks; begin = next.fetch_add(chunk))
+		{
+			for (u64 b = begin; b < std::min(begin + chunk, blocks); b++)
+			{
+				u64 rng = seed + b * EMU_DISASM_BLOCK;
+				for (auto& w : block)
+					w = emu_disasm_random_word(rng);
+
+				std::string text = emu_disasm_image(block, EMU_DISASM_BLOCK);
+				bool assembled = emu_asm(*data, text) == SUCCESS;
+
+				for (u32 i = 0; i < EMU_DISASM_BLOCK; i++)
+				{
+					if (assembled && data->compilled_code[i].get_value() == block[i].get_value())
+						continue;
+					mismatches++;
+					u64 index = b * EMU_DISASM_BLOCK + i;
+					u64 seen = first_bad.load();
+					while (index < seen && !first_bad.compare_exchange_weak(seen, index))
+						;
+				}
+			}
+		}
+	};
+
+	std::vector<std::thread> pool;
+	for (u32 t = 1; t < threads; t++)
+		pool.emplace_back(worker);
+	worker();
+	for (auto& t : pool)
+		t.join();
+
+	result.words_ = blocks * EMU_DISASM_BLOCK;
+	result.mismatches_ = mismatches;
+	// the block is generated again for the word
+	result.first_bad_ = UINT32_MAX;
+	if (first_bad != UINT64_MAX)
+	{
+		u64 rng = seed + first_bad / EMU_DISASM_BLOCK * EMU_DISASM_BLOCK;
+		for (u64 i = 0; i <= first_bad % EMU_DISASM_BLOCK; i++)
+			result.first_bad_ = emu_disasm_random_word(rng).get_value();
+	}
+	return result.mismatches_ == 0 ? SUCCESS : FAILURE;
+}
@@ -0,0 +1,120 @@
+#pragma once
+#include "e_base.h"
+#include "e_predecode.h"
+
+#include <chrono>
+
+/*
+ * BOUNDED EXECUTION:
+ *   - emu_execute_for runs at most max_steps instructions, emu_execute_until runs until a
+ *     steady_clock deadline (checked every EMU_DEADLINE_SLICE steps)
+ *   - the result says if the program halted, ran out of budget or faulted
+ *   - nothing but EState is kept between calls, calling again with the same state resumes
+ *     exactly where the last call stopped (a halted state stays halted, a faulted one keeps
+ *     its pc on the faulting instruction)
+ *   - faults are the undefined cases of emu_process (see emu_step_effects), they are caught
+ *     before the instruction runs instead of crashing the host
+ *   - the _predecoded variants do the same on emu_execute_predecoded
+ */
+
+#define EMU_DEADLINE_SLICE 4096
+
+enum EExecStatus
+{
+	EEXEC_HALTED,
+	EEXEC_BUDGET,
+	EEXEC_FAULT,
+	EEXEC_BREAK    // a breakpoint or watchpoint of e_debug.h
+};
+
+template <u32 RAM_WORDS, u32 REG_COUNT>
+EExecStatus
+emu_execute_for(
+	EStateT<RAM_WORDS, REG_COUNT>& state,
+	u64 max_steps,
+	u64* steps = nullptr)
+{
+	u64 retired = 0;
+	EExecStatus status = EEXEC_BUDGET;
+
+	while (retired < max_steps)
+	{
+		if (state.halt_)
+		{
+			status = EEXEC_HALTED;
+			break;
+		}
+
+		if (emu_step_effects(state).fault_)
+		{
+			status = EEXEC_FAULT;
+			break;
+		}
+
+		emu_load_next(state);
+		emu_process(state);
+		retired++;
+	}
+
+	// the budget may run out right on the halt
+	if (status == EEXEC_BUDGET && state.halt_)
+		status = EEXEC_HALTED;
+
+	if (steps)
+		*steps += retired;
+
+	return status;
+}
+
+template <u32 RAM_WORDS, u32 REG_COUNT>
+EExecStatus
+emu_execute_predecoded_for(
+	EStateT<RAM_WORDS, REG_COUNT>& state,
+	EDecodedProgramT<RAM_WORDS>& program,
+	u64 max_steps,
+	u64* steps = nullptr)
+{
+	if (state.halt_)
+		return EEXEC_HALTED;
+
+	if (emu_execute_predecoded(state, program, steps, max_steps) != SUCCESS)
+		return EEXEC_FAULT;
+
+	return state.halt_ ? EEXEC_HALTED : EEXEC_BUDGET;
+}
+
+template <typename Run>
+EExecStatus
+emu_execute_sliced(
+	std::chrono::steady_clock::time_point deadline,
+	Run run)
+{
+	EExecStatus status = EEXEC_BUDGET;
+	do
+	{
+		status = run(EMU_DEADLINE_SLICE);
+	} while (status == EEXEC_BUDGET && std::chrono::steady_clock::now() < deadline);
+
+	return status;
+}
+
+template <u32 RAM_WORDS, u32 REG_COUNT>
+EExecStatus
+emu_execute_until(
+	EStateT<RAM_WORDS, REG_COUNT>& state,
+	std::chrono::steady_clock::time_point deadline,
+	u64* steps = nullptr)
+{
+	return emu_execute_sliced(deadline, [&](u64 slice) { return emu_execute_for(state, slice, steps); });
+}
+
+template <u32 RAM_WORDS, u32 REG_COUNT>
+EExecStatus
+emu_execute_predecoded_until(
+	EStateT<RAM_WORDS, REG_COUNT>& state,
+	EDecodedProgramT<RAM_WORDS>& program,
+	std::chrono::steady_clock::time_point deadline,
+	u64* steps = nullptr)
+{
+	return emu_execute_sliced(deadline, [&](u64 slice) { return emu_execute_predecoded_for(state, program, slice, steps); });
+}
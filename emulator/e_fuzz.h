@@ -0,0 +1,287 @@
+#pragma once
+#include "e_base.h"
+#include "e_predecode.h"
+#include "e_jit.h"
+#include "e_lanes.h"
+#include "e_tier.h"
+
+#include <memory>
+#include <string>
+
+/*
+ * DIFFERENTIAL FUZZING:
+ *   - emu_fuzz_state turns any bytes into a machine: the first 2 * REGISTERS_COUNT bytes are
+ *     the registers, every 4 bytes after that one valid instruction (opcode, registers in
+ *     range, small offsets so jumps and lw / sw stay near the code), then a halt
+ *   - emu_fuzz_one runs it on emu_process (the reference) and compares every engine against it:
+ *       predecoded (threaded dispatch when EMU_COMPUTED_GOTO) after every single step
+ *       predecoded after emu_fuse, tiered (threshold 2, so loops do move up), jit and lanes
+ *       (every isa the host has, EMU_FUZZ_LANES lanes with different registers) on the final
+ *       state, they can't stop after one step
+ *   - r_, f_, program_counter_, halt_ and ram_ must be identical, a fault must happen on the
+ *     same step, the first difference is described in EFuzzReport
+ *   - programs still running after EMU_FUZZ_MAX_STEPS are only checked step by step, jit and
+ *     lanes would not come back
+ *   - fuzz.cpp wraps it for libFuzzer (EMULATOR_FUZZ=ON with clang) or as a standalone driver
+ */
+
+#define EMU_FUZZ_MAX_WORDS 256
+#define EMU_FUZZ_MAX_STEPS 4096
+#define EMU_FUZZ_LANES 4
+#define EMU_FUZZ_ALL_RAM (EMU_NO_ADDRESS - 1)
+
+enum EFuzzEnd
+{
+	EFUZZ_HALTED,
+	EFUZZ_FAULT,
+	EFUZZ_RUNNING
+};
+
+struct EFuzzReport
+{
+	std::string engine_;
+	u64 step_ = 0;
+	std::string diff_;
+};
+
+[[nodiscard]] EState
+emu_fuzz_state(
+	const u8* data,
+	size_t size,
+	u32 lane = 0)
+{
+	EState state = {};
+
+	size_t pos = 0;
+	for (u32 i = 0; i < REGISTERS_COUNT && pos + 2 <= size; i++, pos += 2)
+		state.r_[i] = (ERegister)((data[pos] | data[pos + 1] << 8) ^ (lane * (i + 1)));
+
+	u32 words = 0;
+	for (; words < EMU_FUZZ_MAX_WORDS && pos + 4 <= size; words++, pos += 4)
+	{
+		u32 v = data[pos] | data[pos + 1] << 8 | data[pos + 2] << 16 | (u32)data[pos + 3] << 24;
+
+		u32 opcode = (v & 0x1F) % (__ECOMMAND_LAST + 1);
+		u32 ra_direct = (v >> 5) & 1;
+		u32 ra = (v >> 6) & 0xF;
+		u32 rb_direct = (v >> 10) & 1;
+		u32 rb = (v >> 11) & 0xF;
+		u32 rr = ((v >> 15) & 0xF) % REGISTERS_COUNT;
+		i32 offset = (i32)((v >> 19) & 0x1F) - 8;
+
+		ra = ra_direct ? ra : ra % REGISTERS_COUNT;
+		rb = rb_direct ? rb : rb % REGISTERS_COUNT;
+
+		state.ram_[words] = opcode_descriptions[opcode].args_type_ == EARGS_A_B_OFFSET
+			? EInstruction::create_ra_rb_offset(opcode, ra, rb, (u32)offset & BITS_12_MASK, ra_direct, rb_direct)
+			: EInstruction::create_ra_rb_rr(opcode, ra, rb, rr, ra_direct, rb_direct);
+	}
+	state.ram_[words] = EInstruction::create_ra_rb_rr(E_HALT, 0, 0, 0);
+
+	return state;
+}
+
+// first difference between two states, empty if there is none (command_register_ is engine private)
+// ram_word compares one ram_ word instead of all of them, EMU_NO_ADDRESS skips ram_
+[[nodiscard]] std::string
+emu_fuzz_diff(
+	const EState& expected,
+	const EState& actual,
+	u32 ram_word = EMU_FUZZ_ALL_RAM)
+{
+	char buffer[96];
+	if (expected.program_counter_ != actual.program_counter_)
+	{
+		snprintf(buffer, sizeof(buffer), "program_counter_ %u != %u", (u32)expected.program_counter_, (u32)actual.program_counter_);
+		return buffer;
+	}
+	if (expected.halt_ != actual.halt_)
+		return expected.halt_ ? "should have halted" : "should not have halted";
+	for (u32 i = 0; i < REGISTERS_COUNT; i++)
+	{
+		if (expected.r_[i] != actual.r_[i])
+		{
+			snprintf(buffer, sizeof(buffer), "r%u %u != %u", i, expected.r_[i], actual.r_[i]);
+			return buffer;
+		}
+	}
+	if (std::memcmp(&expected.f_, &actual.f_, sizeof(EFlags)) != 0)
+	{
+		snprintf(buffer, sizeof(buffer), "f_ (cf sf zf) %u %u %u != %u %u %u",
+			expected.f_.СF_, expected.f_.SF_, expected.f_.ZF_, actual.f_.СF_, actual.f_.SF_, actual.f_.ZF_);
+		return buffer;
+	}
+	const bool all = ram_word == EMU_FUZZ_ALL_RAM;
+	for (u32 i = all ? 0 : ram_word; i < ARRAY_SIZE(expected.ram_) && (all || i == ram_word); i++)
+	{
+		if (expected.ram_[i].data != actual.ram_[i].data)
+		{
+			snprintf(buffer, sizeof(buffer), "ram_[%u] %u != %u", i, expected.ram_[i].data, actual.ram_[i].data);
+			return buffer;
+		}
+	}
+	return {};
+}
+
+// emu_process until halt, fault or max_steps
+EFuzzEnd
+emu_fuzz_reference(
+	EState& state,
+	u64 max_steps,
+	u64* steps = nullptr)
+{
+	for (u64 i = 0; i < max_steps; i++)
+	{
+		if (state.halt_)
+			return EFUZZ_HALTED;
+		if (emu_step_effects(state).fault_)
+			return EFUZZ_FAULT;
+
+		emu_load_next(state);
+		emu_process(state);
+		if (steps)
+			(*steps)++;
+	}
+
+	return state.halt_ ? EFUZZ_HALTED : EFUZZ_RUNNING;
+}
+
+// SUCCESS if every engine agrees with emu_process, the report says where the first one did not
+Status
+emu_fuzz_one(
+	const u8* data,
+	size_t size,
+	EFuzzReport& report)
+{
+	const auto mismatch = [&](const char* engine, u64 step, std::string diff) {
+		report = { engine, step, std::move(diff) };
+		return FAILURE;
+	};
+
+	const EState start = emu_fuzz_state(data, size);
+
+	// predecoded, one step at a time
+	auto reference = std::make_unique<EState>(start);
+	auto predecoded = std::make_unique<EState>(start);
+	auto program = std::make_unique<EDecodedProgram>();
+	emu_predecode(*program, *predecoded);
+
+	EFuzzEnd end = EFUZZ_RUNNING;
+	u64 step = 0;
+	for (; step < EMU_FUZZ_MAX_STEPS; step++)
+	{
+		if (reference->halt_)
+		{
+			end = EFUZZ_HALTED;
+			break;
+		}
+
+		EStepEffects effects = emu_step_effects(*reference);
+		bool fault = effects.fault_;
+		if (!fault)
+		{
+			emu_load_next(*reference);
+			emu_process(*reference);
+		}
+
+		Status status = emu_execute_predecoded(*predecoded, *program, nullptr, 1);
+		if ((status != SUCCESS) != fault)
+			return mismatch("predecoded", step, fault ? "should have faulted" : "should not have faulted");
+
+		// the word the step wrote, all of ram_ once the run is over
+		std::string diff = emu_fuzz_diff(*reference, *predecoded, fault ? EMU_NO_ADDRESS : effects.mem_write_);
+		if (!diff.empty())
+			return mismatch("predecoded", step, diff);
+
+		if (fault)
+		{
+			end = EFUZZ_FAULT;
+			break;
+		}
+	}
+
+	std::string diff = emu_fuzz_diff(*reference, *predecoded);
+	if (!diff.empty())
+		return mismatch("predecoded", step, diff);
+
+	if (end == EFUZZ_RUNNING)
+		return SUCCESS;
+
+	// fused predecoded, in one go, stepping would always take the plain handlers
+	{
+		auto state = std::make_unique<EState>(start);
+		emu_predecode(*program, *state);
+		emu_fuse(*program);
+		Status status = emu_execute_predecoded(*state, *program);
+		if ((status != SUCCESS) != (end == EFUZZ_FAULT))
+			return mismatch("fused", step, end == EFUZZ_FAULT ? "should have faulted" : "should not have faulted");
+
+		std::string diff = emu_fuzz_diff(*reference, *state);
+		if (!diff.empty())
+			return mismatch("fused", step, diff);
+	}
+
+	// tiered, final state only
+	{
+		static auto tier = std::make_unique<ETier>();
+		emu_tier_reset(*tier, 2);
+		auto state = std::make_unique<EState>(start);
+		EExecStatus status = emu_execute_tiered_for(*state, *tier, EMU_FUZZ_MAX_STEPS);
+		if ((status == EEXEC_FAULT) != (end == EFUZZ_FAULT))
+			return mismatch("tiered", step, end == EFUZZ_FAULT ? "should have faulted" : "should not have faulted");
+
+		std::string diff = emu_fuzz_diff(*reference, *state);
+		if (!diff.empty())
+			return mismatch("tiered", step, diff);
+	}
+
+	// jit, final state only
+	{
+		static EJitContext jit;
+		emu_jit_reset(jit);
+		auto state = std::make_unique<EState>(start);
+		Status status = emu_execute_jit(*state, jit);
+		if ((status != SUCCESS) != (end == EFUZZ_FAULT))
+			return mismatch("jit", step, end == EFUZZ_FAULT ? "should have faulted" : "should not have faulted");
+
+		std::string diff = emu_fuzz_diff(*reference, *state);
+		if (!diff.empty())
+			return mismatch("jit", step, diff);
+	}
+
+	// lanes, every lane has to end too or the lanes would never come back
+	std::unique_ptr<EState> expected[EMU_FUZZ_LANES];
+	EFuzzEnd ends[EMU_FUZZ_LANES];
+	u64 steps[EMU_FUZZ_LANES] = {};
+	for (u32 l = 0; l < EMU_FUZZ_LANES; l++)
+	{
+		expected[l] = std::make_unique<EState>(emu_fuzz_state(data, size, l));
+		ends[l] = emu_fuzz_reference(*expected[l], EMU_FUZZ_MAX_STEPS, &steps[l]);
+		if (ends[l] == EFUZZ_RUNNING)
+			return SUCCESS;
+	}
+
+	static const char* const isa_names[] = { "lanes/scalar", "lanes/avx2", "lanes/avx512" };
+	for (u32 isa = ELANES_SCALAR; isa <= (u32)emu_lanes_detect_isa(); isa++)
+	{
+		auto lanes = std::make_unique<EStateLanes<EMU_FUZZ_LANES>>();
+		for (u32 l = 0; l < EMU_FUZZ_LANES; l++)
+			emu_lanes_load(*lanes, l, emu_fuzz_state(data, size, l));
+
+		emu_execute_lanes(*lanes, (ELanesIsa)isa);
+
+		for (u32 l = 0; l < EMU_FUZZ_LANES; l++)
+		{
+			auto state = std::make_unique<EState>();
+			Status status = emu_lanes_store(*lanes, l, *state);
+			if ((status != SUCCESS) != (ends[l] == EFUZZ_FAULT))
+				return mismatch(isa_names[isa], steps[l], "lane " + std::to_string(l) + (ends[l] == EFUZZ_FAULT ? " should have faulted" : " should not have faulted"));
+
+			std::string diff = emu_fuzz_diff(*expected[l], *state);
+			if (!diff.empty())
+				return mismatch(isa_names[isa], steps[l], "lane " + std::to_string(l) + ": " + diff);
+		}
+	}
+
+	return SUCCESS;
+}
@@ -0,0 +1,617 @@
+#pragma once
+#include "e_base.h"
+#include "e_exec.h"
+#include "e_debug.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#define EMU_GDB_AVAILABLE 1
+#else
+#define EMU_GDB_AVAILABLE 0
+#endif
+
+/*
+ * GDB REMOTE STUB:
+ *   - emu_gdb_serve speaks the gdb remote serial protocol on a connected socket (see
+ *     emu_gdb_listen_tcp on 127.0.0.1, emu_gdb_listen_unix and emu_gdb_accept) until the client
+ *     kills or detaches, the EState is only touched in between packets
+ *   - registers: r0..r(REG_COUNT-1) 16 bit, then pc 32 bit, all little endian, target.xml is
+ *     served through qXfer:features:read so the client learns the layout
+ *   - ram is byte addressed for the client: word w is bytes 4w..4w+3, little endian, pc is
+ *     reported and written the same way (4 * program_counter_) so breakpoints on $pc match
+ *   - s runs one emu_process (emu_execute_for with one step), c runs emu_execute_debug_for in
+ *     EMU_DEADLINE_SLICE slices and polls for the client's ^C in between, with no breakpoint or
+ *     watchpoint set that is plain emu_execute_for, the checks only exist while one is armed
+ *   - Z0 / Z1 are breakpoints, Z2 / Z3 / Z4 write / read / access watchpoints, all on EDebug
+ *   - stop replies: S05 breakpoint or step, T05watch/rwatch/awatch:addr for a watchpoint, S02
+ *     after ^C, S0b on a fault, W00 once the guest ran halt
+ *   - QStartNoAckMode is supported, X (binary writes) and vCont are not, the client falls back to
+ *     M, s and c
+ *   - qSupported offers PacketSize EMU_GDB_PACKET_SIZE (in hex like every number of the protocol),
+ *     m / M move up to EMU_GDB_MEMORY_MAX bytes, derived from it, so one m reads all of RAM_SIZE
+ */
+
+#define EMU_GDB_PACKET_SIZE 0x4000
+// two hex digits a byte, with room left for "M<address>,<length>:"
+#define EMU_GDB_MEMORY_MAX ((EMU_GDB_PACKET_SIZE - 32) / 2)
+
+#if EMU_GDB_AVAILABLE
+
+struct EGdbConnection
+{
+	i32 fd_;
+	bool no_ack_ = false;
+	u32 begin_ = 0;   // unread bytes of buffer_
+	u32 end_ = 0;
+	char buffer_[EMU_GDB_PACKET_SIZE];
+};
+
+// next byte from the client, -1 once the connection is gone
+inline i32
+emu_gdb_getc(
+	EGdbConnection& conn)
+{
+	if (conn.begin_ == conn.end_)
+	{
+		ssize_t got = 0;
+		do
+		{
+			got = ::read(conn.fd_, conn.buffer_, sizeof(conn.buffer_));
+		} while (got < 0 && errno == EINTR);
+
+		if (got <= 0)
+			return -1;
+
+		conn.begin_ = 0;
+		conn.end_ = (u32)got;
+	}
+	return (u8)conn.buffer_[conn.begin_++];
+}
+
+inline bool
+emu_gdb_write(
+	EGdbConnection& conn,
+	std::string_view data)
+{
+	while (!data.empty())
+	{
+		ssize_t sent = ::write(conn.fd_, data.data(), data.size());
+		if (sent < 0 && errno == EINTR)
+			continue;
+		if (sent <= 0)
+			return false;
+		data.remove_prefix((size_t)sent);
+	}
+	return true;
+}
+
+[[nodiscard]] constexpr i32
+emu_gdb_hex_digit(
+	char c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+	return -1;
+}
+
+// bytes of value, least significant first, as hex
+inline void
+emu_gdb_hex(
+	std::string& out,
+	u32 value,
+	u32 bytes)
+{
+	constexpr char digits[] = "0123456789abcdef";
+	for (u32 i = 0; i < bytes; i++, value >>= 8)
+	{
+		out += digits[(value >> 4) & 0xF];
+		out += digits[value & 0xF];
+	}
+}
+
+// big endian hex number (addresses, lengths, register numbers), stops at the first non hex
+// character, false if there was none
+inline bool
+emu_gdb_parse(
+	std::string_view& text,
+	u64& value)
+{
+	value = 0;
+	size_t i = 0;
+	for (; i < text.size() && emu_gdb_hex_digit(text[i]) >= 0 && i < 16; i++)
+		value = value << 4 | (u64)emu_gdb_hex_digit(text[i]);
+
+	text.remove_prefix(i);
+	return i != 0;
+}
+
+// bytes little endian hex bytes, the way registers are sent
+inline bool
+emu_gdb_parse_bytes(
+	std::string_view& text,
+	u32 bytes,
+	u32& value)
+{
+	if (text.size() < bytes * 2)
+		return false;
+
+	value = 0;
+	for (u32 i = 0; i < bytes; i++)
+	{
+		i32 hi = emu_gdb_hex_digit(text[i * 2]);
+		i32 lo = emu_gdb_hex_digit(text[i * 2 + 1]);
+		if (hi < 0 || lo < 0)
+			return false;
+		value |= (u32)(hi << 4 | lo) << (i * 8);
+	}
+	text.remove_prefix(bytes * 2);
+	return true;
+}
+
+inline bool
+emu_gdb_expect(
+	std::string_view& text,
+	char c)
+{
+	if (text.empty() || text[0] != c)
+		return false;
+	text.remove_prefix(1);
+	return true;
+}
+
+// "$payload#cs" with '#', '$', '}' and '*' escaped, resent until the client acks it
+inline bool
+emu_gdb_send(
+	EGdbConnection& conn,
+	std::string_view payload)
+{
+	std::string packet = "$";
+	u8 checksum = 0;
+	for (char c : payload)
+	{
+		if (c == '#' || c == '$' || c == '}' || c == '*')
+		{
+			packet += '}';
+			checksum += (u8)'}';
+			c ^= 0x20;
+		}
+		packet += c;
+		checksum += (u8)c;
+	}
+	packet += '#';
+	emu_gdb_hex(packet, checksum, 1);
+
+	for (;;)
+	{
+		if (!emu_gdb_write(conn, packet))
+			return false;
+		if (conn.no_ack_)
+			return true;
+
+		i32 c = emu_gdb_getc(conn);
+		while (c >= 0 && c != '+' && c != '-')
+			c = emu_gdb_getc(conn);
+		if (c < 0)
+			return false;
+		if (c == '+')
+			return true;
+	}
+}
+
+// next packet without "$" / "#cs", "\x03" for the client's ^C, false once the connection is gone
+inline bool
+emu_gdb_receive(
+	EGdbConnection& conn,
+	std::string& packet)
+{
+	for (;;)
+	{
+		i32 c = emu_gdb_getc(conn);
+		if (c < 0)
+			return false;
+		if (c == 0x03)
+		{
+			packet = "\x03";
+			return true;
+		}
+		if (c != '$')
+			continue;   // acks and noise between packets
+
+		packet.clear();
+		u8 checksum = 0;
+		while ((c = emu_gdb_getc(conn)) >= 0 && c != '#')
+		{
+			checksum += (u8)c;
+			if (c == '}')
+			{
+				c = emu_gdb_getc(conn);
+				if (c < 0)
+					return false;
+				checksum += (u8)c;
+				c ^= 0x20;
+			}
+			packet += (char)c;
+		}
+
+		i32 hi = emu_gdb_getc(conn);
+		i32 lo = emu_gdb_getc(conn);
+		if (c < 0 || hi < 0 || lo < 0)
+			return false;
+
+		if (conn.no_ack_)
+			return true;
+
+		if (emu_gdb_hex_digit((char)hi) << 4 == (checksum & 0xF0) && emu_gdb_hex_digit((char)lo) == (checksum & 0xF))
+		{
+			emu_gdb_write(conn, "+");
+			return true;
+		}
+		emu_gdb_write(conn, "-");
+	}
+}
+
+// a ^C waiting on the socket, other bytes stay buffered for emu_gdb_receive
+inline bool
+emu_gdb_interrupted(
+	EGdbConnection& conn)
+{
+	if (conn.begin_ == conn.end_)
+	{
+		pollfd p = { conn.fd_, POLLIN, 0 };
+		if (poll(&p, 1, 0) <= 0 || !(p.revents & POLLIN))
+			return false;
+
+		ssize_t got = ::read(conn.fd_, conn.buffer_, sizeof(conn.buffer_));
+		if (got <= 0)
+			return false;
+		conn.begin_ = 0;
+		conn.end_ = (u32)got;
+	}
+
+	if (conn.buffer_[conn.begin_] != 0x03)
+		return false;
+	conn.begin_++;
+	return true;
+}
+
+template <u32 REG_COUNT>
+std::string
+emu_gdb_target_xml()
+{
+	std::string xml = "<?xml version=\"1.0\"?><!DOCTYPE target SYSTEM \"gdb-target.dtd\">"
+		"<target version=\"1.0\"><feature name=\"org.e16.core\">";
+	for (u32 r = 0; r < REG_COUNT; r++)
+		xml += "<reg name=\"r" + std::to_string(r) + "\" bitsize=\"16\" type=\"uint16\"/>";
+	xml += "<reg name=\"pc\" bitsize=\"32\" type=\"code_ptr\"/></feature></target>";
+	return xml;
+}
+
+template <u32 RAM_WORDS>
+[[nodiscard]] std::string
+emu_gdb_stop_reply(
+	EExecStatus status,
+	const EDebugT<RAM_WORDS>& debug,
+	bool interrupted)
+{
+	if (status == EEXEC_HALTED)
+		return "W00";
+	if (status == EEXEC_FAULT)
+		return "S0b";
+	if (interrupted)
+		return "S02";
+
+	if (status == EEXEC_BREAK && (debug.hit_.kind_ & (EDEBUG_WATCH_READ | EDEBUG_WATCH_WRITE)))
+	{
+		const u32 both = EDEBUG_WATCH_READ | EDEBUG_WATCH_WRITE;
+		const bool access = (debug.flags_[debug.hit_.where_] & both) == both;
+		std::string reply = access ? "T05awatch:" : debug.hit_.kind_ == EDEBUG_WATCH_WRITE ? "T05watch:" : "T05rwatch:";
+		char address[16];
+		snprintf(address, sizeof(address), "%x;", debug.hit_.where_ * 4);
+		return reply + address;
+	}
+	return "S05";
+}
+
+template <u32 RAM_WORDS, u32 REG_COUNT>
+Status
+emu_gdb_serve(
+	EStateT<RAM_WORDS, REG_COUNT>& state,
+	EDebugT<RAM_WORDS>& debug,
+	i32 fd)
+{
+	auto conn = std::make_unique<EGdbConnection>();
+	conn->fd_ = fd;
+
+	std::string packet;
+	std::string reply;
+	std::string last_stop = "S05";
+	while (emu_gdb_receive(*conn, packet))
+	{
+		std::string_view args = std::string_view(packet).substr(packet.empty() ? 0 : 1);
+		reply.clear();
+
+		switch (packet.empty() ? 0 : packet[0])
+		{
+		case '\x03':
+		case '?': {
+			reply = last_stop;
+		} break;
+		case 'g': {
+			for (u32 r = 0; r < REG_COUNT; r++)
+				emu_gdb_hex(reply, state.r_[r], 2);
+			emu_gdb_hex(reply, (u32)state.program_counter_ * 4, 4);
+		} break;
+		case 'G': {
+			ERegister r[REG_COUNT];
+			u32 value = 0;
+			bool ok = true;
+			for (u32 i = 0; i < REG_COUNT && ok; i++)
+			{
+				ok = emu_gdb_parse_bytes(args, 2, value);
+				r[i] = (ERegister)value;
+			}
+			if (ok && emu_gdb_parse_bytes(args, 4, value) && value / 4 < RAM_WORDS)
+			{
+				std::copy(r, r + REG_COUNT, state.r_);
+				state.program_counter_ = value / 4;
+				reply = "OK";
+			}
+			else
+				reply = "E01";
+		} break;
+		case 'p':
+		case 'P': {
+			u64 n = 0;
+			u32 value = 0;
+			if (!emu_gdb_parse(args, n) || n > REG_COUNT)
+				reply = "E01";
+			else if (packet[0] == 'p')
+				emu_gdb_hex(reply, n < REG_COUNT ? (u32)state.r_[n] : (u32)state.program_counter_ * 4, n < REG_COUNT ? 2 : 4);
+			else if (!emu_gdb_expect(args, '=') || !emu_gdb_parse_bytes(args, n < REG_COUNT ? 2 : 4, value)
+				|| (n == REG_COUNT && value / 4 >= RAM_WORDS))
+				reply = "E01";
+			else
+			{
+				if (n < REG_COUNT)
+					state.r_[n] = (ERegister)value;
+				else
+					state.program_counter_ = value / 4;
+				reply = "OK";
+			}
+		} break;
+		case 'm':
+		case 'M': {
+			u64 address = 0;
+			u64 length = 0;
+			if (!emu_gdb_parse(args, address) || !emu_gdb_expect(args, ',') || !emu_gdb_parse(args, length)
+				|| address + length > (u64)RAM_WORDS * 4 || length > EMU_GDB_MEMORY_MAX
+				|| (packet[0] == 'M' && (!emu_gdb_expect(args, ':') || args.size() != length * 2)))
+			{
+				reply = "E01";
+				break;
+			}
+
+			for (u64 a = address; a < address + length; a++)
+			{
+				EInstruction& word = state.ram_[a / 4];
+				const u32 shift = (u32)(a % 4) * 8;
+				if (packet[0] == 'm')
+				{
+					emu_gdb_hex(reply, word.get_value() >> shift, 1);
+					continue;
+				}
+
+				u32 byte = 0;
+				(void)emu_gdb_parse_bytes(args, 1, byte);
+				word.set_value((word.get_value() & ~(0xFFu << shift)) | byte << shift);
+			}
+			if (packet[0] == 'M')
+				reply = "OK";
+		} break;
+		case 's':
+		case 'c': {
+			u64 address = 0;
+			if (emu_gdb_parse(args, address))
+			{
+				if (address / 4 >= RAM_WORDS)
+				{
+					reply = "E01";
+					break;
+				}
+				state.program_counter_ = (u32)(address / 4);
+			}
+
+			EExecStatus status = EEXEC_BUDGET;
+			bool interrupted = false;
+			if (packet[0] == 's')
+				status = emu_execute_for(state, 1);
+			else
+			{
+				do
+				{
+					status = emu_execute_debug_for(state, debug, EMU_DEADLINE_SLICE);
+				} while (status == EEXEC_BUDGET && !(interrupted = emu_gdb_interrupted(*conn)));
+			}
+
+			last_stop = reply = emu_gdb_stop_reply(status, debug, interrupted);
+		} break;
+		case 'Z':
+		case 'z': {
+			u64 type = 0;
+			u64 address = 0;
+			u64 kind = 0;
+			if (!emu_gdb_parse(args, type) || !emu_gdb_expect(args, ',') || !emu_gdb_parse(args, address)
+				|| !emu_gdb_expect(args, ',') || !emu_gdb_parse(args, kind) || type > 4)
+			{
+				reply = "";   // not a type we know, the client tries something else
+				break;
+			}
+
+			const bool on = packet[0] == 'Z';
+			const u32 first = (u32)std::min<u64>(address / 4, UINT32_MAX);
+			Status status = FAILURE;
+			if (type <= 1)
+				status = emu_debug_break(debug, first, on);
+			else
+			{
+				// a watch covers every word the byte range touches
+				const u64 last = (address + std::max<u64>(kind, 1) - 1) / 4;
+				const u32 flags = type == 2 ? EDEBUG_WATCH_WRITE : type == 3 ? EDEBUG_WATCH_READ : EDEBUG_WATCH_READ | EDEBUG_WATCH_WRITE;
+				status = emu_debug_watch(debug, first, (u32)std::min<u64>(last - first + 1, UINT32_MAX), flags, on);
+			}
+			reply = status == SUCCESS ? "OK" : "E01";
+		} break;
+		case 'H':
+		case 'T': {
+			reply = "OK";
+		} break;
+		case 'D': {
+			emu_gdb_send(*conn, "OK");
+			return SUCCESS;
+		} break;
+		case 'k': {
+			return SUCCESS;
+		} break;
+		case 'q': {
+			constexpr std::string_view xfer = "qXfer:features:read:target.xml:";
+			if (packet.starts_with("qSupported"))
+			{
+				char size[16];
+				snprintf(size, sizeof(size), "%x", EMU_GDB_PACKET_SIZE);
+				reply = std::string("PacketSize=") + size + ";qXfer:features:read+;QStartNoAckMode+";
+			}
+			else if (packet == "qAttached")
+				reply = "1";
+			else if (packet == "qC")
+				reply = "QC1";
+			else if (packet == "qfThreadInfo")
+				reply = "m1";
+			else if (packet == "qsThreadInfo")
+				reply = "l";
+			else if (packet == "qOffsets")
+				reply = "Text=0;Data=0;Bss=0";
+			else if (packet.starts_with(xfer))
+			{
+				std::string_view range = std::string_view(packet).substr(xfer.size());
+				u64 offset = 0;
+				u64 length = 0;
+				if (!emu_gdb_parse(range, offset) || !emu_gdb_expect(range, ',') || !emu_gdb_parse(range, length))
+				{
+					reply = "E01";
+					break;
+				}
+
+				const std::string xml = emu_gdb_target_xml<REG_COUNT>();
+				const size_t begin = (size_t)std::min<u64>(offset, xml.size());
+				const size_t size = (size_t)std::min<u64>(length, EMU_GDB_PACKET_SIZE / 2);
+				std::string_view chunk = std::string_view(xml).substr(begin, size);
+				reply = (begin + chunk.size() < xml.size() ? "m" : "l") + std::string(chunk);
+			}
+		} break;
+		case 'Q': {
+			if (packet == "QStartNoAckMode")
+			{
+				if (!emu_gdb_send(*conn, "OK"))
+					return FAILURE;
+				conn->no_ack_ = true;
+				continue;
+			}
+		} break;
+		default: {
+			// an empty reply is "not supported" (vCont, vMustReplyEmpty, X, ...)
+		} break;
+		}
+
+		if (!emu_gdb_send(*conn, reply))
+			break;
+	}
+
+	// the client went away without k or D
+	return FAILURE;
+}
+
+// 127.0.0.1 only, the stub has no authentication
+inline i32
+emu_gdb_listen_tcp(
+	u16 port)
+{
+	i32 fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0)
+		return -1;
+
+	i32 one = 1;
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+	sockaddr_in address = {};
+	address.sin_family = AF_INET;
+	address.sin_port = htons(port);
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (bind(fd, (const sockaddr*)&address, sizeof(address)) != 0 || listen(fd, 1) != 0)
+	{
+		LOG("Can't listen on 127.0.0.1:%u: %s", (u32)port, strerror(errno));
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+// an old socket file at path is replaced
+inline i32
+emu_gdb_listen_unix(
+	const char* path)
+{
+	sockaddr_un address = {};
+	if (strlen(path) >= sizeof(address.sun_path))
+		return -1;
+
+	i32 fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0)
+		return -1;
+
+	address.sun_family = AF_UNIX;
+	strcpy(address.sun_path, path);
+	unlink(path);
+	if (bind(fd, (const sockaddr*)&address, sizeof(address)) != 0 || listen(fd, 1) != 0)
+	{
+		LOG("Can't listen on %s: %s", path, strerror(errno));
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+inline i32
+emu_gdb_accept(
+	i32 listen_fd)
+{
+	i32 fd = -1;
+	do
+	{
+		fd = accept(listen_fd, nullptr, nullptr);
+	} while (fd < 0 && errno == EINTR);
+
+	// packets are small and answered one by one, fails harmlessly on a unix socket
+	i32 one = 1;
+	if (fd >= 0)
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	return fd;
+}
+
+#endif
@@ -0,0 +1,375 @@
+#pragma once
+#include "e_base.h"
+#include "e_asm.h"
+
+#include <string_view>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define EMU_IMAGE_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#define EMU_IMAGE_MMAP 0
+#endif
+
+/*
+ * IMAGE FORMAT (version 1, little endian, every field u32):
+ *   - EImageHeader
+ *   - EImageSegment[segment_count_]  { word address, word count, byte offset of the words }
+ *   - EImageSymbol[symbol_count_]    { name offset into the strings, name size, word address }
+ *   - strings, padded to 4 bytes
+ *   - segment words, stored as the raw EInstruction data
+ *   - checksum_ is FNV-1a over everything after the header
+ * LOADING:
+ *   - emu_image_open maps the file read only (a plain read where there is no mmap) and checks
+ *     it once, after that any number of EStates can be filled from the same EImageMap, each
+ *     load clears ram_ and does one memcpy per segment straight out of the mapping (the file is
+ *     never copied as a whole, the words still are)
+ *   - runs of EMU_IMAGE_GAP or more zero words are not stored
+ */
+
+#define EMU_IMAGE_MAGIC 0x49363145 // "E16I"
+#define EMU_IMAGE_VERSION 1
+#define EMU_IMAGE_GAP 8
+
+struct EImageHeader
+{
+	u32 magic_;
+	u32 version_;
+	u32 entry_; // initial program_counter_
+	u32 segment_count_;
+	u32 symbol_count_;
+	u32 strings_size_;
+	u32 file_size_;
+	u32 checksum_;
+};
+
+struct EImageSegment
+{
+	u32 address_;
+	u32 words_;
+	u32 offset_;
+};
+
+struct EImageSymbol
+{
+	u32 name_offset_;
+	u32 name_size_;
+	u32 address_;
+};
+
+struct EImageMap
+{
+	const u8* data_ = nullptr;
+	size_t size_ = 0;
+	bool mapped_ = false;
+	std::vector<u8> buffer_; // owns the bytes when the file was read instead of mapped
+
+	EImageMap() = default;
+	EImageMap(const EImageMap&) = delete;
+	EImageMap& operator=(const EImageMap&) = delete;
+
+	~EImageMap()
+	{
+		close();
+	}
+
+	// an EImageMap can be opened again, the old mapping goes first
+	void
+	close()
+	{
+#if EMU_IMAGE_MMAP
+		if (mapped_)
+			munmap((void*)data_, size_);
+#endif
+		data_ = nullptr;
+		size_ = 0;
+		mapped_ = false;
+		buffer_.clear();
+	}
+};
+
+[[nodiscard]] inline const EImageHeader*
+emu_image_header(
+	const EImageMap& image)
+{
+	return (const EImageHeader*)image.data_;
+}
+
+[[nodiscard]] inline const EImageSegment*
+emu_image_segments(
+	const EImageMap& image)
+{
+	return (const EImageSegment*)(image.data_ + sizeof(EImageHeader));
+}
+
+[[nodiscard]] inline const EImageSymbol*
+emu_image_symbols(
+	const EImageMap& image)
+{
+	return (const EImageSymbol*)(emu_image_segments(image) + emu_image_header(image)->segment_count_);
+}
+
+[[nodiscard]] inline const char*
+emu_image_strings(
+	const EImageMap& image)
+{
+	return (const char*)(emu_image_symbols(image) + emu_image_header(image)->symbol_count_);
+}
+
+[[nodiscard]] inline u32
+emu_image_checksum(
+	const u8* data,
+	size_t size)
+{
+	return emu_asm_hash(std::string_view((const char*)data, size));
+}
+
+Status
+emu_image_build(
+	std::vector<u8>& out,
+	const EAsmCompillerData& program,
+	u32 entry = 0)
+{
+	constexpr u32 ram_size = ARRAY_SIZE(program.compilled_code);
+
+	const auto word = [&](u32 i) { return program.compilled_code[i].data; };
+
+	std::vector<EImageSegment> segments;
+	for (u32 i = 0; i < ram_size;)
+	{
+		if (word(i) == 0)
+		{
+			i++;
+			continue;
+		}
+
+		// extend over short runs of zeros
+		u32 end = i + 1;
+		for (u32 zeros = 0; end + zeros < ram_size && zeros < EMU_IMAGE_GAP;)
+		{
+			if (word(end + zeros) != 0)
+			{
+				end += zeros + 1;
+				zeros = 0;
+			}
+			else
+				zeros++;
+		}
+
+		segments.push_back({ i, end - i, 0 });
+		i = end;
+	}
+
+	std::vector<EImageSymbol> symbols;
+	std::string strings;
+	for (const auto& symbol : program.symbols_.symbols_)
+	{
+		if (!symbol.defined_)
+			continue;
+		std::string_view name = emu_asm_symbol_name(program.symbols_, symbol);
+		symbols.push_back({ (u32)strings.size(), (u32)name.size(), symbol.address_ });
+		strings += name;
+	}
+	strings.resize((strings.size() + 3) & ~size_t(3));
+
+	size_t offset = sizeof(EImageHeader) + segments.size() * sizeof(EImageSegment) + symbols.size() * sizeof(EImageSymbol) + strings.size();
+	for (auto& segment : segments)
+	{
+		segment.offset_ = (u32)offset;
+		offset += segment.words_ * sizeof(u32);
+	}
+
+	EImageHeader header = {};
+	header.magic_ = EMU_IMAGE_MAGIC;
+	header.version_ = EMU_IMAGE_VERSION;
+	header.entry_ = entry;
+	header.segment_count_ = (u32)segments.size();
+	header.symbol_count_ = (u32)symbols.size();
+	header.strings_size_ = (u32)strings.size();
+	header.file_size_ = (u32)offset;
+
+	out.assign(offset, 0);
+	u8* p = out.data() + sizeof(header);
+	std::memcpy(p, segments.data(), segments.size() * sizeof(EImageSegment));
+	p += segments.size() * sizeof(EImageSegment);
+	std::memcpy(p, symbols.data(), symbols.size() * sizeof(EImageSymbol));
+	p += symbols.size() * sizeof(EImageSymbol);
+	std::memcpy(p, strings.data(), strings.size());
+	for (const auto& segment : segments)
+		std::memcpy(out.data() + segment.offset_, &program.compilled_code[segment.address_], segment.words_ * sizeof(u32));
+
+	header.checksum_ = emu_image_checksum(out.data() + sizeof(header), out.size() - sizeof(header));
+	std::memcpy(out.data(), &header, sizeof(header));
+
+	return SUCCESS;
+}
+
+Status
+emu_image_write(
+	const char* filepath,
+	const EAsmCompillerData& program,
+	u32 entry = 0)
+{
+	std::vector<u8> bytes;
+	emu_image_build(bytes, program, entry);
+
+	FILE* f = fopen(filepath, "wb");
+	if (!f)
+	{
+		LOG("Can't create image: %s", filepath);
+		return FILE_NOT_FOUND;
+	}
+
+	size_t written = fwrite(bytes.data(), 1, bytes.size(), f);
+	fclose(f);
+
+	return written == bytes.size() ? SUCCESS : FAILURE;
+}
+
+// every offset and count is checked here once, loads trust the image afterwards
+Status
+emu_image_validate(
+	const u8* data,
+	size_t size)
+{
+	constexpr u32 ram_size = RAM_SIZE / sizeof(EInstruction);
+
+	if (size < sizeof(EImageHeader) || ((uintptr_t)data & 3))
+		return INVALID_FILE;
+
+	const EImageHeader& header = *(const EImageHeader*)data;
+	if (header.magic_ != EMU_IMAGE_MAGIC || header.version_ != EMU_IMAGE_VERSION || header.file_size_ != size)
+	{
+		LOG("Not an image or a different version: magic %08x version %u", header.magic_, header.version_);
+		return INVALID_FILE;
+	}
+
+	u64 tables = sizeof(EImageHeader) + (u64)header.segment_count_ * sizeof(EImageSegment)
+		+ (u64)header.symbol_count_ * sizeof(EImageSymbol) + header.strings_size_;
+	if (tables > size || (header.strings_size_ & 3) || header.entry_ >= ram_size)
+		return INVALID_FILE;
+
+	if (emu_image_checksum(data + sizeof(header), size - sizeof(header)) != header.checksum_)
+	{
+		LOG("Image checksum mismatch!");
+		return INVALID_FILE;
+	}
+
+	const auto* segments = (const EImageSegment*)(data + sizeof(header));
+	for (u32 i = 0; i < header.segment_count_; i++)
+	{
+		const auto& s = segments[i];
+		if ((u64)s.address_ + s.words_ > ram_size || (s.offset_ & 3) || s.offset_ < tables
+			|| (u64)s.offset_ + (u64)s.words_ * sizeof(u32) > size)
+			return INVALID_FILE;
+	}
+
+	const auto* symbols = (const EImageSymbol*)(segments + header.segment_count_);
+	for (u32 i = 0; i < header.symbol_count_; i++)
+	{
+		if ((u64)symbols[i].name_offset_ + symbols[i].name_size_ > header.strings_size_)
+			return INVALID_FILE;
+	}
+
+	return SUCCESS;
+}
+
+Status
+emu_image_open(
+	EImageMap& image,
+	const char* filepath)
+{
+	image.close();
+
+#if EMU_IMAGE_MMAP
+	int fd = open(filepath, O_RDONLY);
+	if (fd < 0)
+	{
+		LOG("Image not found: %s", filepath);
+		return FILE_NOT_FOUND;
+	}
+
+	struct stat st = {};
+	void* data = MAP_FAILED;
+	if (fstat(fd, &st) == 0 && st.st_size > 0)
+		data = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (data == MAP_FAILED)
+		return INVALID_FILE;
+
+	image.data_ = (const u8*)data;
+	image.size_ = (size_t)st.st_size;
+	image.mapped_ = true;
+#else
+	FILE* f = fopen(filepath, "rb");
+	if (!f)
+	{
+		LOG("Image not found: %s", filepath);
+		return FILE_NOT_FOUND;
+	}
+
+	image.buffer_.resize(get_file_size(f));
+	size_t read = fread(image.buffer_.data(), 1, image.buffer_.size(), f);
+	fclose(f);
+	if (read != image.buffer_.size())
+		return INVALID_FILE;
+
+	image.data_ = image.buffer_.data();
+	image.size_ = image.buffer_.size();
+#endif
+
+	return emu_image_validate(image.data_, image.size_);
+}
+
+// view over bytes the caller keeps alive
+Status
+emu_image_open_memory(
+	EImageMap& image,
+	const u8* data,
+	size_t size)
+{
+	image.close();
+	image.data_ = data;
+	image.size_ = size;
+	return emu_image_validate(data, size);
+}
+
+Status
+emu_image_load(
+	EState& state,
+	const EImageMap& image)
+{
+	const EImageHeader* header = emu_image_header(image);
+	const EImageSegment* segments = emu_image_segments(image);
+
+	std::fill(std::begin(state.ram_), std::end(state.ram_), EInstruction{});
+	for (u32 i = 0; i < header->segment_count_; i++)
+		std::memcpy(&state.ram_[segments[i].address_], image.data_ + segments[i].offset_, segments[i].words_ * sizeof(u32));
+
+	state.command_register_ = { 0 };
+	state.program_counter_ = (ERegister)header->entry_;
+	state.halt_ = false;
+	state.no_pc_increment_ = false;
+
+	return SUCCESS;
+}
+
+[[nodiscard]] const EImageSymbol*
+emu_image_find_symbol(
+	const EImageMap& image,
+	std::string_view name)
+{
+	const EImageSymbol* symbols = emu_image_symbols(image);
+	const char* strings = emu_image_strings(image);
+	for (u32 i = 0; i < emu_image_header(image)->symbol_count_; i++)
+	{
+		if (std::string_view(strings + symbols[i].name_offset_, symbols[i].name_size_) == name)
+			return &symbols[i];
+	}
+	return nullptr;
+}
@@ -0,0 +1,705 @@
+#pragma once
+#include "e_base.h"
+#include "e_predecode.h"
+
+#include <vector>
+#include <cstddef>
+#include <cstring>
+
+/*
+ * BASIC BLOCK JIT (x86-64, SysV):
+ *   - a block starts at any pc and ends after beq/jalr/jma/jmbe/halt, before an instruction
+ *     that can't be compiled, or after EMU_JIT_MAX_BLOCK instructions
+ *   - inside a block r0..r7 live in r8d..r15d, r8 in ebx, the flags in ebp (CF | SF << 8 | ZF << 16)
+ *   - rdi holds the EState, rsi the per word "is compiled" map used to catch self-modifying stores
+ *   - a store into compiled code leaves the block, the blocks covering the word are dropped and
+ *     the word is interpreted from then on
+ *   - cases emu_process leaves undefined (address out of ram, division by zero) leave the block
+ *     and are handled by the dispatcher, which stops with FAILURE like emu_execute_predecoded
+ *   - a pc where no block can start is remembered with its word, it is only tried again once
+ *     the word changed
+ *   - on other platforms emu_execute_jit simply interprets
+ *   - the context belongs to one state, call emu_jit_reset after changing ram_ from outside
+ */
+
+#if defined(__x86_64__) && defined(__linux__)
+#define EMU_JIT_AVAILABLE 1
+#include <sys/mman.h>
+#else
+#define EMU_JIT_AVAILABLE 0
+#endif
+
+#define EMU_JIT_ARENA_SIZE (4 << 20)
+#define EMU_JIT_MAX_BLOCK 256
+
+enum EJitExit
+{
+	EJIT_EXIT_NEXT,   // continue at program_counter_
+	EJIT_EXIT_INTERP, // instruction at program_counter_ must go through the interpreter
+	EJIT_EXIT_SMC     // a compiled word was written, its address is in the upper 32 bits
+};
+
+// returns EJitExit | retired instructions << 8 | written address << 32
+using EJitBlockFn = u64(*)(EState*, const u8*);
+
+struct EJitBlock
+{
+	u32 begin_;
+	u32 end_;
+};
+
+struct EJitContext
+{
+	static constexpr u32 ram_size_ = RAM_SIZE / sizeof(EInstruction);
+
+	u8* arena_ = nullptr;
+	size_t arena_used_ = 0;
+
+	EJitBlockFn entry_[ram_size_] = {}; // compiled block starting at pc
+	u8 code_map_[ram_size_] = {};       // word is part of a compiled block
+	u8 interpret_only_[ram_size_] = {}; // word was modified at run time, never compiled again
+	u8 no_block_[ram_size_] = {};       // no block could be compiled at pc for the word in no_block_word_
+	u32 no_block_word_[ram_size_] = {}; // a store that changes the word makes pc worth another try
+	std::vector<EJitBlock> blocks_;
+
+	EJitContext() = default;
+	EJitContext(const EJitContext&) = delete;
+	EJitContext& operator=(const EJitContext&) = delete;
+
+	~EJitContext()
+	{
+#if EMU_JIT_AVAILABLE
+		if (arena_)
+			munmap(arena_, EMU_JIT_ARENA_SIZE);
+#endif
+	}
+};
+
+Status
+emu_jit_reset(
+	EJitContext& jit)
+{
+	std::fill(std::begin(jit.entry_), std::end(jit.entry_), nullptr);
+	std::fill(std::begin(jit.code_map_), std::end(jit.code_map_), 0);
+	std::fill(std::begin(jit.interpret_only_), std::end(jit.interpret_only_), 0);
+	std::fill(std::begin(jit.no_block_), std::end(jit.no_block_), 0);
+	jit.blocks_.clear();
+	jit.arena_used_ = 0;
+
+	return SUCCESS;
+}
+
+#if EMU_JIT_AVAILABLE
+
+enum EJitHostReg
+{
+	JIT_RAX, JIT_RCX, JIT_RDX, JIT_RBX, JIT_RSP, JIT_RBP, JIT_RSI, JIT_RDI,
+	JIT_R8, JIT_R9, JIT_R10, JIT_R11, JIT_R12, JIT_R13, JIT_R14, JIT_R15
+};
+
+static constexpr u32 jit_guest_regs[REGISTERS_COUNT] = {
+	JIT_R8, JIT_R9, JIT_R10, JIT_R11, JIT_R12, JIT_R13, JIT_R14, JIT_R15, JIT_RBX
+};
+
+static constexpr u32 jit_saved_regs[] = { JIT_RBX, JIT_RBP, JIT_R12, JIT_R13, JIT_R14, JIT_R15 };
+
+// minimal x86-64 encoder, 32 bit operand size unless stated otherwise
+struct EJitEmitter
+{
+	std::vector<u8> code_;
+
+	void byte(u32 b) { code_.push_back((u8)b); }
+	void imm16(u32 v) { byte(v); byte(v >> 8); }
+	void imm32(u32 v) { imm16(v); imm16(v >> 16); }
+	void imm64(u64 v) { imm32((u32)v); imm32((u32)(v >> 32)); }
+
+	void rex(bool w, u32 reg, u32 index, u32 base)
+	{
+		u32 r = 0x40 | (w << 3) | ((reg >> 3) << 2) | ((index >> 3) << 1) | (base >> 3);
+		if (r != 0x40)
+			byte(r);
+	}
+
+	void modrm_rr(u32 reg, u32 rm) { byte(0xC0 | ((reg & 7) << 3) | (rm & 7)); }
+
+	// [base + disp32]
+	void modrm_mem(u32 reg, u32 base, i32 disp)
+	{
+		byte(0x80 | ((reg & 7) << 3) | (base & 7));
+		if ((base & 7) == JIT_RSP)
+			byte(0x24);
+		imm32(disp);
+	}
+
+	// [base + index * (1 << scale) + disp32]
+	void modrm_sib(u32 reg, u32 base, u32 index, u32 scale, i32 disp)
+	{
+		byte(0x80 | ((reg & 7) << 3) | 4);
+		byte((scale << 6) | ((index & 7) << 3) | (base & 7));
+		imm32(disp);
+	}
+
+	void op_rr(u32 op, u32 reg, u32 rm) { rex(false, reg, 0, rm); byte(op); modrm_rr(reg, rm); }
+	void op2_rr(u32 op, u32 reg, u32 rm) { rex(false, reg, 0, rm); byte(0x0F); byte(op); modrm_rr(reg, rm); }
+
+	void mov_rr(u32 dst, u32 src) { op_rr(0x89, src, dst); }
+	void alu_rr(u32 op, u32 dst, u32 src) { op_rr(op, src, dst); }
+	void test_rr(u32 a, u32 b) { op_rr(0x85, b, a); }
+	void imul_rr(u32 dst, u32 src) { op2_rr(0xAF, dst, src); }
+	void movzx16_rr(u32 dst, u32 src) { op2_rr(0xB7, dst, src); }
+
+	void mov_ri(u32 dst, u32 imm) { rex(false, 0, 0, dst); byte(0xB8 + (dst & 7)); imm32(imm); }
+	void alu_ri(u32 ext, u32 dst, u32 imm) { rex(false, 0, 0, dst); byte(0x81); modrm_rr(ext, dst); imm32(imm); }
+	void unary(u32 ext, u32 dst) { rex(false, 0, 0, dst); byte(0xF7); modrm_rr(ext, dst); }
+	void shift_cl(u32 ext, u32 dst) { rex(false, 0, 0, dst); byte(0xD3); modrm_rr(ext, dst); }
+	void shift_ri(u32 ext, u32 dst, u32 imm) { rex(false, 0, 0, dst); byte(0xC1); modrm_rr(ext, dst); byte(imm); }
+
+	void load32(u32 dst, u32 base, i32 disp) { rex(false, dst, 0, base); byte(0x8B); modrm_mem(dst, base, disp); }
+	void load32_sib(u32 dst, u32 base, u32 index, i32 disp) { rex(false, dst, index, base); byte(0x8B); modrm_sib(dst, base, index, 2, disp); }
+	void movzx8_load(u32 dst, u32 base, i32 disp) { rex(false, dst, 0, base); byte(0x0F); byte(0xB6); modrm_mem(dst, base, disp); }
+	void movzx16_load(u32 dst, u32 base, i32 disp) { rex(false, dst, 0, base); byte(0x0F); byte(0xB7); modrm_mem(dst, base, disp); }
+	void movzx16_load_sib(u32 dst, u32 base, u32 index, i32 disp) { rex(false, dst, index, base); byte(0x0F); byte(0xB7); modrm_sib(dst, base, index, 2, disp); }
+
+	void store32(u32 base, i32 disp, u32 src) { rex(false, src, 0, base); byte(0x89); modrm_mem(src, base, disp); }
+	void store32_imm(u32 base, i32 disp, u32 imm) { rex(false, 0, 0, base); byte(0xC7); modrm_mem(0, base, disp); imm32(imm); }
+	void store32_imm_sib(u32 base, u32 index, i32 disp, u32 imm) { rex(false, 0, index, base); byte(0xC7); modrm_sib(0, base, index, 2, disp); imm32(imm); }
+	void store16(u32 base, i32 disp, u32 src) { byte(0x66); rex(false, src, 0, base); byte(0x89); modrm_mem(src, base, disp); }
+	void store16_imm(u32 base, i32 disp, u32 imm) { byte(0x66); rex(false, 0, 0, base); byte(0xC7); modrm_mem(0, base, disp); imm16(imm); }
+	void store8(u32 base, i32 disp, u32 src) { ASSERT(src < JIT_RSP); rex(false, src, 0, base); byte(0x88); modrm_mem(src, base, disp); }
+	void store8_imm(u32 base, i32 disp, u32 imm) { rex(false, 0, 0, base); byte(0xC6); modrm_mem(0, base, disp); byte(imm); }
+	void cmp8_imm(u32 base, i32 disp, u32 imm) { rex(false, 0, 0, base); byte(0x80); modrm_mem(7, base, disp); byte(imm); }
+	void cmp8_imm_sib(u32 base, u32 index, u32 imm) { rex(false, 0, index, base); byte(0x80); modrm_sib(7, base, index, 0, 0); byte(imm); }
+
+	void mov_rax_imm64(u64 imm) { byte(0x48); byte(0xB8); imm64(imm); }
+	void shl_rax(u32 imm) { byte(0x48); byte(0xC1); byte(0xE0); byte(imm); }
+	void or_rax(u32 imm) { byte(0x48); byte(0x0D); imm32(imm); }
+
+	void push(u32 r) { if (r >= 8) byte(0x41); byte(0x50 + (r & 7)); }
+	void pop(u32 r) { if (r >= 8) byte(0x41); byte(0x58 + (r & 7)); }
+	void ret() { byte(0xC3); }
+
+	// rel32 jumps, return the position to patch
+	size_t jcc(u32 cc) { byte(0x0F); byte(0x80 + cc); imm32(0); return code_.size() - 4; }
+	size_t jmp() { byte(0xE9); imm32(0); return code_.size() - 4; }
+
+	void patch(size_t at, size_t target)
+	{
+		i32 rel = (i32)(target - (at + 4));
+		for (u32 i = 0; i < 4; i++)
+			code_[at + i] = (u8)((u32)rel >> (i * 8));
+	}
+};
+
+enum EJitCondition
+{
+	JIT_CC_B = 0x2,
+	JIT_CC_AE = 0x3,
+	JIT_CC_E = 0x4,
+	JIT_CC_NE = 0x5,
+	JIT_CC_BE = 0x6,
+	JIT_CC_A = 0x7
+};
+
+enum EJitAluOp
+{
+	JIT_ALU_ADD = 0x01,
+	JIT_ALU_OR = 0x09,
+	JIT_ALU_AND = 0x21,
+	JIT_ALU_SUB = 0x29,
+	JIT_ALU_XOR = 0x31,
+	JIT_ALU_CMP = 0x39
+};
+
+struct EJitSideExit
+{
+	size_t jump_;    // jcc to patch
+	u32 pc_;         // instruction to interpret
+	u32 retired_;    // instructions of the block retired before it
+};
+
+struct EJitCompiler
+{
+	static constexpr i32 off_r_ = offsetof(EState, r_);
+	static constexpr i32 off_f_ = offsetof(EState, f_);
+	static constexpr i32 off_pc_ = offsetof(EState, program_counter_);
+	static constexpr i32 off_cmd_ = offsetof(EState, command_register_);
+	static constexpr i32 off_ram_ = offsetof(EState, ram_);
+	static constexpr i32 off_halt_ = offsetof(EState, halt_);
+
+	EJitEmitter e_;
+	std::vector<size_t> to_epilogue_;
+	std::vector<EJitSideExit> side_exits_;
+
+	void prologue()
+	{
+		for (u32 r : jit_saved_regs)
+			e_.push(r);
+
+		for (u32 i = 0; i < REGISTERS_COUNT; i++)
+			e_.movzx16_load(jit_guest_regs[i], JIT_RDI, off_r_ + 2 * i);
+
+		e_.movzx8_load(JIT_RBP, JIT_RDI, off_f_ + 2);
+		e_.shift_ri(4, JIT_RBP, 16);
+		e_.movzx16_load(JIT_RAX, JIT_RDI, off_f_);
+		e_.alu_rr(JIT_ALU_OR, JIT_RBP, JIT_RAX);
+	}
+
+	void epilogue()
+	{
+		size_t here = e_.code_.size();
+		for (size_t at : to_epilogue_)
+			e_.patch(at, here);
+
+		for (u32 i = 0; i < REGISTERS_COUNT; i++)
+			e_.store16(JIT_RDI, off_r_ + 2 * i, jit_guest_regs[i]);
+
+		e_.store16(JIT_RDI, off_f_, JIT_RBP);
+		e_.mov_rr(JIT_RCX, JIT_RBP);
+		e_.shift_ri(5, JIT_RCX, 16);
+		e_.store8(JIT_RDI, off_f_ + 2, JIT_RCX);
+
+		for (size_t i = ARRAY_SIZE(jit_saved_regs); i > 0; i--)
+			e_.pop(jit_saved_regs[i - 1]);
+		e_.ret();
+	}
+
+	// leave the block with a static program counter
+	void exit(u32 pc, u32 reason, u32 retired, u32 last_word)
+	{
+		e_.store16_imm(JIT_RDI, off_pc_, pc & BITS_16_MASK);
+		e_.store32_imm(JIT_RDI, off_cmd_, last_word);
+		e_.mov_rax_imm64(reason | (u64)retired << 8);
+		to_epilogue_.push_back(e_.jmp());
+	}
+
+	void side_exit(size_t jump, u32 pc, u32 retired)
+	{
+		side_exits_.push_back({ jump, pc, retired });
+	}
+
+	void emit_side_exits()
+	{
+		for (const auto& s : side_exits_)
+		{
+			e_.patch(s.jump_, e_.code_.size());
+			e_.store16_imm(JIT_RDI, off_pc_, s.pc_);
+			e_.mov_rax_imm64(EJIT_EXIT_INTERP | (u64)s.retired_ << 8);
+			to_epilogue_.push_back(e_.jmp());
+		}
+	}
+
+	// value operand the way emu_process reads it: direct operands are the field itself
+	void arg(u32 dst, u32 index, bool direct)
+	{
+		if (direct)
+			e_.mov_ri(dst, index);
+		else
+			e_.mov_rr(dst, jit_guest_regs[index]);
+	}
+
+	// store of a static ram_ word, leaves the block if the word is compiled code
+	void check_smc(u32 addr, u32 next_pc, u32 retired, u32 word)
+	{
+		e_.cmp8_imm(JIT_RSI, addr, 0);
+		size_t skip = e_.jcc(JIT_CC_E);
+		e_.store16_imm(JIT_RDI, off_pc_, next_pc & BITS_16_MASK);
+		e_.store32_imm(JIT_RDI, off_cmd_, word);
+		e_.mov_rax_imm64(EJIT_EXIT_SMC | (u64)retired << 8 | (u64)addr << 32);
+		to_epilogue_.push_back(e_.jmp());
+		e_.patch(skip, e_.code_.size());
+	}
+
+	// returns false when the instruction ends the block
+	bool instruction(const EDecodedInstruction& d, u32 pc, u32 idx, u32 word)
+	{
+		constexpr u32 ram_size = EJitContext::ram_size_;
+		const u32 rr = jit_guest_regs[d.rr_ < REGISTERS_COUNT ? d.rr_ : 0];
+
+		const auto alu = [&](u32 op) {
+			arg(JIT_RAX, d.ra_, d.ra_direct_);
+			arg(JIT_RCX, d.rb_, d.rb_direct_);
+			e_.alu_rr(op, JIT_RAX, JIT_RCX);
+		};
+
+		const auto with_carry = [&](u32 op) {
+			alu(op);
+			e_.mov_rr(JIT_RDX, JIT_RBP);
+			e_.alu_ri(4, JIT_RDX, 0xFF);
+			e_.alu_rr(op, JIT_RAX, JIT_RDX);
+		};
+
+		const auto branch = [&](u32 skip_cc) {
+			arg(JIT_RAX, d.ra_, d.ra_direct_);
+			arg(JIT_RCX, d.rb_, d.rb_direct_);
+			e_.alu_rr(JIT_ALU_CMP, JIT_RAX, JIT_RCX);
+			size_t fall = e_.jcc(skip_cc);
+			exit(pc + 1 + d.offset_, EJIT_EXIT_NEXT, idx + 1, word);
+			e_.patch(fall, e_.code_.size());
+			exit(pc + 1, EJIT_EXIT_NEXT, idx + 1, word);
+		};
+
+		switch (d.opcode_)
+		{
+		case E_ADD: {
+			// in add a direct operand is a memory read
+			if (d.ra_direct_)
+			{
+				e_.load32(JIT_RAX, JIT_RDI, off_ram_ + 4 * d.ra_);
+				e_.alu_ri(4, JIT_RAX, BITS_27_MASK);
+			}
+			else
+				arg(JIT_RAX, d.ra_, false);
+
+			if (d.rb_direct_)
+			{
+				e_.load32(JIT_RCX, JIT_RDI, off_ram_ + 4 * d.rb_);
+				e_.alu_ri(4, JIT_RCX, BITS_27_MASK);
+			}
+			else
+				arg(JIT_RCX, d.rb_, false);
+
+			e_.alu_rr(JIT_ALU_ADD, JIT_RAX, JIT_RCX);
+			e_.movzx16_rr(rr, JIT_RAX);
+		} break;
+		case E_NAND: {
+			alu(JIT_ALU_AND);
+			e_.unary(2, JIT_RAX);
+			e_.movzx16_rr(rr, JIT_RAX);
+		} break;
+		case E_AND: {
+			alu(JIT_ALU_AND);
+			e_.movzx16_rr(rr, JIT_RAX);
+		} break;
+		case E_XOR: {
+			alu(JIT_ALU_XOR);
+			e_.movzx16_rr(rr, JIT_RAX);
+		} break;
+		case E_IMUL: {
+			arg(JIT_RAX, d.ra_, d.ra_direct_);
+			arg(JIT_RCX, d.rb_, d.rb_direct_);
+			e_.imul_rr(JIT_RAX, JIT_RCX);
+			e_.movzx16_rr(rr, JIT_RAX);
+		} break;
+		case E_SHR: {
+			arg(JIT_RAX, d.ra_, d.ra_direct_);
+			arg(JIT_RCX, d.rb_, d.rb_direct_);
+			e_.shift_cl(5, JIT_RAX);
+			e_.movzx16_rr(rr, JIT_RAX);
+		} break;
+		case E_IDIV: {
+			arg(JIT_RAX, d.ra_, d.ra_direct_);
+			arg(JIT_RCX, d.rb_, d.rb_direct_);
+			e_.test_rr(JIT_RCX, JIT_RCX);
+			side_exit(e_.jcc(JIT_CC_E), pc, idx);
+			e_.alu_rr(JIT_ALU_XOR, JIT_RDX, JIT_RDX);
+			e_.unary(6, JIT_RCX);
+			e_.movzx16_rr(rr, JIT_RAX);
+		} break;
+		case E_ADC: {
+			with_carry(JIT_ALU_ADD);
+			e_.movzx16_rr(rr, JIT_RAX);
+		} break;
+		case E_SBB: {
+			with_carry(JIT_ALU_SUB);
+			e_.movzx16_rr(rr, JIT_RAX);
+		} break;
+		case E_CMP: {
+			arg(JIT_RAX, d.ra_, d.ra_direct_);
+			arg(JIT_RCX, d.rb_, d.rb_direct_);
+			e_.alu_rr(JIT_ALU_CMP, JIT_RAX, JIT_RCX);
+			e_.mov_ri(JIT_RBP, 0x000101);
+			size_t below = e_.jcc(JIT_CC_B);
+			e_.mov_ri(JIT_RBP, 0x010000);
+			size_t equal = e_.jcc(JIT_CC_E);
+			e_.mov_ri(JIT_RBP, 0);
+			e_.patch(below, e_.code_.size());
+			e_.patch(equal, e_.code_.size());
+		} break;
+		case E_LW: {
+			arg(JIT_RCX, d.rb_, d.rb_direct_);
+			if (d.offset_)
+				e_.alu_ri(0, JIT_RCX, (u32)(i32)d.offset_);
+			e_.alu_ri(7, JIT_RCX, ram_size);
+			side_exit(e_.jcc(JIT_CC_AE), pc, idx);
+			e_.movzx16_load_sib(jit_guest_regs[d.ra_], JIT_RDI, JIT_RCX, off_ram_);
+		} break;
+		case E_SW: {
+			u32 addr = d.ra_ + d.offset_;
+			arg(JIT_RAX, d.rb_, d.rb_direct_);
+			e_.store32(JIT_RDI, off_ram_ + 4 * addr, JIT_RAX);
+			check_smc(addr, pc + 1, idx + 1, word);
+		} break;
+		case E_INC: {
+			if (d.ra_direct_)
+			{
+				i32 disp = off_ram_ + 4 * d.ra_;
+				e_.load32(JIT_RAX, JIT_RDI, disp);
+				e_.alu_ri(4, JIT_RAX, BITS_27_MASK);
+				e_.alu_ri(0, JIT_RAX, 1);
+				e_.alu_ri(4, JIT_RAX, BITS_27_MASK);
+				e_.store32(JIT_RDI, disp, JIT_RAX);
+				check_smc(d.ra_, pc + 1, idx + 1, word);
+			}
+			else
+			{
+				u32 r = jit_guest_regs[d.ra_];
+				e_.alu_ri(0, r, 1);
+				e_.movzx16_rr(r, r);
+			}
+		} break;
+		case E_NOOP: {
+		} break;
+		case E_BEQ: {
+			branch(JIT_CC_NE);
+			return false;
+		}
+		case E_JMA: {
+			branch(JIT_CC_BE);
+			return false;
+		}
+		case E_JMBE: {
+			branch(JIT_CC_A);
+			return false;
+		}
+		case E_HALT: {
+			e_.store8_imm(JIT_RDI, off_halt_, 1);
+			exit(pc + 1, EJIT_EXIT_NEXT, idx + 1, word);
+			return false;
+		}
+		case E_JALR: {
+			arg(JIT_RCX, d.ra_, d.ra_direct_);
+			if (!d.ra_direct_)
+			{
+				e_.alu_ri(7, JIT_RCX, ram_size);
+				side_exit(e_.jcc(JIT_CC_AE), pc, idx);
+			}
+			arg(JIT_RDX, d.rb_, d.rb_direct_);
+			e_.store32_imm_sib(JIT_RDI, JIT_RCX, off_ram_, (pc + 1) & BITS_16_MASK);
+			e_.store16(JIT_RDI, off_pc_, JIT_RDX);
+			e_.store32_imm(JIT_RDI, off_cmd_, word);
+
+			e_.cmp8_imm_sib(JIT_RSI, JIT_RCX, 0);
+			size_t clean = e_.jcc(JIT_CC_E);
+			e_.mov_rr(JIT_RAX, JIT_RCX);
+			e_.shl_rax(32);
+			e_.or_rax(EJIT_EXIT_SMC | (idx + 1) << 8);
+			to_epilogue_.push_back(e_.jmp());
+			e_.patch(clean, e_.code_.size());
+			e_.mov_rax_imm64(EJIT_EXIT_NEXT | (u64)(idx + 1) << 8);
+			to_epilogue_.push_back(e_.jmp());
+			return false;
+		}
+		default: {
+			ASSERT(false && "Instruction is not compilable!");
+		} break;
+		}
+
+		return true;
+	}
+};
+
+// instructions the block compiler refuses, the block ends right before them
+[[nodiscard]] inline bool
+emu_jit_compilable(
+	const EDecodedInstruction& d)
+{
+	constexpr u32 ram_size = EJitContext::ram_size_;
+
+	if (d.opcode_ == E_DECODED_INVALID)
+		return false;
+	if (d.opcode_ == E_SW && (u32)(d.ra_ + d.offset_) >= ram_size)
+		return false;
+	return true;
+}
+
+[[nodiscard]] EJitBlockFn
+emu_jit_compile(
+	EJitContext& jit,
+	const EState& state,
+	u32 begin)
+{
+	constexpr u32 ram_size = EJitContext::ram_size_;
+
+	if (!jit.arena_)
+	{
+		void* arena = mmap(nullptr, EMU_JIT_ARENA_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (arena == MAP_FAILED)
+		{
+			LOG("JIT arena allocation failed!");
+			return nullptr;
+		}
+		jit.arena_ = (u8*)arena;
+	}
+
+	EJitCompiler c;
+	c.prologue();
+
+	u32 pc = begin;
+	u32 idx = 0;
+	bool open = true;
+	while (open)
+	{
+		if (pc >= ram_size || jit.interpret_only_[pc] || idx == EMU_JIT_MAX_BLOCK)
+			break;
+
+		EDecodedInstruction d = emu_decode(state.ram_[pc]);
+		if (!emu_jit_compilable(d))
+			break;
+
+		open = c.instruction(d, pc, idx, state.ram_[pc].data);
+		pc++;
+		idx++;
+	}
+
+	if (idx == 0)
+		return nullptr;
+
+	if (open)
+	{
+		// ran into something the interpreter has to deal with, continue there
+		c.e_.store16_imm(JIT_RDI, EJitCompiler::off_pc_, pc & BITS_16_MASK);
+		c.e_.mov_rax_imm64(EJIT_EXIT_NEXT | (u64)idx << 8);
+		c.to_epilogue_.push_back(c.e_.jmp());
+	}
+
+	c.emit_side_exits();
+	c.epilogue();
+
+	const auto& code = c.e_.code_;
+	if (code.size() > EMU_JIT_ARENA_SIZE)
+		return nullptr;
+
+	if (jit.arena_used_ + code.size() > EMU_JIT_ARENA_SIZE)
+	{
+		// arena is full - start over, blocks get recompiled on demand
+		std::fill(std::begin(jit.entry_), std::end(jit.entry_), nullptr);
+		std::fill(std::begin(jit.code_map_), std::end(jit.code_map_), 0);
+		jit.blocks_.clear();
+		jit.arena_used_ = 0;
+	}
+
+	mprotect(jit.arena_, EMU_JIT_ARENA_SIZE, PROT_READ | PROT_WRITE);
+	u8* at = jit.arena_ + jit.arena_used_;
+	std::memcpy(at, code.data(), code.size());
+	mprotect(jit.arena_, EMU_JIT_ARENA_SIZE, PROT_READ | PROT_EXEC);
+
+	// keep blocks 16 byte aligned
+	jit.arena_used_ += (code.size() + 15) & ~(size_t)15;
+
+	EJitBlockFn fn = (EJitBlockFn)(void*)at;
+	jit.entry_[begin] = fn;
+	jit.blocks_.push_back({ begin, pc });
+	for (u32 i = begin; i < pc; i++)
+		jit.code_map_[i] = 1;
+
+	return fn;
+}
+
+// drops every block containing addr, the word stays interpreted from now on
+Status
+emu_jit_invalidate(
+	EJitContext& jit,
+	u32 addr)
+{
+	jit.interpret_only_[addr] = 1;
+
+	std::erase_if(jit.blocks_, [&](const EJitBlock& b) {
+		if (addr < b.begin_ || addr >= b.end_)
+			return false;
+		jit.entry_[b.begin_] = nullptr;
+		return true;
+	});
+
+	std::fill(std::begin(jit.code_map_), std::end(jit.code_map_), 0);
+	for (const auto& b : jit.blocks_)
+		for (u32 i = b.begin_; i < b.end_; i++)
+			jit.code_map_[i] = 1;
+
+	return SUCCESS;
+}
+
+#endif // EMU_JIT_AVAILABLE
+
+// one reference step, with the undefined cases turned into FAILURE and stores into compiled code tracked
+Status
+emu_jit_interpret_step(
+	EJitContext& jit,
+	EState& state)
+{
+	EStepEffects effects = emu_step_effects(state);
+	if (effects.fault_)
+		return FAILURE;
+
+	emu_load_next(state);
+	Status status = emu_process(state);
+
+#if EMU_JIT_AVAILABLE
+	if (effects.mem_write_ != EMU_NO_ADDRESS && jit.code_map_[effects.mem_write_])
+		emu_jit_invalidate(jit, effects.mem_write_);
+#endif
+
+	return status;
+}
+
+Status
+emu_execute_jit(
+	EState& state,
+	EJitContext& jit)
+{
+#if EMU_JIT_AVAILABLE
+	constexpr u32 ram_size = EJitContext::ram_size_;
+
+	while (!state.halt_)
+	{
+		u32 pc = state.program_counter_;
+		if (pc >= ram_size)
+			return FAILURE;
+
+		EJitBlockFn fn = jit.entry_[pc];
+		const u32 word = state.ram_[pc].get_value();
+		if (!fn && !jit.interpret_only_[pc] && !(jit.no_block_[pc] && jit.no_block_word_[pc] == word))
+		{
+			fn = emu_jit_compile(jit, state, pc);
+			if (!fn)
+			{
+				jit.no_block_[pc] = 1;
+				jit.no_block_word_[pc] = word;
+			}
+		}
+
+		if (!fn)
+		{
+			if (emu_jit_interpret_step(jit, state) != SUCCESS)
+				return FAILURE;
+			continue;
+		}
+
+		u64 exit = fn(&state, jit.code_map_);
+		switch (exit & 0xFF)
+		{
+		case EJIT_EXIT_NEXT: {
+		} break;
+		case EJIT_EXIT_INTERP: {
+			if (emu_jit_interpret_step(jit, state) != SUCCESS)
+				return FAILURE;
+		} break;
+		case EJIT_EXIT_SMC: {
+			emu_jit_invalidate(jit, (u32)(exit >> 32));
+		} break;
+		default: {
+			ASSERT(false && "Unknown JIT exit!");
+		} break;
+		}
+	}
+
+	return SUCCESS;
+#else
+	while (!state.halt_)
+	{
+		if (emu_jit_interpret_step(jit, state) != SUCCESS)
+			return FAILURE;
+	}
+
+	return SUCCESS;
+#endif
+}
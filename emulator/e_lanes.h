@@ -0,0 +1,608 @@
+#pragma once
+#include "e_base.h"
+#include "e_predecode.h"
+
+/*
+ * LOCKSTEP LANES (structure of arrays):
+ *   - EStateLanes<N> holds N copies of EState with every register, flag, pc and ram word
+ *     stored contiguously across lanes
+ *   - each step picks the lowest program counter among running lanes and executes that
+ *     instruction for every lane sitting on the same pc with the same instruction word
+ *     (lanes that diverged on a branch wait until the others catch up, so they reconverge),
+ *     unless a lane has waited EMU_LANES_MAX_WAIT steps, then its pc goes first, so a lane
+ *     spinning in a low loop can't starve the others
+ *   - every lane retires at most max_steps per call (steps_ counts them), a lane that is
+ *     neither halted nor faulted afterwards ran out of budget and can be resumed
+ *   - add nand and xor shr imul adc sbb cmp run as 16 bit vector kernels under a lane mask,
+ *     AVX-512BW (32 lanes) or AVX2 (16 lanes) picked at run time, scalar loops otherwise
+ *   - memory, branches and idiv are per lane loops
+ *   - a lane stops on halt, or is marked fault_ in the cases emu_execute_predecoded fails on
+ */
+
+#define EMU_LANES_MAX_WAIT 256
+
+#if (defined(__GNUC__) || defined(__clang__)) && defined(__x86_64__)
+#define EMU_LANES_SIMD 1
+#include <immintrin.h>
+#define EMU_TARGET_AVX2 __attribute__((target("avx2")))
+#define EMU_TARGET_AVX512 __attribute__((target("avx512f,avx512bw")))
+#else
+#define EMU_LANES_SIMD 0
+#endif
+
+enum ELanesIsa
+{
+	ELANES_SCALAR,
+	ELANES_AVX2,
+	ELANES_AVX512
+};
+
+template <u32 LANES>
+struct EStateLanes
+{
+	static constexpr u32 lanes_ = LANES;
+	static constexpr u32 ram_size_ = RAM_SIZE / sizeof(EInstruction);
+
+	alignas(64) ERegister r_[REGISTERS_COUNT][LANES] = {};
+	alignas(64) ERegister cf_[LANES] = {}; // flags are widened to 16 bit so adc/sbb can use them directly
+	alignas(64) ERegister sf_[LANES] = {};
+	alignas(64) ERegister zf_[LANES] = {};
+	alignas(64) ERegister program_counter_[LANES] = {};
+	u8 halt_[LANES] = {};
+	u8 fault_[LANES] = {};
+	u64 steps_[LANES] = {};  // retired by the last emu_execute_lanes
+	alignas(64) u32 ram_[ram_size_][LANES] = {};
+};
+
+[[nodiscard]] inline ELanesIsa
+emu_lanes_detect_isa()
+{
+#if EMU_LANES_SIMD
+	static const ELanesIsa isa = __builtin_cpu_supports("avx512bw") ? ELANES_AVX512
+		: __builtin_cpu_supports("avx2") ? ELANES_AVX2
+		: ELANES_SCALAR;
+	return isa;
+#else
+	return ELANES_SCALAR;
+#endif
+}
+
+template <u32 LANES>
+Status
+emu_lanes_load(
+	EStateLanes<LANES>& lanes,
+	u32 lane,
+	const EState& state)
+{
+	ASSERT(lane < LANES);
+	static_assert(ARRAY_SIZE(state.ram_) == EStateLanes<LANES>::ram_size_);
+
+	for (u32 i = 0; i < REGISTERS_COUNT; i++)
+		lanes.r_[i][lane] = state.r_[i];
+	lanes.cf_[lane] = state.f_.СF_;
+	lanes.sf_[lane] = state.f_.SF_;
+	lanes.zf_[lane] = state.f_.ZF_;
+	lanes.program_counter_[lane] = state.program_counter_;
+	lanes.halt_[lane] = state.halt_;
+	lanes.fault_[lane] = false;
+	for (u32 i = 0; i < ARRAY_SIZE(state.ram_); i++)
+		lanes.ram_[i][lane] = state.ram_[i].data;
+
+	return SUCCESS;
+}
+
+template <u32 LANES>
+Status
+emu_lanes_store(
+	const EStateLanes<LANES>& lanes,
+	u32 lane,
+	EState& state)
+{
+	ASSERT(lane < LANES);
+
+	for (u32 i = 0; i < REGISTERS_COUNT; i++)
+		state.r_[i] = lanes.r_[i][lane];
+	state.f_ = { .СF_ = (u8)lanes.cf_[lane], .SF_ = (u8)lanes.sf_[lane], .ZF_ = (u8)lanes.zf_[lane] };
+	state.program_counter_ = lanes.program_counter_[lane];
+	state.halt_ = lanes.halt_[lane];
+	for (u32 i = 0; i < ARRAY_SIZE(state.ram_); i++)
+		state.ram_[i].data = lanes.ram_[i][lane];
+	// a halted lane still has the halt word in its command register
+	u32 last = (ERegister)(state.program_counter_ - 1);
+	if (state.halt_ && last < ARRAY_SIZE(state.ram_))
+		state.command_register_.data = lanes.ram_[last][lane];
+
+	return lanes.fault_[lane] ? FAILURE : SUCCESS;
+}
+
+// scalar reference of the vector kernels, also handles the tails
+[[nodiscard]] inline ERegister
+emu_lanes_op(
+	u32 op,
+	u32 a,
+	u32 b,
+	u32 cf)
+{
+	switch (op)
+	{
+	case E_ADD:  return (ERegister)(a + b);
+	case E_NAND: return (ERegister)~(a & b);
+	case E_AND:  return (ERegister)(a & b);
+	case E_XOR:  return (ERegister)(a ^ b);
+	case E_SHR:  return (ERegister)(a >> (b & 31));
+	case E_IMUL: return (ERegister)(a * b);
+	case E_ADC:  return (ERegister)(a + b + cf);
+	case E_SBB:  return (ERegister)(a - b - cf);
+	default: {
+		ASSERT(false && "Not a lane ALU op!");
+	} break;
+	}
+	return 0;
+}
+
+inline void
+emu_lanes_alu_scalar(
+	u32 op,
+	ERegister* dst,
+	const ERegister* a,
+	const ERegister* b,
+	const ERegister* cf,
+	const ERegister* mask,
+	u32 from,
+	u32 n)
+{
+	for (u32 i = from; i < n; i++)
+	{
+		if (mask[i])
+			dst[i] = emu_lanes_op(op, a[i], b[i], cf[i]);
+	}
+}
+
+inline void
+emu_lanes_cmp_scalar(
+	const ERegister* a,
+	const ERegister* b,
+	ERegister* cf,
+	ERegister* sf,
+	ERegister* zf,
+	const ERegister* mask,
+	u32 from,
+	u32 n)
+{
+	for (u32 i = from; i < n; i++)
+	{
+		if (!mask[i])
+			continue;
+		cf[i] = sf[i] = a[i] < b[i];
+		zf[i] = a[i] == b[i];
+	}
+}
+
+#if EMU_LANES_SIMD
+
+// no 16 bit variable shift in AVX2, go through 32 bit lanes
+EMU_TARGET_AVX2 inline __m256i
+emu_lanes_srlv16_avx2(
+	__m256i a,
+	__m256i count)
+{
+	__m256i lo = _mm256_srlv_epi32(_mm256_cvtepu16_epi32(_mm256_castsi256_si128(a)), _mm256_cvtepu16_epi32(_mm256_castsi256_si128(count)));
+	__m256i hi = _mm256_srlv_epi32(_mm256_cvtepu16_epi32(_mm256_extracti128_si256(a, 1)), _mm256_cvtepu16_epi32(_mm256_extracti128_si256(count, 1)));
+	return _mm256_permute4x64_epi64(_mm256_packus_epi32(lo, hi), 0xD8);
+}
+
+EMU_TARGET_AVX2 inline void
+emu_lanes_alu_avx2(
+	u32 op,
+	ERegister* dst,
+	const ERegister* a,
+	const ERegister* b,
+	const ERegister* cf,
+	const ERegister* mask,
+	u32 n)
+{
+	u32 i = 0;
+
+#define EMU_LANES_LOOP(expr) \
+	for (; i + 16 <= n; i += 16) \
+	{ \
+		__m256i va = _mm256_loadu_si256((const __m256i*)(a + i)); \
+		__m256i vb = _mm256_loadu_si256((const __m256i*)(b + i)); \
+		[[maybe_unused]] __m256i vc = _mm256_loadu_si256((const __m256i*)(cf + i)); \
+		__m256i vm = _mm256_loadu_si256((const __m256i*)(mask + i)); \
+		__m256i vd = _mm256_loadu_si256((const __m256i*)(dst + i)); \
+		_mm256_storeu_si256((__m256i*)(dst + i), _mm256_blendv_epi8(vd, (expr), vm)); \
+	} \
+	break;
+
+	switch (op)
+	{
+	case E_ADD:  EMU_LANES_LOOP(_mm256_add_epi16(va, vb))
+	case E_NAND: EMU_LANES_LOOP(_mm256_xor_si256(_mm256_and_si256(va, vb), _mm256_set1_epi16(-1)))
+	case E_AND:  EMU_LANES_LOOP(_mm256_and_si256(va, vb))
+	case E_XOR:  EMU_LANES_LOOP(_mm256_xor_si256(va, vb))
+	case E_SHR:  EMU_LANES_LOOP(emu_lanes_srlv16_avx2(va, _mm256_and_si256(vb, _mm256_set1_epi16(31))))
+	case E_IMUL: EMU_LANES_LOOP(_mm256_mullo_epi16(va, vb))
+	case E_ADC:  EMU_LANES_LOOP(_mm256_add_epi16(_mm256_add_epi16(va, vb), vc))
+	case E_SBB:  EMU_LANES_LOOP(_mm256_sub_epi16(_mm256_sub_epi16(va, vb), vc))
+	default: {
+		ASSERT(false && "Not a lane ALU op!");
+	} break;
+	}
+
+#undef EMU_LANES_LOOP
+
+	emu_lanes_alu_scalar(op, dst, a, b, cf, mask, i, n);
+}
+
+EMU_TARGET_AVX2 inline void
+emu_lanes_cmp_avx2(
+	const ERegister* a,
+	const ERegister* b,
+	ERegister* cf,
+	ERegister* sf,
+	ERegister* zf,
+	const ERegister* mask,
+	u32 n)
+{
+	const __m256i bias = _mm256_set1_epi16((i16)0x8000);
+	const __m256i one = _mm256_set1_epi16(1);
+
+	u32 i = 0;
+	for (; i + 16 <= n; i += 16)
+	{
+		__m256i va = _mm256_loadu_si256((const __m256i*)(a + i));
+		__m256i vb = _mm256_loadu_si256((const __m256i*)(b + i));
+		__m256i vm = _mm256_loadu_si256((const __m256i*)(mask + i));
+
+		// unsigned a < b through the signed compare
+		__m256i below = _mm256_and_si256(_mm256_cmpgt_epi16(_mm256_xor_si256(vb, bias), _mm256_xor_si256(va, bias)), one);
+		__m256i equal = _mm256_and_si256(_mm256_cmpeq_epi16(va, vb), one);
+
+		__m256i vcf = _mm256_loadu_si256((const __m256i*)(cf + i));
+		__m256i vsf = _mm256_loadu_si256((const __m256i*)(sf + i));
+		__m256i vzf = _mm256_loadu_si256((const __m256i*)(zf + i));
+		_mm256_storeu_si256((__m256i*)(cf + i), _mm256_blendv_epi8(vcf, below, vm));
+		_mm256_storeu_si256((__m256i*)(sf + i), _mm256_blendv_epi8(vsf, below, vm));
+		_mm256_storeu_si256((__m256i*)(zf + i), _mm256_blendv_epi8(vzf, equal, vm));
+	}
+
+	emu_lanes_cmp_scalar(a, b, cf, sf, zf, mask, i, n);
+}
+
+EMU_TARGET_AVX512 inline void
+emu_lanes_alu_avx512(
+	u32 op,
+	ERegister* dst,
+	const ERegister* a,
+	const ERegister* b,
+	const ERegister* cf,
+	const ERegister* mask,
+	u32 n)
+{
+	u32 i = 0;
+
+#define EMU_LANES_LOOP(expr) \
+	for (; i + 32 <= n; i += 32) \
+	{ \
+		__m512i va = _mm512_loadu_si512(a + i); \
+		__m512i vb = _mm512_loadu_si512(b + i); \
+		[[maybe_unused]] __m512i vc = _mm512_loadu_si512(cf + i); \
+		__m512i vm = _mm512_loadu_si512(mask + i); \
+		_mm512_mask_storeu_epi16(dst + i, _mm512_test_epi16_mask(vm, vm), (expr)); \
+	} \
+	break;
+
+	switch (op)
+	{
+	case E_ADD:  EMU_LANES_LOOP(_mm512_add_epi16(va, vb))
+	case E_NAND: EMU_LANES_LOOP(_mm512_xor_si512(_mm512_and_si512(va, vb), _mm512_set1_epi16(-1)))
+	case E_AND:  EMU_LANES_LOOP(_mm512_and_si512(va, vb))
+	case E_XOR:  EMU_LANES_LOOP(_mm512_xor_si512(va, vb))
+	case E_SHR:  EMU_LANES_LOOP(_mm512_srlv_epi16(va, _mm512_and_si512(vb, _mm512_set1_epi16(31))))
+	case E_IMUL: EMU_LANES_LOOP(_mm512_mullo_epi16(va, vb))
+	case E_ADC:  EMU_LANES_LOOP(_mm512_add_epi16(_mm512_add_epi16(va, vb), vc))
+	case E_SBB:  EMU_LANES_LOOP(_mm512_sub_epi16(_mm512_sub_epi16(va, vb), vc))
+	default: {
+		ASSERT(false && "Not a lane ALU op!");
+	} break;
+	}
+
+#undef EMU_LANES_LOOP
+
+	emu_lanes_alu_scalar(op, dst, a, b, cf, mask, i, n);
+}
+
+EMU_TARGET_AVX512 inline void
+emu_lanes_cmp_avx512(
+	const ERegister* a,
+	const ERegister* b,
+	ERegister* cf,
+	ERegister* sf,
+	ERegister* zf,
+	const ERegister* mask,
+	u32 n)
+{
+	const __m512i one = _mm512_set1_epi16(1);
+
+	u32 i = 0;
+	for (; i + 32 <= n; i += 32)
+	{
+		__m512i va = _mm512_loadu_si512(a + i);
+		__m512i vb = _mm512_loadu_si512(b + i);
+		__m512i vm = _mm512_loadu_si512(mask + i);
+		__mmask32 m = _mm512_test_epi16_mask(vm, vm);
+
+		__m512i below = _mm512_maskz_mov_epi16(_mm512_cmplt_epu16_mask(va, vb), one);
+		__m512i equal = _mm512_maskz_mov_epi16(_mm512_cmpeq_epu16_mask(va, vb), one);
+
+		_mm512_mask_storeu_epi16(cf + i, m, below);
+		_mm512_mask_storeu_epi16(sf + i, m, below);
+		_mm512_mask_storeu_epi16(zf + i, m, equal);
+	}
+
+	emu_lanes_cmp_scalar(a, b, cf, sf, zf, mask, i, n);
+}
+
+#endif // EMU_LANES_SIMD
+
+inline void
+emu_lanes_alu(
+	ELanesIsa isa,
+	u32 op,
+	ERegister* dst,
+	const ERegister* a,
+	const ERegister* b,
+	const ERegister* cf,
+	const ERegister* mask,
+	u32 n)
+{
+#if EMU_LANES_SIMD
+	if (isa == ELANES_AVX512)
+		return emu_lanes_alu_avx512(op, dst, a, b, cf, mask, n);
+	if (isa == ELANES_AVX2)
+		return emu_lanes_alu_avx2(op, dst, a, b, cf, mask, n);
+#endif
+	emu_lanes_alu_scalar(op, dst, a, b, cf, mask, 0, n);
+}
+
+inline void
+emu_lanes_cmp(
+	ELanesIsa isa,
+	const ERegister* a,
+	const ERegister* b,
+	ERegister* cf,
+	ERegister* sf,
+	ERegister* zf,
+	const ERegister* mask,
+	u32 n)
+{
+#if EMU_LANES_SIMD
+	if (isa == ELANES_AVX512)
+		return emu_lanes_cmp_avx512(a, b, cf, sf, zf, mask, n);
+	if (isa == ELANES_AVX2)
+		return emu_lanes_cmp_avx2(a, b, cf, sf, zf, mask, n);
+#endif
+	emu_lanes_cmp_scalar(a, b, cf, sf, zf, mask, 0, n);
+}
+
+// runs every lane until it halts, faults or retired max_steps, FAILURE if any lane faulted
+template <u32 LANES>
+Status
+emu_execute_lanes(
+	EStateLanes<LANES>& s,
+	ELanesIsa isa = emu_lanes_detect_isa(),
+	u64 max_steps = UINT64_MAX)
+{
+	constexpr u32 ram_size = EStateLanes<LANES>::ram_size_;
+
+	alignas(64) ERegister mask[LANES];
+	alignas(64) ERegister tmp_a[LANES];
+	alignas(64) ERegister tmp_b[LANES];
+	u32 waited[LANES] = {};
+
+	std::fill(std::begin(s.steps_), std::end(s.steps_), 0);
+	const auto live = [&](u32 l) { return !s.halt_[l] && !s.fault_[l] && s.steps_[l] < max_steps; };
+
+	// register operands are used in place, direct ones are broadcast (or read from ram_ for add)
+	const auto operand = [&](u32 index, bool direct, bool from_ram, ERegister* tmp) -> const ERegister* {
+		if (!direct)
+			return s.r_[index];
+		for (u32 l = 0; l < LANES; l++)
+			tmp[l] = from_ram ? (ERegister)s.ram_[index][l] : (ERegister)index;
+		return tmp;
+	};
+
+#define EMU_FOR_ACTIVE(l) for (u32 l = 0; l < LANES; l++) if (mask[l])
+
+	for (;;)
+	{
+		u32 pc = UINT32_MAX;
+		u32 lead = LANES;
+		u32 starving = LANES;
+		for (u32 l = 0; l < LANES; l++)
+		{
+			if (!live(l))
+				continue;
+			if (s.program_counter_[l] < pc)
+			{
+				pc = s.program_counter_[l];
+				lead = l;
+			}
+			if (waited[l] >= EMU_LANES_MAX_WAIT && (starving == LANES || waited[l] > waited[starving]))
+				starving = l;
+		}
+
+		if (lead == LANES)
+			break;
+
+		if (starving != LANES)
+		{
+			lead = starving;
+			pc = s.program_counter_[lead];
+		}
+
+		if (pc >= ram_size)
+		{
+			for (u32 l = 0; l < LANES; l++)
+			{
+				if (live(l) && s.program_counter_[l] == pc)
+					s.fault_[l] = true;
+			}
+			continue;
+		}
+
+		u32 word = s.ram_[pc][lead];
+		for (u32 l = 0; l < LANES; l++)
+			mask[l] = (live(l) && s.program_counter_[l] == pc && s.ram_[pc][l] == word) ? 0xFFFF : 0;
+		u8 picked[LANES];
+		for (u32 l = 0; l < LANES; l++)
+			picked[l] = mask[l] != 0;
+
+		EInstruction instruction = {};
+		instruction.data = word;
+		EDecodedInstruction d = emu_decode(instruction);
+
+		bool advance = true;
+		switch (d.opcode_)
+		{
+		case E_ADD:
+		case E_NAND:
+		case E_AND:
+		case E_XOR:
+		case E_SHR:
+		case E_IMUL:
+		case E_ADC:
+		case E_SBB: {
+			const ERegister* a = operand(d.ra_, d.ra_direct_, d.opcode_ == E_ADD, tmp_a);
+			const ERegister* b = operand(d.rb_, d.rb_direct_, d.opcode_ == E_ADD, tmp_b);
+			emu_lanes_alu(isa, d.opcode_, s.r_[d.rr_], a, b, s.cf_, mask, LANES);
+		} break;
+		case E_CMP: {
+			const ERegister* a = operand(d.ra_, d.ra_direct_, false, tmp_a);
+			const ERegister* b = operand(d.rb_, d.rb_direct_, false, tmp_b);
+			emu_lanes_cmp(isa, a, b, s.cf_, s.sf_, s.zf_, mask, LANES);
+		} break;
+		case E_IDIV: {
+			const ERegister* a = operand(d.ra_, d.ra_direct_, false, tmp_a);
+			const ERegister* b = operand(d.rb_, d.rb_direct_, false, tmp_b);
+			EMU_FOR_ACTIVE(l)
+			{
+				if (b[l] == 0)
+				{
+					s.fault_[l] = true;
+					mask[l] = 0;
+				}
+				else
+					s.r_[d.rr_][l] = (ERegister)(a[l] / b[l]);
+			}
+		} break;
+		case E_LW: {
+			const ERegister* b = operand(d.rb_, d.rb_direct_, false, tmp_b);
+			EMU_FOR_ACTIVE(l)
+			{
+				u32 addr = b[l] + d.offset_;
+				if (addr >= ram_size)
+				{
+					s.fault_[l] = true;
+					mask[l] = 0;
+				}
+				else
+					s.r_[d.ra_][l] = (ERegister)s.ram_[addr][l];
+			}
+		} break;
+		case E_SW: {
+			const ERegister* b = operand(d.rb_, d.rb_direct_, false, tmp_b);
+			u32 addr = d.ra_ + d.offset_;
+			EMU_FOR_ACTIVE(l)
+			{
+				if (addr >= ram_size)
+				{
+					s.fault_[l] = true;
+					mask[l] = 0;
+				}
+				else
+					s.ram_[addr][l] = b[l];
+			}
+		} break;
+		case E_INC: {
+			EMU_FOR_ACTIVE(l)
+			{
+				if (d.ra_direct_)
+					s.ram_[d.ra_][l] = BITS_MASKED_COPY(BITS_MASKED_COPY(s.ram_[d.ra_][l], BITS_27_MASK) + 1, BITS_27_MASK);
+				else
+					s.r_[d.ra_][l]++;
+			}
+		} break;
+		case E_BEQ:
+		case E_JMA:
+		case E_JMBE: {
+			const ERegister* a = operand(d.ra_, d.ra_direct_, false, tmp_a);
+			const ERegister* b = operand(d.rb_, d.rb_direct_, false, tmp_b);
+			EMU_FOR_ACTIVE(l)
+			{
+				bool taken = d.opcode_ == E_BEQ ? a[l] == b[l]
+					: d.opcode_ == E_JMA ? a[l] > b[l]
+					: a[l] <= b[l];
+				s.program_counter_[l] = (ERegister)(pc + 1 + (taken ? d.offset_ : 0));
+			}
+			advance = false;
+		} break;
+		case E_JALR: {
+			const ERegister* a = operand(d.ra_, d.ra_direct_, false, tmp_a);
+			const ERegister* b = operand(d.rb_, d.rb_direct_, false, tmp_b);
+			EMU_FOR_ACTIVE(l)
+			{
+				if (a[l] >= ram_size)
+				{
+					s.fault_[l] = true;
+					continue;
+				}
+				ERegister target = b[l];
+				s.ram_[a[l]][l] = (ERegister)(pc + 1);
+				s.program_counter_[l] = target;
+			}
+			advance = false;
+		} break;
+		case E_HALT: {
+			EMU_FOR_ACTIVE(l)
+				s.halt_[l] = true;
+		} break;
+		case E_NOOP: {
+		} break;
+		default: {
+			EMU_FOR_ACTIVE(l)
+				s.fault_[l] = true;
+			advance = false;
+		} break;
+		}
+
+		if (advance)
+		{
+			EMU_FOR_ACTIVE(l)
+				s.program_counter_[l]++;
+		}
+
+		// the lanes on the word took the step (unless it faulted), every other running lane waited
+		for (u32 l = 0; l < LANES; l++)
+		{
+			if (picked[l])
+			{
+				waited[l] = 0;
+				s.steps_[l] += !s.fault_[l];
+			}
+			else if (live(l))
+				waited[l]++;
+		}
+	}
+
+#undef EMU_FOR_ACTIVE
+
+	for (u32 l = 0; l < LANES; l++)
+	{
+		if (s.fault_[l])
+			return FAILURE;
+	}
+
+	return SUCCESS;
+}
@@ -0,0 +1,156 @@
+#pragma once
+#include "e_base.h"
+
+#include <string_view>
+
+/*
+ * LEXER:
+ *   - one linear pass over a std::string_view, tokens point back into the source so lexing
+ *     never allocates
+ *   - ';' starts a comment that runs to the end of the line
+ *   - every line break is a token, the assembler works line by line
+ *   - $name is a label, .name a directive, [+-]digits a number, a run of letters, digits and
+ *     '_' is a word (mnemonics, registers, .fill types)
+ *   - lines and columns are 1 based, tabs count as one column
+ */
+
+enum ETokenKind
+{
+	ETOKEN_END,
+	ETOKEN_NEWLINE,
+	ETOKEN_WORD,
+	ETOKEN_LABEL,
+	ETOKEN_DIRECTIVE,
+	ETOKEN_NUMBER,
+	ETOKEN_INVALID
+};
+
+struct EToken
+{
+	ETokenKind kind_;
+	std::string_view text_;
+	u32 line_;
+	u32 column_;
+	i32 value_; // ETOKEN_NUMBER only
+};
+
+struct ELexer
+{
+	std::string_view src_;
+	size_t pos_ = 0;
+	size_t line_start_ = 0;
+	u32 line_ = 1;
+};
+
+[[nodiscard]] constexpr bool
+emu_lex_is_word_char(
+	char c)
+{
+	return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+}
+
+[[nodiscard]] constexpr bool
+emu_lex_is_digit(
+	char c)
+{
+	return c >= '0' && c <= '9';
+}
+
+[[nodiscard]] constexpr EToken
+emu_lex_next(
+	ELexer& lexer)
+{
+	const std::string_view src = lexer.src_;
+	size_t& pos = lexer.pos_;
+
+	// blanks and comments
+	while (pos < src.size())
+	{
+		char c = src[pos];
+		if (c == ' ' || c == '\t' || c == '\r' || c == '\f' || c == '\v')
+			pos++;
+		else if (c == ';')
+		{
+			while (pos < src.size() && src[pos] != '\n')
+				pos++;
+		}
+		else
+			break;
+	}
+
+	EToken token = {};
+	token.line_ = lexer.line_;
+	token.column_ = (u32)(pos - lexer.line_start_ + 1);
+
+	if (pos >= src.size())
+	{
+		token.kind_ = ETOKEN_END;
+		return token;
+	}
+
+	const size_t begin = pos;
+	const char c = src[pos];
+
+	if (c == '\n')
+	{
+		pos++;
+		lexer.line_++;
+		lexer.line_start_ = pos;
+		token.kind_ = ETOKEN_NEWLINE;
+		token.text_ = src.substr(begin, 1);
+		return token;
+	}
+
+	if (c == '$' || c == '.')
+	{
+		pos++;
+		while (pos < src.size() && emu_lex_is_word_char(src[pos]))
+			pos++;
+		token.kind_ = pos - begin > 1 ? (c == '$' ? ETOKEN_LABEL : ETOKEN_DIRECTIVE) : ETOKEN_INVALID;
+		token.text_ = src.substr(begin, pos - begin);
+		return token;
+	}
+
+	if (emu_lex_is_digit(c) || ((c == '-' || c == '+') && pos + 1 < src.size() && emu_lex_is_digit(src[pos + 1])))
+	{
+		bool negative = c == '-';
+		if (c == '-' || c == '+')
+			pos++;
+
+		i64 value = 0;
+		bool overflow = false;
+		while (pos < src.size() && emu_lex_is_digit(src[pos]))
+		{
+			value = value * 10 + (src[pos] - '0');
+			overflow |= value > (i64)INT32_MAX + 1;
+			if (overflow)
+				value = 0;
+			pos++;
+		}
+		value = negative ? -value : value;
+
+		// "12ab" is not a number followed by a word
+		bool glued = pos < src.size() && emu_lex_is_word_char(src[pos]);
+		while (pos < src.size() && emu_lex_is_word_char(src[pos]))
+			pos++;
+
+		token.kind_ = (overflow || glued || value > INT32_MAX) ? ETOKEN_INVALID : ETOKEN_NUMBER;
+		token.text_ = src.substr(begin, pos - begin);
+		token.value_ = (i32)value;
+		return token;
+	}
+
+	if (emu_lex_is_word_char(c))
+	{
+		while (pos < src.size() && emu_lex_is_word_char(src[pos]))
+			pos++;
+		token.kind_ = ETOKEN_WORD;
+		token.text_ = src.substr(begin, pos - begin);
+		return token;
+	}
+
+	pos++;
+	token.kind_ = ETOKEN_INVALID;
+	token.text_ = src.substr(begin, 1);
+	return token;
+}
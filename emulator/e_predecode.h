@@ -0,0 +1,604 @@
+#pragma once
+#include "e_base.h"
+
+/*
+ * PREDECODED INTERPRETER:
+ *   - emu_predecode walks ram_ once and unpacks every word into EDecodedInstruction
+ *     (handler, operand indices, direct flags, sign extended offset)
+ *   - handlers are threaded by the first run, later runs only thread the slots written in
+ *     between (emu_predecode_touch), so a run in slices doesn't pay for the whole ram each time,
+ *     a run with max_steps 0 only threads
+ *   - emu_execute_predecoded runs the decoded program with computed goto threading
+ *     (switch dispatch on compilers without labels as values)
+ *   - every store into ram_ re-decodes the touched word, self-modifying code keeps working
+ *   - retired instructions are added to *steps when it is given, at most max_steps are run
+ *     (state is left ready to resume, see e_exec.h)
+ *   - everything is templated on the EStateT configuration, EDecodedProgram is the default one
+ *   - emu_fuse turns cmp + branch, inc + branch and lw rX / inc rX / sw rX into one dispatch,
+ *     only the first slot changes, so jumping into the middle runs the plain words. A fused
+ *     handler retires every word it covers, falls back to the plain one when the budget or a
+ *     fault would stop inside, and a store into a fused group makes its head plain again
+ *   - semantics are the same as emu_process, except that undefined cases
+ *     (bad opcode, register index, memory address, division by zero) stop with FAILURE
+ */
+
+#if defined(__GNUC__) || defined(__clang__)
+#define EMU_COMPUTED_GOTO 1
+#else
+#define EMU_COMPUTED_GOTO 0
+#endif
+
+enum EDecodedOpcode
+{
+	// 0 .. __ECOMMAND_LAST are ECommand values
+	E_DECODED_INVALID = __ECOMMAND_MAX, // bad opcode or register index, stops with FAILURE
+	E_DECODED_END,                      // program counter is out of ram_, stops with FAILURE
+	E_DECODED_EXIT,                     // not decoded (e_tier.h), stops with SUCCESS before the word
+	E_FUSED_CMP_JUMP,                   // cmp, then beq / jma / jmbe
+	E_FUSED_INC_JUMP,                   // inc rX, then beq / jma / jmbe
+	E_FUSED_LW_INC_SW,                  // lw rX, inc rX, sw rX: a ram word counter
+	__EDECODED_MAX
+};
+
+struct EDecodedInstruction
+{
+	const void* handler_; // threaded by emu_execute_predecoded, stale until then (see emu_predecode_touch)
+	i16 offset_;          // sign extended operand
+	u8 opcode_;           // ECommand or EDecodedOpcode
+	u8 ra_;
+	u8 rb_;
+	u8 rr_;
+	u8 ra_direct_;
+	u8 rb_direct_;
+};
+
+template <u32 RAM_WORDS>
+struct EDecodedProgramT
+{
+	// one slot per ram_ word plus the E_DECODED_END sentinel
+	EDecodedInstruction code_[RAM_WORDS + 1] = {};
+	// slots emu_execute_predecoded still has to thread, a run only threads these
+	u32 unthreaded_begin_ = 0;
+	u32 unthreaded_end_ = RAM_WORDS + 1;
+	// slots the interpreter re-decoded after a store, for callers that put the program back
+	// between runs (e_batch.h), the caller empties it
+	u32 stored_begin_ = 0;
+	u32 stored_end_ = 0;
+};
+
+using EDecodedProgram = EDecodedProgramT<EState::ram_words_>;
+
+// anything that writes code_ outside emu_execute_predecoded marks the slots it wrote
+template <u32 RAM_WORDS>
+inline void
+emu_predecode_touch(
+	EDecodedProgramT<RAM_WORDS>& program,
+	u32 first,
+	u32 count = 1)
+{
+	const u32 end = (u32)std::min<u64>((u64)first + count, RAM_WORDS + 1);
+	if (first >= end)
+		return;
+
+	if (program.unthreaded_begin_ >= program.unthreaded_end_)
+	{
+		program.unthreaded_begin_ = first;
+		program.unthreaded_end_ = end;
+		return;
+	}
+	program.unthreaded_begin_ = std::min(program.unthreaded_begin_, first);
+	program.unthreaded_end_ = std::max(program.unthreaded_end_, end);
+}
+
+[[nodiscard]] inline bool
+emu_decode_registers_valid(
+	u32 opcode,
+	std::pair<u32, bool> ra,
+	std::pair<u32, bool> rb,
+	u32 rr,
+	u32 registers_count)
+{
+	const auto valid = [&](u32 r) { return r < registers_count; };
+
+	bool a_is_reg = !ra.second;
+	bool b_is_reg = !rb.second;
+	bool r_is_reg = false;
+
+	switch (opcode_descriptions[opcode].args_type_)
+	{
+	case EARGS_NONE: {
+		a_is_reg = b_is_reg = false;
+	} break;
+	case EARGS_A: {
+		b_is_reg = false;
+	} break;
+	case EARGS_A_B: {
+	} break;
+	case EARGS_A_B_R: {
+		// jalr has no destination register, regA is the address to save PC+1 to
+		r_is_reg = opcode != E_JALR;
+	} break;
+	case EARGS_A_B_OFFSET: {
+		// lw always writes regA, sw uses regA as an address
+		if (opcode == E_LW)
+			a_is_reg = true;
+		else if (opcode == E_SW)
+			a_is_reg = false;
+	} break;
+	default: {
+		return false;
+	} break;
+	}
+
+	return (!a_is_reg || valid(ra.first)) && (!b_is_reg || valid(rb.first)) && (!r_is_reg || valid(rr));
+}
+
+[[nodiscard]] inline EDecodedInstruction
+emu_decode(
+	EInstruction i,
+	u32 registers_count = REGISTERS_COUNT)
+{
+	EDecodedInstruction d = {};
+
+	u32 opcode = i.get_opcode();
+	auto ra = i.get_reg_a();
+	auto rb = i.get_reg_b();
+	auto rr = i.get_reg_r();
+
+	d.offset_ = (i16)i.get_offset();
+	d.ra_ = (u8)ra.first;
+	d.rb_ = (u8)rb.first;
+	d.rr_ = (u8)rr;
+	d.ra_direct_ = ra.second;
+	d.rb_direct_ = rb.second;
+
+	if (opcode > __ECOMMAND_LAST || !emu_decode_registers_valid(opcode, ra, rb, rr, registers_count))
+		d.opcode_ = E_DECODED_INVALID;
+	else
+		d.opcode_ = (u8)opcode;
+
+	return d;
+}
+
+#define EMU_NO_ADDRESS UINT32_MAX
+#define EMU_NO_REGISTER 0xFF
+
+struct EStepEffects
+{
+	bool fault_;    // emu_process would run into undefined behaviour (bad opcode/register/address, division by zero)
+	u32 mem_write_; // ram_ word written by the instruction, EMU_NO_ADDRESS if none
+	u32 mem_read_;  // ram_ word read by lw, inc $w or a direct add operand (regA first), EMU_NO_ADDRESS if none
+	u32 mem_read_b_; // the direct regB of an add whose regA is direct too, EMU_NO_ADDRESS otherwise
+	u8 dest_reg_;   // register the instruction writes, EMU_NO_REGISTER if none
+};
+
+// what the instruction at program_counter_ is going to do, without executing it
+template <u32 RAM_WORDS, u32 REG_COUNT>
+[[nodiscard]] inline EStepEffects
+emu_step_effects(
+	const EStateT<RAM_WORDS, REG_COUNT>& state)
+{
+	constexpr u32 ram_size = RAM_WORDS;
+
+	EStepEffects e = { .fault_ = false, .mem_write_ = EMU_NO_ADDRESS, .mem_read_ = EMU_NO_ADDRESS, .mem_read_b_ = EMU_NO_ADDRESS, .dest_reg_ = EMU_NO_REGISTER };
+	if (state.program_counter_ >= ram_size)
+	{
+		e.fault_ = true;
+		return e;
+	}
+
+	EDecodedInstruction d = emu_decode(state.ram_[state.program_counter_], REG_COUNT);
+	if (d.opcode_ == E_DECODED_INVALID)
+	{
+		e.fault_ = true;
+		return e;
+	}
+
+	// unused fields may hold any index, only the used ones are checked by emu_decode
+	u32 arg_a = d.ra_direct_ ? d.ra_ : (d.ra_ < REG_COUNT ? state.r_[d.ra_] : 0);
+	u32 arg_b = d.rb_direct_ ? d.rb_ : (d.rb_ < REG_COUNT ? state.r_[d.rb_] : 0);
+
+	switch (d.opcode_)
+	{
+	case E_ADD:
+	case E_NAND:
+	case E_IDIV:
+	case E_IMUL:
+	case E_AND:
+	case E_XOR:
+	case E_SHR:
+	case E_ADC:
+	case E_SBB: {
+		e.dest_reg_ = d.rr_;
+		if (d.opcode_ == E_ADD && (d.ra_direct_ || d.rb_direct_))
+			e.mem_read_ = d.ra_direct_ ? d.ra_ : d.rb_;
+		if (d.opcode_ == E_ADD && d.ra_direct_ && d.rb_direct_)
+			e.mem_read_b_ = d.rb_;
+		if (d.opcode_ == E_IDIV)
+			e.fault_ = arg_b == 0;
+	} break;
+	case E_LW: {
+		e.dest_reg_ = d.ra_;
+		e.mem_read_ = arg_b + d.offset_;
+		e.fault_ = e.mem_read_ >= ram_size;
+	} break;
+	case E_SW: {
+		// checked here, ra + offset can wrap around to EMU_NO_ADDRESS
+		e.mem_write_ = d.ra_ + d.offset_;
+		e.fault_ = e.mem_write_ >= ram_size;
+	} break;
+	case E_JALR: {
+		e.mem_write_ = arg_a;
+		e.fault_ = e.mem_write_ >= ram_size;
+	} break;
+	case E_INC: {
+		if (d.ra_direct_)
+			e.mem_read_ = e.mem_write_ = d.ra_;
+		else
+			e.dest_reg_ = d.ra_;
+	} break;
+	default: {
+	} break;
+	}
+
+	return e;
+}
+
+template <u32 RAM_WORDS, u32 REG_COUNT>
+Status
+emu_predecode(
+	EDecodedProgramT<RAM_WORDS>& program,
+	const EStateT<RAM_WORDS, REG_COUNT>& state)
+{
+	constexpr size_t ram_size = RAM_WORDS;
+
+	for (size_t i = 0; i < ram_size; i++)
+		program.code_[i] = emu_decode(state.ram_[i], REG_COUNT);
+
+	program.code_[ram_size] = {};
+	program.code_[ram_size].opcode_ = E_DECODED_END;
+	emu_predecode_touch(program, 0, ram_size + 1);
+
+	return SUCCESS;
+}
+
+[[nodiscard]] constexpr bool
+emu_is_branch(
+	u32 opcode)
+{
+	return opcode == E_BEQ || opcode == E_JMA || opcode == E_JMBE;
+}
+
+// fuses every site, or with hits (per pc counts, EProfile::pc_hits_) the sites run at least min_hits times
+template <u32 RAM_WORDS>
+Status
+emu_fuse(
+	EDecodedProgramT<RAM_WORDS>& program,
+	const u64* hits = nullptr,
+	u64 min_hits = 1,
+	u32* sites = nullptr)
+{
+	EDecodedInstruction* code = program.code_;
+	u32 fused = 0;
+
+	// heads are cmp / inc / lw, the words after them are branches, inc and sw, so groups never nest
+	for (u32 i = 0; i + 1 < RAM_WORDS; i++)
+	{
+		if (hits && hits[i] < min_hits)
+			continue;
+
+		const EDecodedInstruction& a = code[i];
+		const EDecodedInstruction& b = code[i + 1];
+		u8 kind = a.opcode_;
+
+		if (a.opcode_ == E_CMP && emu_is_branch(b.opcode_))
+			kind = E_FUSED_CMP_JUMP;
+		else if (a.opcode_ == E_INC && !a.ra_direct_ && emu_is_branch(b.opcode_))
+			kind = E_FUSED_INC_JUMP;
+		else if (i + 2 < RAM_WORDS && a.opcode_ == E_LW && b.opcode_ == E_INC && !b.ra_direct_ && b.ra_ == a.ra_)
+		{
+			const EDecodedInstruction& c = code[i + 2];
+			if (c.opcode_ == E_SW && !c.rb_direct_ && c.rb_ == a.ra_)
+				kind = E_FUSED_LW_INC_SW;
+		}
+
+		if (kind != a.opcode_)
+		{
+			code[i].opcode_ = kind;
+			emu_predecode_touch(program, i);
+			fused++;
+		}
+	}
+
+	if (sites)
+		*sites = fused;
+
+	return SUCCESS;
+}
+
+template <u32 RAM_WORDS, u32 REG_COUNT>
+Status
+emu_execute_predecoded(
+	EStateT<RAM_WORDS, REG_COUNT>& state,
+	EDecodedProgramT<RAM_WORDS>& program,
+	u64* steps = nullptr,
+	u64 max_steps = UINT64_MAX)
+{
+	using pc_t = typename EStateT<RAM_WORDS, REG_COUNT>::pc_t;
+	constexpr u32 ram_size = RAM_WORDS;
+
+	EDecodedInstruction* code = program.code_;
+	ERegister* r = state.r_;
+	EInstruction* ram = state.ram_;
+
+	u32 pc = state.program_counter_;
+	const EDecodedInstruction* op = nullptr;
+	Status status = SUCCESS;
+	u64 retired = 0;
+
+#if EMU_COMPUTED_GOTO
+	static const void* const handlers[__EDECODED_MAX] = {
+		/* E_ADD  */ &&op_add,
+		/* E_NAND */ &&op_nand,
+		/* E_LW   */ &&op_lw,
+		/* E_SW   */ &&op_sw,
+		/* E_BEQ  */ &&op_beq,
+		/* E_JALR */ &&op_jalr,
+		/* E_HALT */ &&op_halt,
+		/* E_NOOP */ &&op_noop,
+		/* E_INC  */ &&op_inc,
+		/* E_IDIV */ &&op_idiv,
+		/* E_IMUL */ &&op_imul,
+		/* E_AND  */ &&op_and,
+		/* E_XOR  */ &&op_xor,
+		/* E_SHR  */ &&op_shr,
+		/* E_JMA  */ &&op_jma,
+		/* E_JMBE */ &&op_jmbe,
+		/* E_ADC  */ &&op_adc,
+		/* E_SBB  */ &&op_sbb,
+		/* E_CMP  */ &&op_cmp,
+		/* E_DECODED_INVALID */ &&op_invalid,
+		/* E_DECODED_END     */ &&op_end,
+		/* E_DECODED_EXIT    */ &&op_exit,
+		/* E_FUSED_CMP_JUMP  */ &&op_fused_cmp_jump,
+		/* E_FUSED_INC_JUMP  */ &&op_fused_inc_jump,
+		/* E_FUSED_LW_INC_SW */ &&op_fused_lw_inc_sw
+	};
+
+	// thread what was written since the last run: every slot jumps straight to its handler
+	for (u32 i = program.unthreaded_begin_; i < program.unthreaded_end_; i++)
+		code[i].handler_ = handlers[code[i].opcode_];
+
+	program.unthreaded_begin_ = program.unthreaded_end_ = 0;
+
+#define EMU_DISPATCH() goto *op->handler_
+#define EMU_DECODE_SLOT(addr) do { code[addr] = emu_decode(ram[addr], REG_COUNT); code[addr].handler_ = handlers[code[addr].opcode_]; } while (0)
+#else
+	program.unthreaded_begin_ = program.unthreaded_end_ = 0;
+
+#define EMU_DISPATCH() goto dispatch
+#define EMU_DECODE_SLOT(addr) do { code[addr] = emu_decode(ram[addr], REG_COUNT); } while (0)
+#endif
+
+	// a fused head covering the stored word goes back to its plain instruction
+#define EMU_REDECODE(addr) do { \
+		if (program.stored_begin_ >= program.stored_end_) { program.stored_begin_ = (addr); program.stored_end_ = (addr) + 1; } \
+		program.stored_begin_ = std::min<u32>(program.stored_begin_, (addr) >= 2 ? (addr) - 2 : 0); \
+		program.stored_end_ = std::max<u32>(program.stored_end_, (addr) + 1); \
+		EMU_DECODE_SLOT(addr); \
+		if ((addr) >= 1 && code[(addr) - 1].opcode_ >= E_FUSED_CMP_JUMP) EMU_DECODE_SLOT((addr) - 1); \
+		if ((addr) >= 2 && code[(addr) - 2].opcode_ == E_FUSED_LW_INC_SW) EMU_DECODE_SLOT((addr) - 2); \
+	} while (0)
+
+	// pc wraps like program_counter_, everything past ram_ lands on the sentinel
+#define EMU_NEXT(next_pc) do { retired++; pc = (pc_t)(next_pc); if (retired >= max_steps) goto done; op = &code[pc < ram_size ? pc : ram_size]; EMU_DISPATCH(); } while (0)
+#define EMU_ARG_A (op->ra_direct_ ? (u32)op->ra_ : (u32)r[op->ra_])
+#define EMU_ARG_B (op->rb_direct_ ? (u32)op->rb_ : (u32)r[op->rb_])
+	// msg only names the fault at the call site, the caller gets FAILURE with the pc left on it
+#define EMU_FAULT(msg) do { status = FAILURE; goto done; } while (0)
+#define EMU_CMP() do { \
+		u32 a = EMU_ARG_A, b = EMU_ARG_B; \
+		if (a < b) state.f_ = { .СF_ = true, .SF_ = true, .ZF_ = false }; \
+		else if (a == b) state.f_ = { .СF_ = false, .SF_ = false, .ZF_ = true }; \
+		else state.f_ = { .СF_ = false, .SF_ = false, .ZF_ = false }; \
+	} while (0)
+	// the head is retired, the branch after it finishes the step
+#define EMU_FUSED_BRANCH() do { \
+		retired++; pc++; op++; \
+		u32 a = EMU_ARG_A, b = EMU_ARG_B; \
+		bool taken = op->opcode_ == E_BEQ ? a == b : op->opcode_ == E_JMA ? a > b : a <= b; \
+		EMU_NEXT(taken ? pc + 1 + op->offset_ : pc + 1); \
+	} while (0)
+
+	// the first EMU_NEXT only dispatches, nothing is retired yet
+	retired--;
+	EMU_NEXT(pc);
+
+#if !EMU_COMPUTED_GOTO
+dispatch:
+	switch (op->opcode_)
+	{
+	case E_ADD:  goto op_add;
+	case E_NAND: goto op_nand;
+	case E_LW:   goto op_lw;
+	case E_SW:   goto op_sw;
+	case E_BEQ:  goto op_beq;
+	case E_JALR: goto op_jalr;
+	case E_HALT: goto op_halt;
+	case E_NOOP: goto op_noop;
+	case E_INC:  goto op_inc;
+	case E_IDIV: goto op_idiv;
+	case E_IMUL: goto op_imul;
+	case E_AND:  goto op_and;
+	case E_XOR:  goto op_xor;
+	case E_SHR:  goto op_shr;
+	case E_JMA:  goto op_jma;
+	case E_JMBE: goto op_jmbe;
+	case E_ADC:  goto op_adc;
+	case E_SBB:  goto op_sbb;
+	case E_CMP:  goto op_cmp;
+	case E_DECODED_END: goto op_end;
+	case E_DECODED_EXIT: goto op_exit;
+	case E_FUSED_CMP_JUMP: goto op_fused_cmp_jump;
+	case E_FUSED_INC_JUMP: goto op_fused_inc_jump;
+	case E_FUSED_LW_INC_SW: goto op_fused_lw_inc_sw;
+	default:     goto op_invalid;
+	}
+#endif
+
+op_add: {
+	// in add a direct operand is a memory read, everywhere else it is the value itself
+	u32 a = op->ra_direct_ ? ram[op->ra_].get_value() : r[op->ra_];
+	u32 b = op->rb_direct_ ? ram[op->rb_].get_value() : r[op->rb_];
+	r[op->rr_] = (ERegister)(a + b);
+	EMU_NEXT(pc + 1);
+}
+op_nand: {
+	r[op->rr_] = (ERegister)~(EMU_ARG_A & EMU_ARG_B);
+	EMU_NEXT(pc + 1);
+}
+op_lw: {
+	u32 addr = EMU_ARG_B + op->offset_;
+	if (addr >= ram_size)
+		EMU_FAULT("lw out of ram");
+	r[op->ra_] = (ERegister)ram[addr].get_value();
+	EMU_NEXT(pc + 1);
+}
+op_sw: {
+	u32 addr = op->ra_ + op->offset_;
+	if (addr >= ram_size)
+		EMU_FAULT("sw out of ram");
+	ram[addr].set_value(EMU_ARG_B);
+	EMU_REDECODE(addr);
+	EMU_NEXT(pc + 1);
+}
+op_beq: {
+	EMU_NEXT(EMU_ARG_A == EMU_ARG_B ? pc + 1 + op->offset_ : pc + 1);
+}
+op_jalr: {
+	u32 addr = EMU_ARG_A;
+	if (addr >= ram_size)
+		EMU_FAULT("jalr out of ram");
+	u32 target = EMU_ARG_B;
+	ram[addr].set_value((ERegister)(pc + 1));
+	EMU_REDECODE(addr);
+	EMU_NEXT(target);
+}
+op_halt: {
+	state.halt_ = true;
+	state.command_register_ = ram[pc];
+	retired++;
+	pc++;
+	goto done;
+}
+op_noop: {
+	EMU_NEXT(pc + 1);
+}
+op_inc: {
+	if (op->ra_direct_)
+	{
+		u32 addr = op->ra_;
+		ram[addr]++;
+		EMU_REDECODE(addr);
+	}
+	else
+	{
+		r[op->ra_]++;
+	}
+	EMU_NEXT(pc + 1);
+}
+op_idiv: {
+	u32 b = EMU_ARG_B;
+	if (b == 0)
+		EMU_FAULT("division by zero");
+	r[op->rr_] = (ERegister)(EMU_ARG_A / b);
+	EMU_NEXT(pc + 1);
+}
+op_imul: {
+	r[op->rr_] = (ERegister)(EMU_ARG_A * EMU_ARG_B);
+	EMU_NEXT(pc + 1);
+}
+op_and: {
+	r[op->rr_] = (ERegister)(EMU_ARG_A & EMU_ARG_B);
+	EMU_NEXT(pc + 1);
+}
+op_xor: {
+	r[op->rr_] = (ERegister)(EMU_ARG_A ^ EMU_ARG_B);
+	EMU_NEXT(pc + 1);
+}
+op_shr: {
+	r[op->rr_] = (ERegister)(EMU_ARG_A >> (EMU_ARG_B & 31));
+	EMU_NEXT(pc + 1);
+}
+op_jma: {
+	EMU_NEXT(EMU_ARG_A > EMU_ARG_B ? pc + 1 + op->offset_ : pc + 1);
+}
+op_jmbe: {
+	EMU_NEXT(EMU_ARG_A <= EMU_ARG_B ? pc + 1 + op->offset_ : pc + 1);
+}
+op_adc: {
+	r[op->rr_] = (ERegister)(EMU_ARG_A + EMU_ARG_B + state.f_.СF_);
+	EMU_NEXT(pc + 1);
+}
+op_sbb: {
+	r[op->rr_] = (ERegister)(EMU_ARG_A - EMU_ARG_B - state.f_.СF_);
+	EMU_NEXT(pc + 1);
+}
+op_cmp: {
+	EMU_CMP();
+	EMU_NEXT(pc + 1);
+}
+op_fused_cmp_jump: {
+	if (max_steps - retired < 2)
+		goto op_cmp;
+	EMU_CMP();
+	EMU_FUSED_BRANCH();
+}
+op_fused_inc_jump: {
+	if (max_steps - retired < 2)
+		goto op_inc;
+	r[op->ra_]++;
+	EMU_FUSED_BRANCH();
+}
+op_fused_lw_inc_sw: {
+	u32 load = EMU_ARG_B + op->offset_;
+	u32 store = op[2].ra_ + op[2].offset_;
+	if (max_steps - retired < 3 || load >= ram_size || store >= ram_size)
+		goto op_lw;
+	ERegister value = (ERegister)(ram[load].get_value() + 1);
+	r[op->ra_] = value;
+	ram[store].set_value(value);
+	EMU_REDECODE(store);
+	retired += 2;
+	pc += 2;
+	EMU_NEXT(pc + 1);
+}
+op_invalid: {
+	EMU_FAULT("invalid instruction");
+}
+op_end: {
+	EMU_FAULT("program counter is out of ram");
+}
+op_exit: {
+	goto done;
+}
+
+done:
+	if (pc < ram_size && !state.halt_)
+		state.command_register_ = ram[pc];
+	state.program_counter_ = (pc_t)pc;
+	if (steps)
+		*steps += retired;
+
+#undef EMU_FUSED_BRANCH
+#undef EMU_CMP
+#undef EMU_FAULT
+#undef EMU_ARG_B
+#undef EMU_ARG_A
+#undef EMU_NEXT
+#undef EMU_REDECODE
+#undef EMU_DECODE_SLOT
+#undef EMU_DISPATCH
+
+	return status;
+}
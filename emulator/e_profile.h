@@ -0,0 +1,161 @@
+#pragma once
+#include "e_base.h"
+#include "e_predecode.h"
+
+#include <string>
+#include <vector>
+
+/*
+ * PROFILING (EMU_PROFILE=1, off by default):
+ *   - emu_execute_profiled runs like emu_execute and fills an EProfile before every step, it
+ *     stops with FAILURE before a step that would fault (emu_step_effects) or when one fails
+ *   - retired instructions (one per cycle, the machine has no other timing), per opcode and
+ *     per pc counts, taken / not taken for beq jma jmbe, ram reads (lw, add with a direct
+ *     operand) and writes (sw, jalr, inc $label), fetches are not counted
+ *   - with EMU_PROFILE=0 emu_execute_profiled is emu_execute and the profile stays empty
+ *   - emu_profile_json turns a profile into JSON, pcs that never ran are left out
+ */
+
+#ifndef EMU_PROFILE
+#define EMU_PROFILE 0
+#endif
+
+struct EBranchProfile
+{
+	u64 taken_;
+	u64 not_taken_;
+};
+
+struct EProfile
+{
+	u64 retired_ = 0;
+	u64 opcodes_[__ECOMMAND_MAX] = {};
+	EBranchProfile branches_[__ECOMMAND_MAX] = {}; // only beq jma jmbe are filled
+	u64 mem_reads_ = 0;
+	u64 mem_writes_ = 0;
+	std::vector<u64> pc_hits_; // one per ram_ word, sized by the first run
+};
+
+template <u32 RAM_WORDS, u32 REG_COUNT>
+inline void
+emu_profile_record(
+	EProfile& profile,
+	const EStateT<RAM_WORDS, REG_COUNT>& state)
+{
+	u32 pc = state.program_counter_;
+	EInstruction i = state.command_register_;
+	u32 opcode = i.get_opcode();
+
+	profile.retired_++;
+	if (pc < profile.pc_hits_.size())
+		profile.pc_hits_[pc]++;
+
+	if (opcode > __ECOMMAND_LAST)
+		return;
+	profile.opcodes_[opcode]++;
+
+	auto ra = i.get_reg_a();
+	auto rb = i.get_reg_b();
+	const auto arg = [&](std::pair<u32, bool> x) -> u32 {
+		return x.second ? x.first : (x.first < REG_COUNT ? state.r_[x.first] : 0);
+	};
+
+	switch (opcode)
+	{
+	case E_ADD: {
+		profile.mem_reads_ += ra.second + rb.second;
+	} break;
+	case E_LW: {
+		profile.mem_reads_++;
+	} break;
+	case E_SW:
+	case E_JALR: {
+		profile.mem_writes_++;
+	} break;
+	case E_INC: {
+		profile.mem_writes_ += ra.second;
+	} break;
+	case E_BEQ:
+	case E_JMA:
+	case E_JMBE: {
+		u32 a = arg(ra);
+		u32 b = arg(rb);
+		bool taken = opcode == E_BEQ ? a == b : opcode == E_JMA ? a > b : a <= b;
+		auto& branch = profile.branches_[opcode];
+		(taken ? branch.taken_ : branch.not_taken_)++;
+	} break;
+	default: {
+	} break;
+	}
+}
+
+template <u32 RAM_WORDS, u32 REG_COUNT>
+Status
+emu_execute_profiled(
+	EStateT<RAM_WORDS, REG_COUNT>& state,
+	EProfile& profile)
+{
+#if EMU_PROFILE
+	if (profile.pc_hits_.size() != RAM_WORDS)
+		profile.pc_hits_.assign(RAM_WORDS, 0);
+
+	while (!state.halt_)
+	{
+		// a bad address would touch the host past ram_, a bad opcode would never move the pc
+		if (emu_step_effects(state).fault_)
+			return FAILURE;
+
+		emu_load_next(state);
+		emu_profile_record(profile, state);
+		if (emu_process(state) != SUCCESS)
+			return FAILURE;
+	}
+
+	return SUCCESS;
+#else
+	(void)profile;
+	return emu_execute(state);
+#endif
+}
+
+[[nodiscard]] std::string
+emu_profile_json(
+	const EProfile& profile)
+{
+	std::string json;
+	char buffer[128];
+
+	const auto append = [&](const char* fmt, auto... args) {
+		snprintf(buffer, sizeof(buffer), fmt, args...);
+		json += buffer;
+	};
+
+	append("{\"retired\":%llu,\"mem_reads\":%llu,\"mem_writes\":%llu,\"opcodes\":{",
+		(unsigned long long)profile.retired_, (unsigned long long)profile.mem_reads_, (unsigned long long)profile.mem_writes_);
+	for (u32 op = 0; op < __ECOMMAND_MAX; op++)
+	{
+		append("%s\"%s\":%llu", op ? "," : "", opcode_descriptions[op].asm_name_.data(), (unsigned long long)profile.opcodes_[op]);
+	}
+
+	json += "},\"branches\":{";
+	bool first = true;
+	for (u32 op : { E_BEQ, E_JMA, E_JMBE })
+	{
+		append("%s\"%s\":{\"taken\":%llu,\"not_taken\":%llu}", first ? "" : ",", opcode_descriptions[op].asm_name_.data(),
+			(unsigned long long)profile.branches_[op].taken_, (unsigned long long)profile.branches_[op].not_taken_);
+		first = false;
+	}
+
+	json += "},\"pc_hits\":{";
+	first = true;
+	for (size_t pc = 0; pc < profile.pc_hits_.size(); pc++)
+	{
+		if (!profile.pc_hits_[pc])
+			continue;
+		append("%s\"%zu\":%llu", first ? "" : ",", pc, (unsigned long long)profile.pc_hits_[pc]);
+		first = false;
+	}
+	json += "}}";
+
+	return json;
+}
@@ -0,0 +1,187 @@
+#pragma once
+#include "e_base.h"
+#include "e_predecode.h"
+#include "e_snapshot.h"
+#include "e_exec.h"
+
+#include <vector>
+
+/*
+ * RECORD / REPLAY:
+ *   - EReplay follows an EState from emu_replay_begin on, step_ counts the instructions
+ *     retired since then
+ *   - every interval_ steps an ESnapshot is kept (pages shared with the previous one, so a
+ *     snapshot costs the pages the program wrote plus a few hundred bytes)
+ *   - every step inside the current interval keeps an undo record: what the step is about to
+ *     overwrite (cpu fields, the one register and the one ram word an instruction can write)
+ *   - emu_replay_back undoes one step in O(1), crossing back over an interval restores the
+ *     previous snapshot and re-executes it, so only one interval of undo records is kept
+ *   - emu_replay_seek jumps to any step: back within the interval it undoes, forward it steps
+ *     from where it is unless a snapshot lies in between, otherwise it restores the snapshot
+ *     before the step and re-executes at most interval_ steps (steps past the furthest one
+ *     reached are simply executed)
+ *   - the machine has no input, re-executing from a snapshot always gives the same states
+ */
+
+#define EMU_REPLAY_INTERVAL 4096
+
+struct EReplayUndo
+{
+	EInstruction command_register_;
+	u32 mem_addr_;        // EMU_NO_ADDRESS if the step writes no ram
+	EInstruction mem_old_;
+	ERegister program_counter_;
+	ERegister reg_old_;
+	u8 reg_;              // EMU_NO_REGISTER if the step writes no register
+	EFlags f_;
+	bool halt_;
+	bool no_pc_increment_;
+};
+
+struct EReplay
+{
+	u64 interval_ = EMU_REPLAY_INTERVAL;
+	u64 step_ = 0;
+	std::vector<ESnapshot> snapshots_;  // snapshots_[k] is the state at step k * interval_
+	std::vector<EReplayUndo> undo_;     // steps from the last snapshot up to step_
+};
+
+Status
+emu_replay_begin(
+	EReplay& replay,
+	const EState& state,
+	u64 interval = EMU_REPLAY_INTERVAL)
+{
+	if (interval == 0)
+		return FAILURE;
+
+	replay.interval_ = interval;
+	replay.step_ = 0;
+	replay.snapshots_.clear();
+	replay.undo_.clear();
+	replay.undo_.reserve(interval);
+
+	replay.snapshots_.emplace_back();
+	return emu_snapshot_take(replay.snapshots_.back(), state);
+}
+
+// runs one instruction, FAILURE (and nothing changes) on a halted or faulting state
+Status
+emu_replay_step(
+	EReplay& replay,
+	EState& state)
+{
+	if (state.halt_)
+		return FAILURE;
+
+	EStepEffects effects = emu_step_effects(state);
+	if (effects.fault_)
+		return FAILURE;
+
+	EReplayUndo undo = {};
+	undo.command_register_ = state.command_register_;
+	undo.mem_addr_ = effects.mem_write_;
+	if (undo.mem_addr_ != EMU_NO_ADDRESS)
+		undo.mem_old_ = state.ram_[undo.mem_addr_];
+	undo.program_counter_ = state.program_counter_;
+	undo.reg_ = effects.dest_reg_;
+	if (undo.reg_ != EMU_NO_REGISTER)
+		undo.reg_old_ = state.r_[undo.reg_];
+	undo.f_ = state.f_;
+	undo.halt_ = state.halt_;
+	undo.no_pc_increment_ = state.no_pc_increment_;
+
+	emu_load_next(state);
+	emu_process(state);
+	replay.step_++;
+
+	if (replay.step_ % replay.interval_ == 0)
+	{
+		// a replayed interval already has its snapshot, the state is the same
+		u64 k = replay.step_ / replay.interval_;
+		if (k == replay.snapshots_.size())
+		{
+			replay.snapshots_.emplace_back();
+			emu_snapshot_take(replay.snapshots_.back(), state, &replay.snapshots_[k - 1]);
+		}
+		replay.undo_.clear();
+	}
+	else
+		replay.undo_.push_back(undo);
+
+	return SUCCESS;
+}
+
+EExecStatus
+emu_replay_run(
+	EReplay& replay,
+	EState& state,
+	u64 max_steps)
+{
+	for (u64 i = 0; i < max_steps; i++)
+	{
+		if (state.halt_)
+			return EEXEC_HALTED;
+		if (emu_replay_step(replay, state) != SUCCESS)
+			return EEXEC_FAULT;
+	}
+
+	return state.halt_ ? EEXEC_HALTED : EEXEC_BUDGET;
+}
+
+// FAILURE if the program halts or faults before reaching step
+Status
+emu_replay_seek(
+	EReplay& replay,
+	EState& state,
+	u64 step)
+{
+	ASSERT(!replay.snapshots_.empty() && "emu_replay_begin was never called!");
+
+	// undo_ only reaches back to the last snapshot, anything earlier restores one, forward a
+	// snapshot is only worth restoring if it is past step_
+	const u64 base = replay.step_ - replay.undo_.size();
+	const u64 k = std::min<u64>(step / replay.interval_, replay.snapshots_.size() - 1);
+	if (step < base || (step > replay.step_ && k * replay.interval_ > replay.step_))
+	{
+		emu_snapshot_restore(state, replay.snapshots_[k]);
+		replay.step_ = k * replay.interval_;
+		replay.undo_.clear();
+	}
+
+	while (replay.step_ > step)
+	{
+		const EReplayUndo& undo = replay.undo_.back();
+		state.command_register_ = undo.command_register_;
+		if (undo.mem_addr_ != EMU_NO_ADDRESS)
+			state.ram_[undo.mem_addr_] = undo.mem_old_;
+		state.program_counter_ = undo.program_counter_;
+		if (undo.reg_ != EMU_NO_REGISTER)
+			state.r_[undo.reg_] = undo.reg_old_;
+		state.f_ = undo.f_;
+		state.halt_ = undo.halt_;
+		state.no_pc_increment_ = undo.no_pc_increment_;
+
+		replay.undo_.pop_back();
+		replay.step_--;
+	}
+
+	while (replay.step_ < step)
+	{
+		if (emu_replay_step(replay, state) != SUCCESS)
+			return FAILURE;
+	}
+
+	return SUCCESS;
+}
+
+Status
+emu_replay_back(
+	EReplay& replay,
+	EState& state)
+{
+	if (replay.step_ == 0)
+		return FAILURE;
+
+	return emu_replay_seek(replay, state, replay.step_ - 1);
+}
@@ -0,0 +1,99 @@
+#pragma once
+#include "e_base.h"
+
+#include <memory>
+
+/*
+ * SNAPSHOTS:
+ *   - ESnapshot is the cpu part of an EState plus ram_ split into EMU_PAGE_WORDS pages
+ *   - pages are immutable and shared between snapshots, taking a snapshot against a base
+ *     shares every page whose words did not change (sw / inc $label) and copies the rest
+ *   - restoring writes the snapshot into a plain EState, so every executor runs forks as is
+ *   - pages are refcounted, snapshots can be shared between threads and outlive their base
+ */
+
+#define EMU_PAGE_WORDS 64
+#define EMU_PAGE_COUNT (RAM_SIZE / sizeof(EInstruction) / EMU_PAGE_WORDS)
+
+struct EPage
+{
+	EInstruction words_[EMU_PAGE_WORDS];
+};
+
+struct ESnapshot
+{
+	EInstruction command_register_;
+	ERegister program_counter_;
+	ERegister r_[REGISTERS_COUNT];
+	EFlags f_;
+	bool halt_;
+	bool no_pc_increment_;
+
+	std::shared_ptr<const EPage> pages_[EMU_PAGE_COUNT];
+};
+
+static_assert(EMU_PAGE_COUNT * EMU_PAGE_WORDS == ARRAY_SIZE(EState::ram_));
+
+Status
+emu_snapshot_take(
+	ESnapshot& snapshot,
+	const EState& state,
+	const ESnapshot* base = nullptr)
+{
+	snapshot.command_register_ = state.command_register_;
+	snapshot.program_counter_ = state.program_counter_;
+	std::memcpy(snapshot.r_, state.r_, sizeof(state.r_));
+	snapshot.f_ = state.f_;
+	snapshot.halt_ = state.halt_;
+	snapshot.no_pc_increment_ = state.no_pc_increment_;
+
+	for (u32 p = 0; p < EMU_PAGE_COUNT; p++)
+	{
+		const EInstruction* words = &state.ram_[p * EMU_PAGE_WORDS];
+		const EPage* shared = base ? base->pages_[p].get() : nullptr;
+		if (shared && std::memcmp(shared->words_, words, sizeof(EPage)) == 0)
+		{
+			snapshot.pages_[p] = base->pages_[p];
+			continue;
+		}
+
+		auto page = std::make_shared<EPage>();
+		std::memcpy(page->words_, words, sizeof(EPage));
+		snapshot.pages_[p] = std::move(page);
+	}
+
+	return SUCCESS;
+}
+
+Status
+emu_snapshot_restore(
+	EState& state,
+	const ESnapshot& snapshot)
+{
+	state.command_register_ = snapshot.command_register_;
+	state.program_counter_ = snapshot.program_counter_;
+	std::memcpy(state.r_, snapshot.r_, sizeof(state.r_));
+	state.f_ = snapshot.f_;
+	state.halt_ = snapshot.halt_;
+	state.no_pc_increment_ = snapshot.no_pc_increment_;
+
+	for (u32 p = 0; p < EMU_PAGE_COUNT; p++)
+	{
+		ASSERT(snapshot.pages_[p] && "Snapshot was never taken!");
+		std::memcpy(&state.ram_[p * EMU_PAGE_WORDS], snapshot.pages_[p]->words_, sizeof(EPage));
+	}
+
+	return SUCCESS;
+}
+
+// pages a and b have in common (same memory, not just same words)
+[[nodiscard]] u32
+emu_snapshot_shared_pages(
+	const ESnapshot& a,
+	const ESnapshot& b)
+{
+	u32 shared = 0;
+	for (u32 p = 0; p < EMU_PAGE_COUNT; p++)
+		shared += a.pages_[p] == b.pages_[p];
+	return shared;
+}
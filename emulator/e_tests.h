@@ -4,6 +4,30 @@
 
 #include "e_base.h"
 #include "e_asm.h"
+#include "e_lexer.h"
+#include "e_predecode.h"
+#include "e_jit.h"
+#include "e_batch.h"
+#include "e_lanes.h"
+#include "e_image.h"
+#include "e_snapshot.h"
+#include "e_profile.h"
+#include "e_exec.h"
+#include "e_trace.h"
+#include "e_replay.h"
+#include "e_disasm.h"
+#include "e_fuzz.h"
+#include "e_asm_incremental.h"
+#include "e_asm_parallel.h"
+#include "e_asm_stream.h"
+#include "e_asm_const.h"
+#include "e_cfg.h"
+#include "e_tier.h"
+#include "e_debug.h"
+#include "e_gdb.h"
+
+#include <filesystem>
+#include <sstream>
 
 UTEST(emu, emu_lw_add_halt) {
 	EAsmCompillerData compiller_data = {};
@@ -108,7 +132,21 @@ UTEST(emu, emu_nand) {
 }
 
 UTEST(emu, emu_beq) {
-	ASSERT_TRUE(0);
+	EAsmCompillerData compiller_data = {};
+	emu_asm(compiller_data, R"(
+		inc r0
+		beq r0 r1 1
+		beq r2 r2 -3
+		halt
+	)");
+	EState state = {};
+	state.r_[1] = 5;
+	std::memcpy(state.ram_, compiller_data.compilled_code, RAM_SIZE);
+	emu_execute(state);
+
+	ERegister reg_state[9] = { 5, 5 };
+	ASSERT_TRUE(memcmp(state.r_, reg_state, sizeof(state.r_)) == 0);
+	ASSERT_TRUE(state.halt_ && state.program_counter_ == 4);
 }
 
 UTEST(emu, emu_jalr) {
@@ -210,11 +248,45 @@ UTEST(emu, emu_shr) {
 }
 
 UTEST(emu, emu_jma) {
-	ASSERT_TRUE(0);
+	EAsmCompillerData compiller_data = {};
+	emu_asm(compiller_data, R"(
+		jma r0 r1 1
+		inc r2
+		jma r1 r0 1
+		inc r3
+		halt
+	)");
+	EState state = {};
+	state.r_[0] = 5;
+	state.r_[1] = 2;
+	std::memcpy(state.ram_, compiller_data.compilled_code, RAM_SIZE);
+	emu_execute(state);
+
+	ERegister reg_state[9] = { 5, 2, 0, 1 };
+	ASSERT_TRUE(memcmp(state.r_, reg_state, sizeof(state.r_)) == 0);
+	ASSERT_TRUE(state.halt_ && state.program_counter_ == 5);
 }
 
 UTEST(emu, emu_jmbe) {
-	ASSERT_TRUE(0);
+	EAsmCompillerData compiller_data = {};
+	emu_asm(compiller_data, R"(
+		jmbe r0 r1 1
+		inc r2
+		jmbe r0 r0 1
+		inc r3
+		jmbe r1 r0 1
+		inc r4
+		halt
+	)");
+	EState state = {};
+	state.r_[0] = 5;
+	state.r_[1] = 2;
+	std::memcpy(state.ram_, compiller_data.compilled_code, RAM_SIZE);
+	emu_execute(state);
+
+	ERegister reg_state[9] = { 5, 2, 1, 0, 0 };
+	ASSERT_TRUE(memcmp(state.r_, reg_state, sizeof(state.r_)) == 0);
+	ASSERT_TRUE(state.halt_ && state.program_counter_ == 7);
 }
 
 UTEST(emu, emu_adc) {
@@ -278,9 +350,1537 @@ UTEST(emu, emu_fill_and_labels) {
 	ASSERT_TRUE(compiller_data.compilled_code[1].get_value() == 2);
 	ASSERT_TRUE(compiller_data.compilled_code[2].get_value() == 3);
 
-	ASSERT_TRUE(compiller_data.labels_.size() == 3);
-	ASSERT_TRUE(compiller_data.labels_.find("$first") != compiller_data.labels_.end());
-	ASSERT_TRUE(compiller_data.labels_.find("$second") != compiller_data.labels_.end());
-	ASSERT_TRUE(compiller_data.labels_.find("$third") != compiller_data.labels_.end());
+	ASSERT_TRUE(compiller_data.symbols_.symbols_.size() == 3);
+	ASSERT_TRUE(emu_asm_symbol_find(compiller_data.symbols_, "$first") != nullptr);
+	ASSERT_TRUE(emu_asm_symbol_find(compiller_data.symbols_, "$second") != nullptr);
+	ASSERT_TRUE(emu_asm_symbol_find(compiller_data.symbols_, "$third") != nullptr);
+}
+
+UTEST(emu, lexer_tokens) {
+	ELexer lexer = { "$loop\tbeq r0 r1 -3 ; back\n.fill dec 12x" };
+
+	const struct { ETokenKind kind_; std::string_view text_; u32 line_, column_; } expected[] = {
+		{ ETOKEN_LABEL, "$loop", 1, 1 },
+		{ ETOKEN_WORD, "beq", 1, 7 },
+		{ ETOKEN_WORD, "r0", 1, 11 },
+		{ ETOKEN_WORD, "r1", 1, 14 },
+		{ ETOKEN_NUMBER, "-3", 1, 17 },
+		{ ETOKEN_NEWLINE, "\n", 1, 26 },
+		{ ETOKEN_DIRECTIVE, ".fill", 2, 1 },
+		{ ETOKEN_WORD, "dec", 2, 7 },
+		{ ETOKEN_INVALID, "12x", 2, 11 },
+		{ ETOKEN_END, "", 2, 14 },
+	};
+
+	for (const auto& e : expected)
+	{
+		EToken token = emu_lex_next(lexer);
+		ASSERT_TRUE(token.kind_ == e.kind_);
+		ASSERT_TRUE(token.text_ == e.text_);
+		ASSERT_TRUE(token.line_ == e.line_ && token.column_ == e.column_);
+	}
+
+	ELexer number = { "-2048" };
+	ASSERT_TRUE(emu_lex_next(number).value_ == -2048);
+}
+
+UTEST(emu, asm_label_on_its_own_line) {
+	EAsmCompillerData compiller_data = {};
+	ASSERT_TRUE(emu_asm(compiller_data, R"(
+		; the label names the next word, empty lines and comments don't count
+
+		lw r0 $value 0
+		halt
+		$value
+		.fill dec 7
+	)") == SUCCESS);
+
+	ASSERT_TRUE(emu_asm_symbol_find(compiller_data.symbols_, "$value")->address_ == 2);
+	ASSERT_TRUE(compiller_data.compilled_code[2].get_value() == 7);
+}
+
+UTEST(emu, asm_forward_reference) {
+	EAsmCompillerData compiller_data = {};
+	ASSERT_TRUE(emu_asm(compiller_data, R"(
+		lw r0 $later 0
+		add $later $early r1
+		halt
+		$early .fill dec 2
+		$later .fill dec 5
+	)") == SUCCESS);
+
+	ASSERT_TRUE(compiller_data.diagnostics_.empty());
+	ASSERT_TRUE(compiller_data.compilled_code[0].get_reg_b().first == 4);
+	ASSERT_TRUE(compiller_data.compilled_code[1].get_reg_a().first == 4);
+	ASSERT_TRUE(compiller_data.compilled_code[1].get_reg_b().first == 3);
+}
+
+UTEST(emu, asm_diagnostics) {
+	EAsmCompillerData compiller_data = {};
+	ASSERT_TRUE(emu_asm(compiller_data, R"(
+		lw r0 $misspelled 0
+		frob r0
+		$twice noop
+		$twice noop
+		halt
+	)") == FAILURE);
+
+	// reported in source order for the pass one errors, the unresolved label comes from pass two
+	const auto& d = compiller_data.diagnostics_;
+	ASSERT_TRUE(d.size() == 3);
+	ASSERT_TRUE(d[0].line_ == 3 && d[0].column_ == 3);
+	ASSERT_TRUE(d[0].message_.find("frob") != std::string::npos);
+	ASSERT_TRUE(d[1].line_ == 5 && d[1].column_ == 3);
+	ASSERT_TRUE(d[2].line_ == 2 && d[2].column_ == 9);
+	ASSERT_TRUE(d[2].message_.find("$misspelled") != std::string::npos);
+
+	// the first definition keeps the label, the bad line still takes its word
+	ASSERT_TRUE(emu_asm_symbol_find(compiller_data.symbols_, "$twice")->address_ == 2);
+}
+
+UTEST(emu, predecoded_matches_emu_execute) {
+	EAsmCompillerData compiller_data = {};
+	emu_asm(compiller_data, R"(
+		lw r0 $a 0
+		lw r1 $b 0
+		add r0 r1 r2
+		nand r0 r1 r3
+		imul r0 r1 r4
+		xor r4 r3 r5
+		shr r5 r1 r6
+		cmp r0 r1
+		adc r0 r1 r7
+		inc r0
+		jma r1 r0 -3
+		sw $a r0 0
+		inc $b
+		halt
+		$a .fill dec 1
+		$b .fill dec 7
+	)");
+	EState reference = {};
+	std::memcpy(reference.ram_, compiller_data.compilled_code, RAM_SIZE);
+	EState state = reference;
+
+	emu_execute(reference);
+
+	EDecodedProgram program = {};
+	emu_predecode(program, state);
+	ASSERT_TRUE(emu_execute_predecoded(state, program) == SUCCESS);
+
+	ASSERT_TRUE(memcmp(state.r_, reference.r_, sizeof(state.r_)) == 0);
+	ASSERT_TRUE(memcmp(state.ram_, reference.ram_, sizeof(state.ram_)) == 0);
+	ASSERT_TRUE(memcmp(&state.f_, &reference.f_, sizeof(state.f_)) == 0);
+	ASSERT_TRUE(state.halt_ && state.program_counter_ == reference.program_counter_);
+}
+
+UTEST(emu, predecoded_self_modifying_code) {
+	EAsmCompillerData compiller_data = {};
+	// the sw overwrites the noop with the word 1, which decodes as "add r0 r0 r1"
+	emu_asm(compiller_data, R"(
+		lw r0 $value 0
+		sw $patch r0 0
+		$patch noop
+		halt
+		$value .fill dec 1
+	)");
+	EState state = {};
+	std::memcpy(state.ram_, compiller_data.compilled_code, RAM_SIZE);
+
+	EDecodedProgram program = {};
+	emu_predecode(program, state);
+	ASSERT_TRUE(emu_execute_predecoded(state, program) == SUCCESS);
+
+	ASSERT_TRUE(state.r_[1] == 2);
+	ASSERT_TRUE(state.halt_ && state.program_counter_ == 4);
+}
+
+UTEST(emu, predecoded_fault) {
+	EState state = {};
+	state.ram_[0] = EInstruction::create_ra_rb_rr(E_IDIV, 0, 1, 2);
+
+	EDecodedProgram program = {};
+	emu_predecode(program, state);
+	ASSERT_TRUE(emu_execute_predecoded(state, program) == FAILURE);
+	ASSERT_TRUE(!state.halt_ && state.program_counter_ == 0);
+}
+
+UTEST(emu, jit_matches_emu_execute) {
+	EAsmCompillerData compiller_data = {};
+	emu_asm(compiller_data, R"(
+		beq r0 r0 2
+		$a .fill dec 1
+		$b .fill dec 7
+		lw r0 $a 0
+		lw r1 $b 0
+		add r0 r1 r2
+		nand r0 r1 r3
+		imul r0 r1 r4
+		xor r4 r3 r5
+		shr r5 r1 r6
+		cmp r0 r1
+		adc r0 r1 r7
+		idiv r7 r1 r6
+		inc r0
+		jma r1 r0 -4
+		sw $a r0 0
+		inc $b
+		jmbe r0 r0 1
+		halt
+		jalr $b r8 r0
+		halt
+		halt
+	)");
+	EState reference = {};
+	reference.r_[8] = 21;
+	std::memcpy(reference.ram_, compiller_data.compilled_code, RAM_SIZE);
+	EState state = reference;
+
+	emu_execute(reference);
+
+	EJitContext jit;
+	ASSERT_TRUE(emu_execute_jit(state, jit) == SUCCESS);
+#if EMU_JIT_AVAILABLE
+	ASSERT_TRUE(!jit.blocks_.empty());
+#endif
+
+	ASSERT_TRUE(memcmp(state.r_, reference.r_, sizeof(state.r_)) == 0);
+	ASSERT_TRUE(memcmp(state.ram_, reference.ram_, sizeof(state.ram_)) == 0);
+	ASSERT_TRUE(memcmp(&state.f_, &reference.f_, sizeof(state.f_)) == 0);
+	ASSERT_TRUE(state.halt_ && state.program_counter_ == reference.program_counter_);
+}
+
+UTEST(emu, jit_self_modifying_code) {
+	EAsmCompillerData compiller_data = {};
+	// second pass through the loop runs the patched word "add r0 r0 r1" instead of the noop
+	emu_asm(compiller_data, R"(
+		inc r2
+		$patch noop
+		sw $patch r0 0
+		beq r2 r3 1
+		beq r0 r0 -5
+		halt
+	)");
+	EState state = {};
+	state.r_[0] = 1;
+	state.r_[3] = 2;
+	std::memcpy(state.ram_, compiller_data.compilled_code, RAM_SIZE);
+
+	EJitContext jit;
+	ASSERT_TRUE(emu_execute_jit(state, jit) == SUCCESS);
+
+	ASSERT_TRUE(state.r_[1] == 2);
+	ASSERT_TRUE(state.halt_ && state.program_counter_ == 6);
+#if EMU_JIT_AVAILABLE
+	ASSERT_TRUE(jit.interpret_only_[1]);
+#endif
+}
+
+UTEST(emu, jit_pc_without_block) {
+	// sw into word -1 can't be compiled and faults, the pc is remembered with its word
+	EAsmCompillerData compiller_data = {};
+	ASSERT_TRUE(emu_asm(compiller_data, R"(
+		sw $x r0 -3
+		halt
+	$x	.fill dec 0
+	)") == SUCCESS);
+	EState state = {};
+	std::memcpy(state.ram_, compiller_data.compilled_code, RAM_SIZE);
+
+	EJitContext jit;
+	ASSERT_TRUE(emu_execute_jit(state, jit) == FAILURE);
+#if EMU_JIT_AVAILABLE
+	ASSERT_TRUE(jit.no_block_[0] && !jit.entry_[0]);
+#endif
+
+	// another word at the same pc is compiled again
+	ASSERT_TRUE(emu_asm(compiller_data, "inc r1\nhalt") == SUCCESS);
+	std::memcpy(state.ram_, compiller_data.compilled_code, RAM_SIZE);
+	ASSERT_TRUE(emu_execute_jit(state, jit) == SUCCESS);
+	ASSERT_TRUE(state.r_[1] == 1 && state.halt_);
+#if EMU_JIT_AVAILABLE
+	ASSERT_TRUE(jit.entry_[0]);
+#endif
+}
+
+UTEST(emu, batch_execute) {
+	EAsmCompillerData compiller_data = {};
+	emu_asm(compiller_data, R"(
+		inc r0
+		jma r1 r0 -2
+		lw r2 $v 0
+		halt
+		$v .fill dec 0
+	)");
+
+	std::vector<EBatchSeed> seeds(100);
+	for (u32 i = 0; i < seeds.size(); i++)
+	{
+		seeds[i].r_[1] = (ERegister)(1 + i * i);
+		seeds[i].ram_ = { { 4, i } };
+	}
+
+	std::vector<EBatchResult> results;
+	ASSERT_TRUE(emu_batch_execute(compiller_data, seeds, results, 4) == SUCCESS);
+	ASSERT_TRUE(results.size() == seeds.size());
+
+	for (u32 i = 0; i < seeds.size(); i++)
+	{
+		const auto& r = results[i];
+		u32 n = 1 + i * i;
+		ASSERT_TRUE(r.status_ == SUCCESS);
+		ASSERT_TRUE(r.state_.halt_);
+		ASSERT_TRUE(r.state_.r_[0] == n);
+		ASSERT_TRUE(r.state_.r_[2] == i);
+		ASSERT_TRUE(r.steps_ == 2 * n + 2);
+		ASSERT_TRUE(r.exec_ == EEXEC_HALTED);
+	}
+}
+
+UTEST(emu, batch_budget_and_stores) {
+	// r1 = 1 stores 0 (add r0 r0 r0) over the spin loop and halts, r1 = 0 spins until the budget,
+	// every 4th seed overrides the loop word itself, the words have to be put back for later jobs
+	EAsmCompillerData compiller_data = {};
+	ASSERT_TRUE(emu_asm(compiller_data, R"(
+		beq r1 r0 1
+		sw $spin r2 0
+	$spin	beq r0 r0 -1
+		halt
+	)") == SUCCESS);
+
+	std::vector<EBatchSeed> seeds(64);
+	for (u32 i = 0; i < seeds.size(); i++)
+	{
+		seeds[i].r_[1] = (ERegister)(i % 2);
+		if (i % 4 == 0)
+			seeds[i].ram_ = { { 2, 0 } };
+	}
+
+	std::vector<EBatchResult> results;
+	ASSERT_TRUE(emu_batch_execute(compiller_data, seeds, results, 2, 1000) == SUCCESS);
+	for (u32 i = 0; i < seeds.size(); i++)
+	{
+		const auto& r = results[i];
+		ASSERT_TRUE(r.status_ == SUCCESS);
+		if (i % 4 == 0)
+		{
+			ASSERT_TRUE(r.exec_ == EEXEC_HALTED && r.steps_ == 3);
+		}
+		else if (i % 2 == 1)
+		{
+			ASSERT_TRUE(r.exec_ == EEXEC_HALTED && r.steps_ == 4);
+		}
+		else
+		{
+			ASSERT_TRUE(r.exec_ == EEXEC_BUDGET && r.steps_ == 1000 && r.state_.program_counter_ == 2);
+		}
+	}
+}
+
+UTEST(emu, lanes_match_emu_execute) {
+	EAsmCompillerData compiller_data = {};
+	// lanes leave the loop after r1 rounds, so they diverge and wait for each other at the lw
+	emu_asm(compiller_data, R"(
+		inc r0
+		imul r0 r0 r2
+		shr r2 r0 r3
+		cmp r2 r1
+		sbb r3 r1 r4
+		jma r1 r0 -6
+		lw r5 $v 0
+		add r4 r5 r6
+		halt
+		$v .fill dec 3
+	)");
+	EState image = {};
+	std::memcpy(image.ram_, compiller_data.compilled_code, RAM_SIZE);
+
+	constexpr u32 lanes = 37;
+	for (u32 isa = ELANES_SCALAR; isa <= (u32)emu_lanes_detect_isa(); isa++)
+	{
+		auto state = std::make_unique<EStateLanes<lanes>>();
+		for (u32 l = 0; l < lanes; l++)
+		{
+			EState seed = image;
+			seed.r_[1] = (ERegister)(l * 7 % 23);
+			seed.f_.СF_ = l & 1;
+			emu_lanes_load(*state, l, seed);
+		}
+
+		ASSERT_TRUE(emu_execute_lanes(*state, (ELanesIsa)isa) == SUCCESS);
+
+		for (u32 l = 0; l < lanes; l++)
+		{
+			EState reference = image;
+			reference.r_[1] = (ERegister)(l * 7 % 23);
+			reference.f_.СF_ = l & 1;
+			emu_execute(reference);
+
+			EState lane = {};
+			ASSERT_TRUE(emu_lanes_store(*state, l, lane) == SUCCESS);
+			ASSERT_TRUE(memcmp(lane.r_, reference.r_, sizeof(lane.r_)) == 0);
+			ASSERT_TRUE(memcmp(&lane.f_, &reference.f_, sizeof(lane.f_)) == 0);
+			ASSERT_TRUE(lane.halt_ && lane.program_counter_ == reference.program_counter_);
+		}
+	}
+}
+
+UTEST(emu, lanes_budget_and_no_starvation) {
+	// lane 0 spins on word 0 forever, that is always the lowest pc, lane 1 still has to finish
+	EAsmCompillerData compiller_data = {};
+	ASSERT_TRUE(emu_asm(compiller_data, R"(
+		beq r1 r0 -1
+		inc r2
+		halt
+	)") == SUCCESS);
+	EState image = {};
+	std::memcpy(image.ram_, compiller_data.compilled_code, RAM_SIZE);
+
+	for (u32 isa = ELANES_SCALAR; isa <= (u32)emu_lanes_detect_isa(); isa++)
+	{
+		auto state = std::make_unique<EStateLanes<2>>();
+		EState seed = image;
+		emu_lanes_load(*state, 0, seed);
+		seed.r_[1] = 1;
+		emu_lanes_load(*state, 1, seed);
+
+		ASSERT_TRUE(emu_execute_lanes(*state, (ELanesIsa)isa, 10000) == SUCCESS);
+		ASSERT_TRUE(state->halt_[1] && state->r_[2][1] == 1 && state->steps_[1] == 3);
+		ASSERT_TRUE(!state->halt_[0] && state->steps_[0] == 10000 && state->program_counter_[0] == 0);
+	}
+}
+
+UTEST(emu, image_round_trip) {
+	EAsmCompillerData compiller_data = {};
+	ASSERT_TRUE(emu_asm(compiller_data, R"(
+		lw r0 $a 0
+		inc r0
+		halt
+		$a .fill dec 41
+	)") == SUCCESS);
+	// second segment far away from the first
+	compiller_data.compilled_code[700].set_value(7);
+
+	const auto path = (std::filesystem::temp_directory_path() / "emu_image_round_trip.img").string();
+	ASSERT_TRUE(emu_image_write(path.c_str(), compiller_data) == SUCCESS);
+
+	EImageMap image;
+	ASSERT_TRUE(emu_image_open(image, path.c_str()) == SUCCESS);
+	ASSERT_TRUE(emu_image_header(image)->segment_count_ == 2);
+	ASSERT_TRUE(emu_image_find_symbol(image, "$a")->address_ == 3);
+
+	// one mapping, many states
+	for (u32 i = 0; i < 4; i++)
+	{
+		EState state = {};
+		state.ram_[900].set_value(1);
+		ASSERT_TRUE(emu_image_load(state, image) == SUCCESS);
+		ASSERT_TRUE(memcmp(state.ram_, compiller_data.compilled_code, sizeof(state.ram_)) == 0);
+		emu_execute(state);
+		ASSERT_TRUE(state.r_[0] == 42);
+	}
+
+	// opening again drops the old mapping
+	ASSERT_TRUE(emu_image_open(image, path.c_str()) == SUCCESS);
+	ASSERT_TRUE(emu_image_find_symbol(image, "$a")->address_ == 3);
+
+	std::vector<u8> bytes;
+	emu_image_build(bytes, compiller_data);
+	bytes.back() ^= 1;
+	EImageMap corrupted;
+	ASSERT_TRUE(emu_image_open_memory(corrupted, bytes.data(), bytes.size()) == INVALID_FILE);
+
+	std::filesystem::remove(path);
+}
+
+UTEST(emu, load_raw_image) {
+	EState source = {};
+	source.ram_[0] = EInstruction::create_ra_rb_rr(E_HALT, 0, 0, 0);
+	source.ram_[1023].set_value(5);
+
+	const auto path = (std::filesystem::temp_directory_path() / "emu_raw.img").string();
+	FILE* f = fopen(path.c_str(), "wb");
+	ASSERT_TRUE(f != nullptr);
+	fwrite(source.ram_, sizeof(source.ram_), 1, f);
+	fclose(f);
+
+	EState state = {};
+	ASSERT_TRUE(emu_load_image(state, path.c_str()) == SUCCESS);
+	ASSERT_TRUE(memcmp(state.ram_, source.ram_, sizeof(state.ram_)) == 0);
+
+	std::filesystem::remove(path);
+	ASSERT_TRUE(emu_load_image(state, path.c_str()) == FILE_NOT_FOUND);
+}
+
+UTEST(emu, snapshot_fork) {
+	EAsmCompillerData compiller_data = {};
+	// warm up counts r0 to 5, the forks then store their own r1 into $out
+	ASSERT_TRUE(emu_asm(compiller_data, R"(
+		inc r0
+		jma r2 r0 -2
+		halt
+		sw $out r1 0
+		halt
+		$out .fill dec 0
+	)") == SUCCESS);
+
+	EState state = {};
+	state.r_[2] = 5;
+	std::memcpy(state.ram_, compiller_data.compilled_code, RAM_SIZE);
+	emu_execute(state);
+	state.halt_ = false;
+
+	ESnapshot warm = {};
+	emu_snapshot_take(warm, state);
+
+	ESnapshot forks[8] = {};
+	for (u32 i = 0; i < ARRAY_SIZE(forks); i++)
+	{
+		EState fork = {};
+		emu_snapshot_restore(fork, warm);
+		fork.r_[1] = (ERegister)(100 + i);
+		emu_execute(fork);
+		emu_snapshot_take(forks[i], fork, &warm);
+
+		// only the page with $out was copied
+		ASSERT_TRUE(emu_snapshot_shared_pages(forks[i], warm) == EMU_PAGE_COUNT - 1);
+	}
+
+	for (u32 i = 0; i < ARRAY_SIZE(forks); i++)
+	{
+		EState fork = {};
+		emu_snapshot_restore(fork, forks[i]);
+		ASSERT_TRUE(fork.halt_ && fork.r_[0] == 5);
+		ASSERT_TRUE(fork.ram_[5].get_value() == 100 + i);
+		ASSERT_TRUE(memcmp(&fork.ram_[EMU_PAGE_WORDS], &state.ram_[EMU_PAGE_WORDS], sizeof(state.ram_) - sizeof(EPage)) == 0);
+	}
+}
+
+UTEST(emu, configurable_state) {
+	// L1 sized machine with 16 registers
+	EAsmCompillerDataT<64, 16> small_asm = {};
+	ASSERT_TRUE(emu_asm(small_asm, R"(
+		lw r12 $v 0
+		add r12 r12 r15
+		halt
+		$v .fill dec 21
+	)") == SUCCESS);
+	EStateT<64, 16> small = {};
+	std::memcpy(small.ram_, small_asm.compilled_code, sizeof(small.ram_));
+	emu_execute(small);
+	ASSERT_TRUE(small.halt_ && small.r_[15] == 42 && small.program_counter_ == 3);
+
+	// r9 is not a register of the default machine
+	EAsmCompillerData default_asm = {};
+	ASSERT_TRUE(emu_asm(default_asm, "inc r9") == FAILURE);
+
+	// more words than a 16 bit program counter reaches
+	using EBig = EStateT<0x20000, REGISTERS_COUNT>;
+	static_assert(sizeof(EBig::pc_t) == sizeof(u32));
+	auto big = std::make_unique<EBig>();
+	big->program_counter_ = 0x10010;
+	big->ram_[0x10010] = EInstruction::create_ra_rb_rr(E_INC, 3, 0, 0);
+	big->ram_[0x10011] = EInstruction::create_ra_rb_rr(E_HALT, 0, 0, 0);
+	auto predecoded = std::make_unique<EBig>(*big);
+
+	emu_execute(*big);
+	ASSERT_TRUE(big->r_[3] == 1 && big->program_counter_ == 0x10012);
+
+	auto program = std::make_unique<EDecodedProgramT<0x20000>>();
+	emu_predecode(*program, *predecoded);
+	ASSERT_TRUE(emu_execute_predecoded(*predecoded, *program) == SUCCESS);
+	ASSERT_TRUE(predecoded->r_[3] == 1 && predecoded->program_counter_ == 0x10012);
+}
+
+UTEST(emu, profile_counts) {
+	EAsmCompillerData compiller_data = {};
+	ASSERT_TRUE(emu_asm(compiller_data, R"(
+		inc r0
+		jma r1 r0 -2
+		lw r2 $v 0
+		add $v $v r3
+		sw $v r0 0
+		halt
+		$v .fill dec 1
+	)") == SUCCESS);
+	EState state = {};
+	state.r_[1] = 3;
+	std::memcpy(state.ram_, compiller_data.compilled_code, RAM_SIZE);
+
+	EProfile profile;
+	ASSERT_TRUE(emu_execute_profiled(state, profile) == SUCCESS);
+	ASSERT_TRUE(state.halt_ && state.ram_[6].get_value() == 3);
+
+#if EMU_PROFILE
+	ASSERT_TRUE(profile.retired_ == 10);
+	ASSERT_TRUE(profile.opcodes_[E_INC] == 3 && profile.opcodes_[E_JMA] == 3 && profile.opcodes_[E_HALT] == 1);
+	ASSERT_TRUE(profile.branches_[E_JMA].taken_ == 2 && profile.branches_[E_JMA].not_taken_ == 1);
+	ASSERT_TRUE(profile.mem_reads_ == 3 && profile.mem_writes_ == 1);
+	ASSERT_TRUE(profile.pc_hits_[0] == 3 && profile.pc_hits_[5] == 1 && profile.pc_hits_[6] == 0);
+
+	std::string json = emu_profile_json(profile);
+	ASSERT_TRUE(json.find("\"retired\":10,") != std::string::npos);
+	ASSERT_TRUE(json.find("\"jma\":{\"taken\":2,\"not_taken\":1}") != std::string::npos);
+	ASSERT_TRUE(json.find("\"pc_hits\":{\"0\":3,\"1\":3,\"2\":1,") != std::string::npos);
+#else
+	ASSERT_TRUE(profile.retired_ == 0);
+#endif
+}
+
+UTEST(emu, profile_stops_on_faults) {
+	// a bad opcode at word 0 would leave the pc there forever
+	auto state = std::make_unique<EState>();
+	state->ram_[0].set_value(31u << 22);
+	EProfile profile;
+	ASSERT_TRUE(emu_execute_profiled(*state, profile) == FAILURE);
+	ASSERT_TRUE(state->program_counter_ == 0);
+
+#if EMU_PROFILE
+	// an lw past ram_ stops before it runs, the inc before it is counted
+	*state = {};
+	state->r_[1] = (ERegister)EState::ram_words_;
+	state->ram_[0] = EInstruction::create_ra_rb_rr(E_INC, 2, 0, 0);
+	state->ram_[1] = EInstruction::create_ra_rb_offset(E_LW, 0, 1, 0);
+	profile = {};
+	ASSERT_TRUE(emu_execute_profiled(*state, profile) == FAILURE);
+	ASSERT_TRUE(state->program_counter_ == 1 && state->r_[2] == 1 && profile.retired_ == 1);
+#endif
+}
+
+UTEST(emu, execute_for_budget_and_resume) {
+	EAsmCompillerData compiller_data = {};
+	ASSERT_TRUE(emu_asm(compiller_data, R"(
+		inc r0
+		jma r1 r0 -2
+		halt
+	)") == SUCCESS);
+	EState image = {};
+	image.r_[1] = 100;
+	std::memcpy(image.ram_, compiller_data.compilled_code, RAM_SIZE);
+
+	EState reference = image;
+	emu_execute(reference);
+
+	// 201 steps to the halt, run in slices of 7
+	EState state = image;
+	EDecodedProgram program = {};
+	emu_predecode(program, image);
+	EState predecoded = image;
+
+	u64 steps = 0;
+	u64 predecoded_steps = 0;
+	u32 slices = 0;
+	EExecStatus status = EEXEC_BUDGET;
+	EExecStatus predecoded_status = EEXEC_BUDGET;
+	while (status == EEXEC_BUDGET || predecoded_status == EEXEC_BUDGET)
+	{
+		status = emu_execute_for(state, 7, &steps);
+		predecoded_status = emu_execute_predecoded_for(predecoded, program, 7, &predecoded_steps);
+		ASSERT_TRUE(status == predecoded_status);
+		ASSERT_TRUE(state.program_counter_ == predecoded.program_counter_);
+		slices++;
+	}
+
+	ASSERT_TRUE(status == EEXEC_HALTED);
+	ASSERT_TRUE(steps == 201 && predecoded_steps == 201 && slices == 29);
+	ASSERT_TRUE(memcmp(state.r_, reference.r_, sizeof(state.r_)) == 0);
+	ASSERT_TRUE(memcmp(predecoded.r_, reference.r_, sizeof(state.r_)) == 0);
+	ASSERT_TRUE(state.program_counter_ == reference.program_counter_);
+
+	ASSERT_TRUE(emu_execute_for(state, 7, &steps) == EEXEC_HALTED && steps == 201);
+}
+
+UTEST(emu, execute_until_deadline_and_fault) {
+	EAsmCompillerData compiller_data = {};
+	ASSERT_TRUE(emu_asm(compiller_data, R"(
+		beq r0 r0 -1
+	)") == SUCCESS);
+	EState state = {};
+	std::memcpy(state.ram_, compiller_data.compilled_code, RAM_SIZE);
+
+	u64 steps = 0;
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(5);
+	ASSERT_TRUE(emu_execute_until(state, deadline, &steps) == EEXEC_BUDGET);
+	ASSERT_TRUE(std::chrono::steady_clock::now() >= deadline);
+	ASSERT_TRUE(steps > 0 && steps % EMU_DEADLINE_SLICE == 0 && state.program_counter_ == 0);
+
+	// jumping off the end of ram_ faults and stays faulted
+	EState runaway = {};
+	runaway.program_counter_ = ARRAY_SIZE(runaway.ram_) - 1;
+	ASSERT_TRUE(emu_execute_for(runaway, 10) == EEXEC_FAULT);
+	ASSERT_TRUE(runaway.program_counter_ == ARRAY_SIZE(runaway.ram_));
+	ASSERT_TRUE(emu_execute_for(runaway, 10) == EEXEC_FAULT);
+
+	EDecodedProgram program = {};
+	EState predecoded = {};
+	std::memcpy(predecoded.ram_, compiller_data.compilled_code, RAM_SIZE);
+	emu_predecode(program, predecoded);
+	auto soon = std::chrono::steady_clock::now() + std::chrono::milliseconds(1);
+	ASSERT_TRUE(emu_execute_predecoded_until(predecoded, program, soon) == EEXEC_BUDGET);
+}
+
+UTEST(emu, trace_round_trip) {
+	EAsmCompillerData compiller_data = {};
+	ASSERT_TRUE(emu_asm(compiller_data, R"(
+		inc r0
+		lw r3 r0 5
+		beq r0 r1 1
+		beq r2 r2 -4
+		halt
+	)") == SUCCESS);
+	EState state = {};
+	std::memcpy(state.ram_, compiller_data.compilled_code, RAM_SIZE);
+	state.r_[1] = 100;
+
+	auto path = (std::filesystem::temp_directory_path() / "emu_trace_round_trip.bin").string();
+	auto writer = std::make_unique<ETraceWriter>();
+	ASSERT_TRUE(emu_trace_open(*writer, path.c_str()) == SUCCESS);
+	ASSERT_TRUE(emu_execute_traced(state, *writer) == SUCCESS);
+	ASSERT_TRUE(emu_trace_close(*writer) == SUCCESS);
+	ASSERT_TRUE(writer->records_ == 100 * 4);
+
+	auto reader = std::make_unique<ETraceReader>();
+	ASSERT_TRUE(emu_trace_read_open(*reader, path.c_str()) == SUCCESS);
+	// header plus ~2 bytes for every step of the loop
+	ASSERT_TRUE(reader->data_.size() < 8 + 3 * writer->records_);
+
+	ETraceRecord record = {};
+	u64 count = 0;
+	while (emu_trace_next(*reader, record))
+	{
+		if (count == 0)
+		{
+			ASSERT_TRUE(record.pc_ == 0 && record.dest_reg_ == 0 && record.dest_value_ == 1);
+			ASSERT_TRUE(emu_trace_format(record) == "0000: inc r0  r0=1");
+		}
+		if (count == 1)
+			ASSERT_TRUE(record.pc_ == 1 && record.dest_reg_ == 3 && record.mem_addr_ == 6);
+		if (count == 3)
+			ASSERT_TRUE(record.pc_ == 3 && record.dest_reg_ == EMU_NO_REGISTER && record.mem_addr_ == EMU_NO_ADDRESS);
+		count++;
+	}
+	ASSERT_TRUE(count == writer->records_);
+	ASSERT_TRUE(record.pc_ == 4 && emu_trace_format(record) == "0004: halt");
+	std::filesystem::remove(path);
+}
+
+UTEST(emu, replay_seek_and_back) {
+	EAsmCompillerData compiller_data = {};
+	ASSERT_TRUE(emu_asm(compiller_data, R"(
+		inc r0
+		sw r2 r0 20
+		cmp r0 r1
+		beq r0 r1 1
+		beq r2 r2 -5
+		halt
+	)") == SUCCESS);
+	EState reset = {};
+	std::memcpy(reset.ram_, compiller_data.compilled_code, RAM_SIZE);
+	reset.r_[1] = 50;
+
+	const auto same_as_fresh_run = [&](const EState& state, u64 steps) {
+		EState fresh = reset;
+		emu_execute_for(fresh, steps);
+		return state.program_counter_ == fresh.program_counter_ && state.halt_ == fresh.halt_
+			&& std::memcmp(state.r_, fresh.r_, sizeof(fresh.r_)) == 0
+			&& std::memcmp(&state.f_, &fresh.f_, sizeof(fresh.f_)) == 0
+			&& std::memcmp(state.ram_, fresh.ram_, sizeof(fresh.ram_)) == 0;
+	};
+
+	EState state = reset;
+	EReplay replay;
+	ASSERT_TRUE(emu_replay_begin(replay, state, 16) == SUCCESS);
+	ASSERT_TRUE(emu_replay_run(replay, state, 1000) == EEXEC_HALTED);
+	ASSERT_TRUE(replay.step_ == 5 * 49 + 4 + 1 && replay.snapshots_.size() == 16);
+	ASSERT_TRUE(emu_replay_step(replay, state) == FAILURE);
+
+	for (u64 step : { 37u, 36u, 200u, 0u, 250u, 33u, 32u, 31u, 17u })
+	{
+		ASSERT_TRUE(emu_replay_seek(replay, state, step) == SUCCESS);
+		ASSERT_TRUE(replay.step_ == step && same_as_fresh_run(state, step));
+	}
+
+	// forward inside the interval just steps, r8 (which the program never touches) shows that
+	// nothing was restored, past the next snapshot restoring it is cheaper
+	ASSERT_TRUE(emu_replay_seek(replay, state, 20) == SUCCESS);
+	state.r_[8] = 99;
+	ASSERT_TRUE(emu_replay_seek(replay, state, 21) == SUCCESS);
+	ASSERT_TRUE(replay.step_ == 21 && state.r_[8] == 99);
+	ASSERT_TRUE(emu_replay_seek(replay, state, 35) == SUCCESS);
+	ASSERT_TRUE(replay.step_ == 35 && state.r_[8] == 0 && same_as_fresh_run(state, 35));
+
+	// one step back at a time, across snapshots
+	ASSERT_TRUE(emu_replay_seek(replay, state, 40) == SUCCESS);
+	for (u64 step = 40; step > 0; step--)
+	{
+		ASSERT_TRUE(emu_replay_back(replay, state) == SUCCESS);
+		ASSERT_TRUE(same_as_fresh_run(state, step - 1));
+	}
+	ASSERT_TRUE(emu_replay_back(replay, state) == FAILURE);
+
+	// past the halt there is nothing to reach
+	ASSERT_TRUE(emu_replay_seek(replay, state, 251) == FAILURE);
+}
+
+UTEST(emu, disasm_words_and_image) {
+	char line[EMU_DISASM_LINE];
+	ASSERT_TRUE(emu_disasm_word(EInstruction::create_ra_rb_rr(E_ADD, 1, 2, 3), line) == 12);
+	ASSERT_TRUE(std::string_view(line) == "add r1 r2 r3");
+	emu_disasm_word(EInstruction::create_ra_rb_offset(E_BEQ, 0, 5, (u32)-3 & BITS_12_MASK, 0, 1), line);
+	ASSERT_TRUE(std::string_view(line) == "beq r0 $w5 -3");
+	emu_disasm_word(EInstruction::create_ra_rb_rr(E_HALT, 0, 0, 0), line);
+	ASSERT_TRUE(std::string_view(line) == "halt");
+	// halt with operand bits and r12 on a 9 register machine are data, not code
+	emu_disasm_word(EInstruction::create_ra_rb_rr(E_HALT, 1, 0, 0), line);
+	ASSERT_TRUE(std::string_view(line) == ".fill dec 25296896");
+	emu_disasm_word(EInstruction::create_ra_rb_rr(E_INC, 12, 0, 0), line);
+	ASSERT_TRUE(std::string_view(line) == ".fill dec 35127296");
+	ASSERT_TRUE(emu_disasm_is_instruction(EInstruction::create_ra_rb_rr(E_INC, 12, 0, 0), 16));
+
+	EAsmCompillerData source = {};
+	ASSERT_TRUE(emu_asm(source, R"(
+		lw r0 $value 0
+		inc r0
+		sw $value r0 0
+		cmp r0 r1
+		jmbe r0 r1 -5
+		halt
+		$value .fill dec 3
+	)") == SUCCESS);
+
+	// data words that happen to be valid instructions come back as those
+	std::string text = emu_disasm_image(source.compilled_code, 7);
+	ASSERT_TRUE(text == "\tlw r0 $w6 0\n\tinc r0\n\tsw $w6 r0 0\n\tcmp r0 r1\n\tjmbe r0 r1 -5\n\thalt\n$w6\tadd r0 r0 r3\n");
+
+	auto path = (std::filesystem::temp_directory_path() / "emu_disasm.bin").string();
+	FILE* f = fopen(path.c_str(), "wb");
+	ASSERT_TRUE(f != nullptr);
+	fwrite(source.compilled_code, sizeof(EInstruction), 7, f);
+	fclose(f);
+
+	std::string from_file;
+	ASSERT_TRUE(emu_disasm_file(path.c_str(), from_file) == SUCCESS);
+	ASSERT_TRUE(from_file == text);
+	std::filesystem::remove(path);
+
+	EAsmCompillerData again = {};
+	ASSERT_TRUE(emu_asm(again, text) == SUCCESS);
+	ASSERT_TRUE(std::memcmp(again.compilled_code, source.compilled_code, sizeof(again.compilled_code)) == 0);
+
+	// a label past the end of a short image pads it
+	EInstruction one = EInstruction::create_ra_rb_rr(E_INC, 3, 0, 0, 1);
+	ASSERT_TRUE(emu_disasm_image(&one, 1) == "\tinc $w3\n\tadd r0 r0 r0\n\tadd r0 r0 r0\n$w3\tadd r0 r0 r0\n");
+}
+
+UTEST(emu, disasm_round_trip_parallel) {
+	EDisasmRoundTrip single, parallel;
+	ASSERT_TRUE(emu_disasm_round_trip(20'000, 7, single, 1) == SUCCESS);
+	ASSERT_TRUE(emu_disasm_round_trip(200'000, 7, parallel, 4) == SUCCESS);
+	ASSERT_TRUE(parallel.words_ == 200'000 && parallel.mismatches_ == 0 && parallel.first_bad_ == UINT32_MAX);
+}
+
+UTEST(emu, fuzz_engines_match_reference) {
+	// sw r4 r0 -5 with r4 = 4 writes word -1, which has to fault
+	u8 wrap[2 * REGISTERS_COUNT + 4] = {};
+	wrap[8] = 4;
+	u32 sw = E_SW | 4 << 6 | 3 << 19;
+	std::memcpy(wrap + 2 * REGISTERS_COUNT, &sw, sizeof(sw));
+	EState state = emu_fuzz_state(wrap, sizeof(wrap));
+	ASSERT_TRUE(state.ram_[0].get_offset() == -5 && emu_step_effects(state).fault_);
+
+	EFuzzReport report;
+	ASSERT_TRUE(emu_fuzz_one(wrap, sizeof(wrap), report) == SUCCESS);
+
+	u64 x = 0x9E3779B97F4A7C15ull;
+	std::vector<u8> input;
+	for (u32 run = 0; run < 300; run++)
+	{
+		input.resize(emu_disasm_splitmix(x) % 512);
+		for (auto& byte : input)
+			byte = (u8)emu_disasm_splitmix(x);
+		ASSERT_TRUE(emu_fuzz_one(input.data(), input.size(), report) == SUCCESS);
+	}
+}
+
+UTEST(emu, fused_predecoded_matches_plain) {
+	EAsmCompillerData compiller_data = {};
+	// a ram counter, a cmp + jmbe inner loop, an inc + beq outer loop
+	ASSERT_TRUE(emu_asm(compiller_data, R"(
+		lw r0 $count 0
+		inc r0
+		sw $count r0 0
+		inc r2
+		cmp r2 r1
+		jmbe r2 r1 -3
+		inc r3
+		beq r3 r4 1
+		beq r0 r0 -9
+		halt
+		$count .fill dec 0
+	)") == SUCCESS);
+	EState image = {};
+	std::memcpy(image.ram_, compiller_data.compilled_code, RAM_SIZE);
+	image.r_[1] = 20;
+	image.r_[4] = 30;
+
+	EState reference = image;
+	u64 reference_steps = 0;
+	ASSERT_TRUE(emu_execute_for(reference, UINT64_MAX, &reference_steps) == EEXEC_HALTED);
+
+	EDecodedProgram program = {};
+	EState fused = image;
+	u32 sites = 0;
+	emu_predecode(program, fused);
+	emu_fuse(program, nullptr, 1, &sites);
+	ASSERT_TRUE(sites == 3);
+
+	u64 steps = 0;
+	ASSERT_TRUE(emu_execute_predecoded(fused, program, &steps) == SUCCESS);
+	ASSERT_TRUE(steps == reference_steps && fused.program_counter_ == reference.program_counter_);
+	ASSERT_TRUE(std::memcmp(fused.r_, reference.r_, sizeof(fused.r_)) == 0);
+	ASSERT_TRUE(std::memcmp(&fused.f_, &reference.f_, sizeof(fused.f_)) == 0);
+	ASSERT_TRUE(fused.ram_[10].get_value() == 30);
+
+	// one step at a time the fused handlers give way to the plain ones
+	EState stepped = image;
+	emu_predecode(program, stepped);
+	emu_fuse(program);
+	EState plain = image;
+	for (u64 i = 0; i < reference_steps; i++)
+	{
+		ASSERT_TRUE(emu_execute_predecoded_for(stepped, program, 1) != EEXEC_FAULT);
+		emu_execute_for(plain, 1);
+		ASSERT_TRUE(stepped.program_counter_ == plain.program_counter_);
+		ASSERT_TRUE(std::memcmp(stepped.r_, plain.r_, sizeof(plain.r_)) == 0);
+	}
+
+	// only the sites that ran often enough
+	std::vector<u64> hits(ARRAY_SIZE(image.ram_), 0);
+	hits[3] = 600;
+	hits[4] = 600;
+	emu_predecode(program, image);
+	emu_fuse(program, hits.data(), 100, &sites);
+	ASSERT_TRUE(sites == 1 && program.code_[4].opcode_ == E_FUSED_CMP_JUMP);
+}
+
+UTEST(emu, fused_group_rewritten_by_store) {
+	EAsmCompillerData compiller_data = {};
+	// after one round the sw turns the beq of the fused inc + beq into add r0 r0 r0
+	ASSERT_TRUE(emu_asm(compiller_data, R"(
+		inc r0
+		$branch beq r0 r1 1
+		halt
+		sw $branch r5 0
+		beq r5 r5 -5
+	)") == SUCCESS);
+	EState image = {};
+	std::memcpy(image.ram_, compiller_data.compilled_code, RAM_SIZE);
+	image.r_[1] = 1;
+
+	EState reference = image;
+	emu_execute(reference);
+	ASSERT_TRUE(reference.r_[0] == 4);
+
+	EDecodedProgram program = {};
+	EState fused = image;
+	emu_predecode(program, fused);
+	emu_fuse(program);
+	ASSERT_TRUE(program.code_[0].opcode_ == E_FUSED_INC_JUMP);
+	ASSERT_TRUE(emu_execute_predecoded(fused, program) == SUCCESS);
+	ASSERT_TRUE(program.code_[0].opcode_ == E_INC);
+	ASSERT_TRUE(fused.program_counter_ == reference.program_counter_ && fused.r_[0] == reference.r_[0]);
+}
+
+UTEST(emu, asm_incremental_matches_full) {
+	// random line edits, after each one the words match emu_asm on the whole text
+	static const char* const bodies[] = { "inc r1", "add r0 r1 r2", "lw $l%u r1 0", "add $l%u r3 r4", "halt", "" };
+	u64 rng = 7;
+	std::vector<std::string> lines;
+	EAsmIncremental inc;
+	auto full = std::make_unique<EAsmCompillerData>();
+
+	const auto random_line = [&]() {
+		char text[48];
+		u64 r = emu_disasm_splitmix(rng);
+		const char* body = bodies[r % ARRAY_SIZE(bodies)];
+		snprintf(text, sizeof(text), body, (u32)(r >> 8) % 3);
+		std::string line = text;
+
+		// labels may be defined twice, the first definition counts in both assemblers
+		std::string label = "$l" + std::to_string((r >> 16) % 3);
+		return (r >> 24) % 2 == 0 ? (line.empty() ? label : label + " " + line) : "\t" + line;
+	};
+
+	for (u32 edit = 0; edit < 400; edit++)
+	{
+		u32 first = (u32)(emu_disasm_splitmix(rng) % (lines.size() + 1));
+		u32 removed = (u32)(emu_disasm_splitmix(rng) % std::min<size_t>(3, lines.size() - first + 1));
+		if (lines.size() > 24 && first < lines.size())
+			removed = std::max(removed, 1u);
+		u32 added = (u32)(emu_disasm_splitmix(rng) % 3);
+
+		lines.erase(lines.begin() + first, lines.begin() + first + removed);
+		std::string text;
+		for (u32 i = 0; i < added; i++)
+		{
+			std::string line = random_line();
+			lines.insert(lines.begin() + first + i, line);
+			text += (i ? "\n" : "") + line;
+		}
+		Status status = emu_asm_edit(inc, first, removed, text);
+
+		std::string source;
+		for (const auto& l : lines)
+			source += l + "\n";
+		*full = {};
+		Status expected = emu_asm(*full, source);
+
+		ASSERT_TRUE(inc.order_.size() == lines.size());
+		ASSERT_TRUE(status == expected);
+		ASSERT_TRUE(emu_asm_incremental_diagnostics(inc).size() == full->diagnostics_.size());
+		if (expected != SUCCESS)
+			continue;
+		for (u32 i = 0; i < inc.code_.size(); i++)
+			ASSERT_TRUE(inc.code_[i].get_value() == full->compilled_code[i].get_value());
+	}
+}
+
+UTEST(emu, asm_incremental_edit_is_local) {
+	// an edit in the middle of a long program encodes its own lines and the users of moved labels
+	auto inc = std::make_unique<EAsmIncrementalT<1 << 16, REGISTERS_COUNT>>();
+	std::string source = "$top\tinc r0\n\tbeq r0 r1 1\n\tlw $top r2 0\n";
+	for (u32 i = 0; i < 20000; i++)
+		source += "\tadd r0 r1 r2\n";
+	source += "$end\thalt\n\tlw $top r1 0";
+	ASSERT_TRUE(emu_asm_edit(*inc, 0, 0, source) == SUCCESS);
+	ASSERT_TRUE(inc->code_.size() == 20005);
+
+	ASSERT_TRUE(emu_asm_edit(*inc, 10000, 1, "\tinc r3\n\tinc r4") == SUCCESS);
+	ASSERT_TRUE(inc->encoded_ == 2);
+	ASSERT_TRUE(inc->code_.size() == 20006);
+	ASSERT_TRUE(inc->code_[10000].get_opcode() == E_INC && inc->code_[10001].get_opcode() == E_INC);
+	ASSERT_TRUE(inc->code_[20004].get_opcode() == E_HALT);
+
+	// moving $top re-patches its users without encoding them again
+	ASSERT_TRUE(emu_asm_edit(*inc, 0, 0, "\tinc r5") == SUCCESS);
+	ASSERT_TRUE(inc->encoded_ == 1);
+	ASSERT_TRUE(inc->code_[3].get_reg_a().first == 1 && inc->code_[20006].get_reg_a().first == 1);
+
+	// an undefined label is an error until it is defined again
+	ASSERT_TRUE(emu_asm_edit(*inc, 1, 1, "\tinc r0") == FAILURE);
+	ASSERT_TRUE(emu_asm_incremental_diagnostics(*inc).size() == 2);
+	ASSERT_TRUE(emu_asm_edit(*inc, 1, 1, "$top inc r0") == SUCCESS);
+	ASSERT_TRUE(emu_asm_incremental_diagnostics(*inc).empty());
+}
+
+UTEST(emu, asm_incremental_label_twice) {
+	// the first definition in source order counts, the error follows it like emu_asm on the text
+	std::vector<std::string> lines = { "$a\tinc r0", "\tlw $a r1 0", "$a\tinc r1", "\thalt" };
+	EAsmIncremental inc;
+	auto full = std::make_unique<EAsmCompillerData>();
+
+	const auto check = [&](Status status) {
+		std::string source;
+		for (const auto& l : lines)
+			source += l + "\n";
+		*full = {};
+		if (emu_asm(*full, source) != status)
+			return false;
+
+		auto diagnostics = emu_asm_incremental_diagnostics(inc);
+		if (diagnostics.size() != full->diagnostics_.size())
+			return false;
+		for (u32 i = 0; i < diagnostics.size(); i++)
+		{
+			if (diagnostics[i].line_ != full->diagnostics_[i].line_ || diagnostics[i].column_ != full->diagnostics_[i].column_ ||
+				diagnostics[i].message_ != full->diagnostics_[i].message_)
+				return false;
+		}
+		return true;
+	};
+
+	std::string source = lines[0];
+	for (u32 i = 1; i < lines.size(); i++)
+		source += "\n" + lines[i];
+	ASSERT_TRUE(emu_asm_edit(inc, 0, 0, source) == FAILURE);
+	ASSERT_TRUE(check(FAILURE));
+	ASSERT_TRUE(emu_asm_incremental_diagnostics(inc)[0].line_ == 3);
+
+	// a new first definition takes the label, both old ones are errors now
+	lines.insert(lines.begin(), "$a\tnoop");
+	ASSERT_TRUE(emu_asm_edit(inc, 0, 0, lines[0]) == FAILURE);
+	ASSERT_TRUE(check(FAILURE));
+	ASSERT_TRUE(emu_asm_symbol_find(inc.symbols_, "$a")->address_ == 0);
+
+	// deleting the first definitions clears the errors, the last one gives $a its address
+	lines.erase(lines.begin(), lines.begin() + 2);
+	ASSERT_TRUE(emu_asm_edit(inc, 0, 2, "") == SUCCESS);
+	ASSERT_TRUE(check(SUCCESS));
+	ASSERT_TRUE(inc.code_[0].get_reg_a().first == 1);
+	lines.insert(lines.begin(), "\tinc r2");
+	ASSERT_TRUE(emu_asm_edit(inc, 0, 0, lines[0]) == SUCCESS);
+	ASSERT_TRUE(check(SUCCESS));
+	ASSERT_TRUE(inc.code_.size() == 4 && inc.code_[1].get_reg_a().first == 2);
+
+	// a duplicate whose missing label turns up later is still an error
+	inc = {};
+	lines = { "\thalt", "$a\tlw $z r1 0" };
+	ASSERT_TRUE(emu_asm_edit(inc, 0, 0, lines[0] + "\n" + lines[1]) == FAILURE);
+	lines.insert(lines.begin(), "$a\tinc r0");
+	ASSERT_TRUE(emu_asm_edit(inc, 0, 0, lines[0]) == FAILURE);
+	lines.push_back("$z\thalt");
+	ASSERT_TRUE(emu_asm_edit(inc, 3, 0, lines[3]) == FAILURE);
+	ASSERT_TRUE(check(FAILURE));
+}
+
+UTEST(emu, asm_parallel_matches_full) {
+	// many chunks, labels used across them, then the same source with errors sprinkled in
+	static const char* const bodies[] = { "\tadd r0 r1 r2", "\tlw $l%u r1 5", "\tadd $l%u r3 r4", "; comment", "", "$m%u", "\t.fill dec 77", "\tbeq r0 r1 -3" };
+	u64 rng = 11;
+	std::vector<std::string> lines;
+	for (u32 i = 0; i < 10; i++)
+		lines.push_back("$l" + std::to_string(i) + "\tinc r" + std::to_string(i % REGISTERS_COUNT));
+	for (u32 i = 0; i < 30000; i++)
+	{
+		char text[48];
+		u64 r = emu_disasm_splitmix(rng);
+		snprintf(text, sizeof(text), bodies[r % ARRAY_SIZE(bodies)], (u32)(r >> 8) % 10 + (r % ARRAY_SIZE(bodies) == 5 ? i * 10 : 0));
+		lines.push_back(text);
+	}
+
+	const auto join = [&]() {
+		std::string source;
+		for (const auto& l : lines)
+			source += l + "\n";
+		return source;
+	};
+	const auto sorted = [](std::vector<EAsmDiagnostic> d) {
+		std::sort(d.begin(), d.end(), [](const EAsmDiagnostic& a, const EAsmDiagnostic& b) {
+			return std::tie(a.line_, a.column_, a.message_) < std::tie(b.line_, b.column_, b.message_);
+		});
+		return d;
+	};
+
+	using EBigData = EAsmCompillerDataT<1u << 16, REGISTERS_COUNT>;
+	auto full = std::make_unique<EBigData>();
+	auto parallel = std::make_unique<EBigData>();
+
+	std::string source = join();
+	ASSERT_TRUE(emu_asm(*full, source) == SUCCESS);
+	ASSERT_TRUE(emu_asm_parallel(*parallel, source, 4) == SUCCESS);
+	ASSERT_TRUE(std::memcmp(full->compilled_code, parallel->compilled_code, sizeof(full->compilled_code)) == 0);
+
+	static const char* const errors[] = { "\tadd r99 r0 r0", "\tlw $nope r1 0", "\tadd $nope $l3 r1", "\tadd $m10 r0 r1", "\tinc r1 r2 r3 r4", "\t#" };
+	for (u32 i = 0; i < 200; i++)
+	{
+		u64 r = emu_disasm_splitmix(rng);
+		lines[10 + r % 30000] = errors[(r >> 32) % ARRAY_SIZE(errors)];
+	}
+	source = join();
+	*full = {};
+	*parallel = {};
+	ASSERT_TRUE(emu_asm(*full, source) == FAILURE);
+	ASSERT_TRUE(emu_asm_parallel(*parallel, source, 4) == FAILURE);
+
+	auto expected = sorted(full->diagnostics_);
+	auto actual = sorted(parallel->diagnostics_);
+	ASSERT_TRUE(expected.size() == actual.size());
+	for (u32 i = 0; i < expected.size(); i++)
+		ASSERT_TRUE(expected[i].line_ == actual[i].line_ && expected[i].column_ == actual[i].column_ && expected[i].message_ == actual[i].message_);
+}
+
+UTEST(emu, asm_stream_matches_full) {
+	// reads of 1..1021 bytes and a line longer than a whole chunk, the words must match emu_asm
+	std::string source = "$a\tlw $b r1 3\n; " + std::string(EMU_ASM_STREAM_CHUNK + 100, 'x') + "\n";
+	for (u32 i = 0; i < 3000; i++)
+		source += i % 3 ? "\tadd r0 r1 r2 ; sum\n" : "\tbeq $a $b -7\n";
+	source += "$b\t.fill dec 9\n\thalt";
+
+	using EBigData = EAsmCompillerDataT<1u << 13, REGISTERS_COUNT>;
+	auto full = std::make_unique<EBigData>();
+	auto streamed = std::make_unique<EBigData>();
+	ASSERT_TRUE(emu_asm(*full, source) == FAILURE); // $b ends up past word 15
+
+	size_t pos = 0;
+	u64 rng = 3;
+	ASSERT_TRUE(emu_asm_stream(*streamed, [&](char* out, size_t capacity) {
+		size_t n = std::min<size_t>({ capacity, source.size() - pos, 1 + emu_disasm_splitmix(rng) % 1021 });
+		std::memcpy(out, source.data() + pos, n);
+		pos += n;
+		return n;
+	}) == FAILURE);
+	ASSERT_TRUE(full->diagnostics_.size() == streamed->diagnostics_.size());
+	for (u32 i = 0; i < full->diagnostics_.size(); i++)
+	{
+		const EAsmDiagnostic& a = full->diagnostics_[i];
+		const EAsmDiagnostic& b = streamed->diagnostics_[i];
+		ASSERT_TRUE(a.line_ == b.line_ && a.column_ == b.column_ && a.message_ == b.message_);
+	}
+
+	// move $b down and it assembles
+	source = "$b\t.fill dec 9\n" + source.substr(0, source.rfind("$b"));
+	std::istringstream in(source);
+	ASSERT_TRUE(emu_asm(*full, source) == SUCCESS);
+	ASSERT_TRUE(emu_asm_stream_istream(*streamed, in) == SUCCESS);
+	ASSERT_TRUE(std::memcmp(full->compilled_code, streamed->compilled_code, sizeof(full->compilled_code)) == 0);
+}
+
+UTEST(emu, asm_stream_read_errors) {
+	// a source that can't be read is a failure, not an empty program
+	auto data = std::make_unique<EAsmCompillerData>();
+	std::istringstream in("\thalt\n");
+	in.setstate(std::ios::badbit);
+	ASSERT_TRUE(emu_asm_stream_istream(*data, in) == FAILURE);
+
+#if EMU_ASM_STREAM_FD
+	ASSERT_TRUE(emu_asm_stream_fd(*data, -1) == FAILURE);
+	// a directory opens but every read fails
+	ASSERT_TRUE(emu_asm_stream_file(*data, ".") == FAILURE);
+#endif
+}
+
+UTEST(emu, asm_const_matches_runtime) {
+	// assembled by the compiler, the words must be the ones emu_asm makes at run time
+	constexpr auto program = emu_asm_const<R"(
+		lw r0 $first 0
+	$loop	inc r0
+		cmp r0 r1
+		jma r0 r1 -2 ; a comment
+		beq $loop $first 1
+		halt
+	$first .fill dec 10
+	)">();
+	static_assert(program.size() == 7);
+	static_assert(program[1].get_opcode() == E_INC);
+	static_assert(program[4].get_reg_a().first == 1 && program[4].get_reg_b().first == 6);
+
+	EAsmCompillerData compiller_data = {};
+	ASSERT_TRUE(emu_asm(compiller_data, R"(
+		lw r0 $first 0
+	$loop	inc r0
+		cmp r0 r1
+		jma r0 r1 -2 ; a comment
+		beq $loop $first 1
+		halt
+	$first .fill dec 10
+	)") == SUCCESS);
+	for (u32 i = 0; i < program.size(); i++)
+		ASSERT_TRUE(program[i].data == compiller_data.compilled_code[i].data);
+}
+
+UTEST(emu, cfg_blocks_loops_and_dead_words) {
+	EAsmCompillerData compiller_data = {};
+	ASSERT_TRUE(emu_asm(compiller_data, R"(
+		lw r4 $n 0
+		lw r5 $n 0
+	$top	inc r0
+	$in	inc r1
+		inc r2
+		jmbe r1 r4 -3
+		xor r1 r1 r1
+		jmbe r0 r5 -6
+		halt
+		inc r3
+		inc r3
+	$n	.fill dec 2
+	)") == SUCCESS);
+
+	ECfg cfg;
+	ASSERT_TRUE(emu_cfg_build(cfg, compiller_data.compilled_code, 12) == SUCCESS);
+	ASSERT_TRUE(cfg.blocks_.size() == 5);
+	ASSERT_TRUE(cfg.blocks_[2].begin_ == 3 && cfg.blocks_[2].end_ == 6);
+	ASSERT_TRUE(cfg.blocks_[2].succ_count_ == 2);
+	ASSERT_TRUE(cfg.block_of_[9] == ECFG_NONE && cfg.block_of_[11] == ECFG_NONE && cfg.data_[11]);
+
+	// the outer loop holds the inner one
+	ASSERT_TRUE(cfg.loops_.size() == 2);
+	ASSERT_TRUE(cfg.loops_[0].header_ == 1 && cfg.loops_[0].depth_ == 1 && cfg.loops_[0].blocks_ == 3 && cfg.loops_[0].words_ == 6);
+	ASSERT_TRUE(cfg.loops_[1].header_ == 2 && cfg.loops_[1].depth_ == 2 && cfg.loops_[1].parent_ == 0);
+	ASSERT_TRUE(cfg.blocks_[2].loop_ == 1 && cfg.blocks_[3].loop_ == 0 && cfg.blocks_[4].loop_ == ECFG_NONE);
+
+	auto dead = emu_cfg_dead(cfg);
+	ASSERT_TRUE(dead.size() == 1 && dead[0].first == 9 && dead[0].second == 11);
+
+	// stripping changes nothing the program can see
+	EState original = {};
+	std::memcpy(original.ram_, compiller_data.compilled_code, RAM_SIZE);
+	ASSERT_TRUE(emu_cfg_strip(cfg, compiller_data.compilled_code) == 2);
+	EState stripped = {};
+	std::memcpy(stripped.ram_, compiller_data.compilled_code, RAM_SIZE);
+	emu_execute(original);
+	emu_execute(stripped);
+	ASSERT_TRUE(stripped.halt_ && stripped.r_[2] == original.r_[2] && stripped.r_[0] == 3);
+	ASSERT_TRUE(original.r_[3] == 0);
+
+	// a return through a register: the words after every jalr count as reached, nothing is stripped
+	ASSERT_TRUE(emu_asm(compiller_data, R"(
+		jalr $link $sub r0
+		halt
+	$sub	inc r0
+		lw r6 $link 0
+		jalr $scratch r6 r0
+	$link	.fill dec 0
+	$scratch .fill dec 0
+	)") == SUCCESS);
+	ASSERT_TRUE(emu_cfg_build(cfg, compiller_data.compilled_code, 7) == SUCCESS);
+	ASSERT_TRUE(cfg.dynamic_jumps_ == 1);
+	ASSERT_TRUE(cfg.block_of_[1] != ECFG_NONE && cfg.blocks_[cfg.block_of_[1]].succ_count_ == 0);
+	ASSERT_TRUE(emu_cfg_strip(cfg, compiller_data.compilled_code) == 0);
+
+	// a direct add operand reads its word, only the dead inc goes
+	ASSERT_TRUE(emu_asm(compiller_data, R"(
+		add $a $b r1
+		halt
+		inc r2
+	$a	.fill dec 7
+	$b	.fill dec 5
+	)") == SUCCESS);
+	ASSERT_TRUE(emu_cfg_build(cfg, compiller_data.compilled_code, 5) == SUCCESS);
+	ASSERT_TRUE(cfg.data_[3] && cfg.data_[4]);
+	ASSERT_TRUE(emu_cfg_strip(cfg, compiller_data.compilled_code) == 1);
+	EState added = {};
+	std::memcpy(added.ram_, compiller_data.compilled_code, RAM_SIZE);
+	emu_execute(added);
+	ASSERT_TRUE(added.halt_ && added.r_[1] == 12);
+}
+
+UTEST(emu, tiered_hot_loop_moves_to_predecoded) {
+	// a short setup, then one long loop: the loop runs predecoded, the setup never gets decoded
+	EAsmCompillerData compiller_data = {};
+	ASSERT_TRUE(emu_asm(compiller_data, R"(
+		lw r4 $n 0
+		inc r1
+		inc r1
+	$loop	inc r0
+		add r0 r1 r2
+		jmbe r0 r4 -3
+		halt
+	$n	.fill dec 5000
+	)") == SUCCESS);
+	EState image = {};
+	std::memcpy(image.ram_, compiller_data.compilled_code, RAM_SIZE);
+
+	EState reference = image;
+	u64 reference_steps = 0;
+	ASSERT_TRUE(emu_execute_for(reference, UINT64_MAX, &reference_steps) == EEXEC_HALTED);
+
+	auto tier = std::make_unique<ETier>();
+	emu_tier_reset(*tier, 16);
+	EState state = image;
+	u64 steps = 0;
+	ASSERT_TRUE(emu_execute_tiered_for(state, *tier, UINT64_MAX, &steps) == EEXEC_HALTED);
+	ASSERT_TRUE(emu_fuzz_diff(reference, state).empty());
+	ASSERT_TRUE(steps == reference_steps);
+	ASSERT_TRUE(tier->loops_ == 1);
+	ASSERT_TRUE(tier->program_.code_[0].opcode_ == E_DECODED_EXIT && tier->program_.code_[3].opcode_ == E_INC);
+	ASSERT_TRUE(tier->interpreted_ < 100 && tier->predecoded_ + tier->interpreted_ == steps);
+
+	// in slices of 7 steps it ends the same
+	emu_tier_reset(*tier, 16);
+	state = image;
+	steps = 0;
+	EExecStatus status = EEXEC_BUDGET;
+	while (status == EEXEC_BUDGET)
+		status = emu_execute_tiered_for(state, *tier, 7, &steps);
+	ASSERT_TRUE(status == EEXEC_HALTED && steps == reference_steps);
+	ASSERT_TRUE(emu_fuzz_diff(reference, state).empty());
+}
+
+UTEST(emu, tiered_store_into_hot_loop) {
+	// the loop rewrites its own branch after it went hot
+	EAsmCompillerData compiller_data = {};
+	ASSERT_TRUE(emu_asm(compiller_data, R"(
+	$loop	inc r0
+		jmbe r0 r4 -2
+		sw $loop r5 1
+		inc r4
+		inc r4
+		jmbe r0 r4 -6
+		halt
+	)") == SUCCESS);
+	EState image = {};
+	std::memcpy(image.ram_, compiller_data.compilled_code, RAM_SIZE);
+	image.r_[4] = 40;
+
+	EState reference = image;
+	ASSERT_TRUE(emu_execute_for(reference, 100000) == EEXEC_HALTED);
+
+	auto tier = std::make_unique<ETier>();
+	emu_tier_reset(*tier, 4);
+	EState state = image;
+	ASSERT_TRUE(emu_execute_tiered_for(state, *tier, 100000) == EEXEC_HALTED);
+	ASSERT_TRUE(emu_fuzz_diff(reference, state).empty());
+	ASSERT_TRUE(tier->loops_ >= 1);
+}
+
+UTEST(emu, debug_breakpoints_and_watchpoints) {
+	EAsmCompillerData compiller_data = {};
+	ASSERT_TRUE(emu_asm(compiller_data, R"(
+		lw r1 $x 0
+		inc r1
+		sw $y r1 0
+		add r2 r0 r0
+		halt
+	$x	.fill dec 7
+	$y	.fill dec 0
+	)") == SUCCESS);
+	EState image = {};
+	std::memcpy(image.ram_, compiller_data.compilled_code, RAM_SIZE);
+
+	EState reference = image;
+	ASSERT_TRUE(emu_execute_for(reference, 100) == EEXEC_HALTED);
+
+	// nothing armed is just emu_execute_for
+	auto debug = std::make_unique<EDebug>();
+	EState state = image;
+	ASSERT_TRUE(!emu_debug_armed(*debug));
+	ASSERT_TRUE(emu_execute_debug_for(state, *debug, 100) == EEXEC_HALTED);
+	ASSERT_TRUE(emu_fuzz_diff(reference, state).empty());
+
+	// stops before the instruction, continuing runs it
+	ASSERT_TRUE(emu_debug_break(*debug, 2) == SUCCESS);
+	state = image;
+	u64 steps = 0;
+	ASSERT_TRUE(emu_execute_debug_for(state, *debug, 100, &steps) == EEXEC_BREAK);
+	ASSERT_TRUE(debug->hit_.kind_ == EDEBUG_BREAK && state.program_counter_ == 2 && steps == 2);
+	ASSERT_TRUE(emu_execute_debug_for(state, *debug, 100, &steps) == EEXEC_HALTED);
+	ASSERT_TRUE(emu_fuzz_diff(reference, state).empty());
+	ASSERT_TRUE(emu_debug_break(*debug, 2, false) == SUCCESS && !emu_debug_armed(*debug));
+
+	// read and write watches over a range stop after the access
+	ASSERT_TRUE(emu_debug_watch(*debug, 5, 2, EDEBUG_WATCH_READ | EDEBUG_WATCH_WRITE) == SUCCESS);
+	state = image;
+	ASSERT_TRUE(emu_execute_debug_for(state, *debug, 100) == EEXEC_BREAK);
+	ASSERT_TRUE(debug->hit_.kind_ == EDEBUG_WATCH_READ && debug->hit_.where_ == 5 && debug->hit_.new_ == 7);
+	ASSERT_TRUE(debug->hit_.pc_ == 0 && state.program_counter_ == 1);
+	ASSERT_TRUE(emu_execute_debug_for(state, *debug, 100) == EEXEC_BREAK);
+	ASSERT_TRUE(debug->hit_.kind_ == EDEBUG_WATCH_WRITE && debug->hit_.where_ == 6);
+	ASSERT_TRUE(debug->hit_.old_ == 0 && debug->hit_.new_ == 8);
+	ASSERT_TRUE(emu_execute_debug_for(state, *debug, 100) == EEXEC_HALTED);
+	ASSERT_TRUE(emu_debug_watch(*debug, 5, 2, EDEBUG_WATCH_READ | EDEBUG_WATCH_WRITE, false) == SUCCESS);
+	ASSERT_TRUE(emu_debug_watch(*debug, RAM_SIZE, 1, EDEBUG_WATCH_READ) == FAILURE);
+
+	// a register watch stops on changes only, add r2 r0 r0 leaves r2 at 0
+	ASSERT_TRUE(emu_debug_watch_register(*debug, 1) == SUCCESS);
+	ASSERT_TRUE(emu_debug_watch_register(*debug, 2) == SUCCESS);
+	state = image;
+	ASSERT_TRUE(emu_execute_debug_for(state, *debug, 100) == EEXEC_BREAK);
+	ASSERT_TRUE(debug->hit_.kind_ == EDEBUG_WATCH_REGISTER && debug->hit_.where_ == 1);
+	ASSERT_TRUE(debug->hit_.old_ == 0 && debug->hit_.new_ == 7);
+	ASSERT_TRUE(emu_execute_debug_for(state, *debug, 100) == EEXEC_BREAK);
+	ASSERT_TRUE(debug->hit_.old_ == 7 && debug->hit_.new_ == 8);
+	ASSERT_TRUE(emu_execute_debug_for(state, *debug, 100) == EEXEC_HALTED);
+	ASSERT_TRUE(emu_fuzz_diff(reference, state).empty());
+
+	emu_debug_clear(*debug);
+	ASSERT_TRUE(!emu_debug_armed(*debug));
+
+	// the second direct operand of an add and the word inc $w reads are reads too
+	ASSERT_TRUE(emu_asm(compiller_data, R"(
+		add $y $x r1
+		inc $x
+		halt
+	$y	.fill dec 5
+	$x	.fill dec 7
+	)") == SUCCESS);
+	state = {};
+	std::memcpy(state.ram_, compiller_data.compilled_code, RAM_SIZE);
+	ASSERT_TRUE(emu_debug_watch(*debug, 4, 1, EDEBUG_WATCH_READ) == SUCCESS);
+	ASSERT_TRUE(emu_execute_debug_for(state, *debug, 100) == EEXEC_BREAK);
+	ASSERT_TRUE(debug->hit_.kind_ == EDEBUG_WATCH_READ && debug->hit_.pc_ == 0 && debug->hit_.where_ == 4);
+	ASSERT_TRUE(state.r_[1] == 12);
+	ASSERT_TRUE(emu_execute_debug_for(state, *debug, 100) == EEXEC_BREAK);
+	ASSERT_TRUE(debug->hit_.kind_ == EDEBUG_WATCH_READ && debug->hit_.pc_ == 1 && debug->hit_.where_ == 4);
+	ASSERT_TRUE(debug->hit_.old_ == 7 && debug->hit_.new_ == 8);
+	ASSERT_TRUE(emu_execute_debug_for(state, *debug, 100) == EEXEC_HALTED);
+}
+
+#if EMU_GDB_AVAILABLE
+
+UTEST(emu, gdb_stub_session) {
+	EAsmCompillerData compiller_data = {};
+	ASSERT_TRUE(emu_asm(compiller_data, R"(
+		lw r1 $x 0
+		inc r1
+		sw $y r1 0
+		halt
+	$spin	beq r0 r0 -1
+	$x	.fill dec 7
+	$y	.fill dec 0
+	)") == SUCCESS);
+	auto state = std::make_unique<EState>();
+	std::memcpy(state->ram_, compiller_data.compilled_code, RAM_SIZE);
+	auto debug = std::make_unique<EDebug>();
+
+	i32 fds[2];
+	ASSERT_TRUE(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+	Status served = FAILURE;
+	std::thread server([&]() { served = emu_gdb_serve(*state, *debug, fds[1]); });
+
+	// a failing ASSERT returns early, the server still has to be stopped and joined
+	struct EJoin
+	{
+		std::thread& thread_;
+		i32* fds_;
+		~EJoin()
+		{
+			shutdown(fds_[0], SHUT_RDWR);
+			if (thread_.joinable())
+				thread_.join();
+			close(fds_[0]);
+			close(fds_[1]);
+		}
+	} join = { server, fds };
+
+	// the test is the client, with the same packet code
+	auto client = std::make_unique<EGdbConnection>();
+	client->fd_ = fds[0];
+	std::string reply;
+	const auto exchange = [&](std::string_view packet) {
+		reply.clear();
+		return emu_gdb_send(*client, packet) && emu_gdb_receive(*client, reply);
+	};
+
+	char pc[8];
+	snprintf(pc, sizeof(pc), "%x", REGISTERS_COUNT);
+
+	ASSERT_TRUE(exchange("qSupported:xmlRegisters=i386") && reply.starts_with("PacketSize=4000;"));
+	ASSERT_TRUE(exchange("qXfer:features:read:target.xml:0,fff") && reply.starts_with("l<?xml"));
+	ASSERT_TRUE(exchange("g") && reply.size() == REGISTERS_COUNT * 4 + 8);
+	ASSERT_TRUE(exchange("m14,4") && reply == "07000000");
+
+	// all of ram in one packet, the size gdb was offered
+	char all[16];
+	snprintf(all, sizeof(all), "m0,%x", RAM_SIZE);
+	ASSERT_TRUE(exchange(all) && reply.size() == RAM_SIZE * 2 && reply.size() <= EMU_GDB_PACKET_SIZE);
+	ASSERT_TRUE(reply.substr(0x14 * 2, 8) == "07000000");
+
+	// ^C stops a guest that never halts
+	ASSERT_TRUE(exchange(std::string("P") + pc + "=10000000") && reply == "OK");
+	ASSERT_TRUE(emu_gdb_send(*client, "c") && emu_gdb_write(*client, "\x03"));
+	ASSERT_TRUE(emu_gdb_receive(*client, reply) && reply == "S02");
+	ASSERT_TRUE(exchange(std::string("p") + pc) && reply == "10000000");
+	ASSERT_TRUE(exchange(std::string("P") + pc + "=00000000") && reply == "OK");
+
+	// breakpoint on word 2, then a write watch on $y
+	ASSERT_TRUE(exchange("Z0,8,4") && reply == "OK");
+	ASSERT_TRUE(exchange("c") && reply == "S05");
+	ASSERT_TRUE(exchange(std::string("p") + pc) && reply == "08000000");
+	ASSERT_TRUE(exchange("p1") && reply == "0800");
+	ASSERT_TRUE(exchange("z0,8,4") && reply == "OK");
+	ASSERT_TRUE(exchange("P1=2a00") && reply == "OK");
+	ASSERT_TRUE(exchange("Z2,18,4") && reply == "OK");
+	ASSERT_TRUE(exchange("c") && reply == "T05watch:18;");
+	ASSERT_TRUE(exchange("m18,4") && reply == "2a000000");
+	ASSERT_TRUE(exchange("M18,2:0100") && reply == "OK");
+	ASSERT_TRUE(state->ram_[6].get_value() == 1);
+	ASSERT_TRUE(exchange("s") && reply == "W00");
+	ASSERT_TRUE(exchange("c") && reply == "W00");
+	ASSERT_TRUE(exchange("vMustReplyEmpty") && reply.empty());
+
+	ASSERT_TRUE(emu_gdb_send(*client, "k"));
+	server.join();
+	ASSERT_TRUE(served == SUCCESS);
 }
 
+#endif
@@ -0,0 +1,191 @@
+#pragma once
+#include "e_base.h"
+#include "e_predecode.h"
+#include "e_exec.h"
+
+#include <chrono>
+#include <vector>
+
+/*
+ * TIERED EXECUTION:
+ *   - emu_tier_reset before the first run, execution starts in emu_process, every taken beq /
+ *     jma / jmbe that goes backwards counts one for its target (the loop head); after the first
+ *     reset it only puts back the heads that were counted and the words that were decoded
+ *   - when a head reaches threshold_ the words from the head to the branch are decoded into
+ *     program_, every other slot stays E_DECODED_EXIT, so only hot loops are ever translated
+ *   - whenever the pc is on a decoded word the run continues in emu_execute_predecoded, which
+ *     comes back at the first E_DECODED_EXIT, i.e. as soon as the loop is left; an outer loop
+ *     that gets hot later takes the inner one with it
+ *   - a store made by the interpreter into a decoded word re-decodes it, the predecoded tier
+ *     does that itself
+ *   - budget, resume and faults work like e_exec.h: the same state and tier can be run again,
+ *     interpreted_ / predecoded_ say how many steps ran in each tier
+ *   - the jit can't stop after n steps or when a loop is left, so the hot tier is predecoded;
+ *     emu_execute_jit already compiles lazily, block by block
+ */
+
+#define EMU_TIER_THRESHOLD 64
+
+template <u32 RAM_WORDS>
+struct ETierT
+{
+	u32 threshold_ = EMU_TIER_THRESHOLD;
+	u32 loops_ = 0;                      // loops handed to the predecoded tier
+	u64 interpreted_ = 0;
+	u64 predecoded_ = 0;
+	u32 counts_[RAM_WORDS] = {};         // backward branches taken to each word
+	EDecodedProgramT<RAM_WORDS> program_;
+	bool reset_ = false;                 // counts_ and program_ are clean apart from the lists below
+	std::vector<u32> counted_;           // heads with a count
+	std::vector<u32> decoded_;           // words emu_tier_up decoded
+};
+
+using ETier = ETierT<EState::ram_words_>;
+
+template <u32 RAM_WORDS>
+void
+emu_tier_reset(
+	ETierT<RAM_WORDS>& tier,
+	u32 threshold = EMU_TIER_THRESHOLD)
+{
+	tier.threshold_ = threshold;
+	tier.loops_ = 0;
+	tier.interpreted_ = 0;
+	tier.predecoded_ = 0;
+
+	EDecodedInstruction exit = {};
+	exit.opcode_ = E_DECODED_EXIT;
+	EDecodedProgramT<RAM_WORDS>& program = tier.program_;
+	if (tier.reset_)
+	{
+		for (u32 w : tier.counted_)
+			tier.counts_[w] = 0;
+		for (u32 w : tier.decoded_)
+		{
+			program.code_[w] = exit;
+			emu_predecode_touch(program, w);
+		}
+		// stores the predecoded tier made decode words of their own
+		for (u32 w = program.stored_begin_; w < program.stored_end_; w++)
+			program.code_[w] = exit;
+		emu_predecode_touch(program, program.stored_begin_, program.stored_end_ - program.stored_begin_);
+	}
+	else
+	{
+		std::fill(std::begin(tier.counts_), std::end(tier.counts_), 0);
+		std::fill(std::begin(program.code_), std::end(program.code_), exit);
+		program.code_[RAM_WORDS].opcode_ = E_DECODED_END;
+		emu_predecode_touch(program, 0, RAM_WORDS + 1);
+	}
+
+	program.stored_begin_ = program.stored_end_ = 0;
+	tier.counted_.clear();
+	tier.decoded_.clear();
+	tier.reset_ = true;
+}
+
+template <u32 RAM_WORDS, u32 REG_COUNT>
+void
+emu_tier_up(
+	ETierT<RAM_WORDS>& tier,
+	const EStateT<RAM_WORDS, REG_COUNT>& state,
+	u32 head,
+	u32 tail)
+{
+	for (u32 w = head; w <= tail && w < RAM_WORDS; w++)
+	{
+		if (tier.program_.code_[w].opcode_ == E_DECODED_EXIT)
+		{
+			tier.program_.code_[w] = emu_decode(state.ram_[w], REG_COUNT);
+			emu_predecode_touch(tier.program_, w);
+			tier.decoded_.push_back(w);
+		}
+	}
+	tier.loops_++;
+}
+
+template <u32 RAM_WORDS, u32 REG_COUNT>
+EExecStatus
+emu_execute_tiered_for(
+	EStateT<RAM_WORDS, REG_COUNT>& state,
+	ETierT<RAM_WORDS>& tier,
+	u64 max_steps,
+	u64* steps = nullptr)
+{
+	EDecodedInstruction* code = tier.program_.code_;
+	u64 retired = 0;
+	EExecStatus status = EEXEC_BUDGET;
+
+	while (retired < max_steps)
+	{
+		if (state.halt_)
+		{
+			status = EEXEC_HALTED;
+			break;
+		}
+
+		const u32 pc = state.program_counter_;
+		if (pc < RAM_WORDS && code[pc].opcode_ != E_DECODED_EXIT)
+		{
+			u64 hot = 0;
+			Status result = emu_execute_predecoded(state, tier.program_, &hot, max_steps - retired);
+			retired += hot;
+			tier.predecoded_ += hot;
+			if (result != SUCCESS)
+			{
+				status = EEXEC_FAULT;
+				break;
+			}
+			continue;
+		}
+
+		EStepEffects effects = emu_step_effects(state);
+		if (effects.fault_)
+		{
+			status = EEXEC_FAULT;
+			break;
+		}
+
+		emu_load_next(state);
+		emu_process(state);
+		retired++;
+		tier.interpreted_++;
+
+		const u32 written = effects.mem_write_;
+		if (written != EMU_NO_ADDRESS && code[written].opcode_ != E_DECODED_EXIT)
+		{
+			code[written] = emu_decode(state.ram_[written], REG_COUNT);
+			emu_predecode_touch(tier.program_, written);
+		}
+
+		const u32 opcode = state.command_register_.get_opcode();
+		const u32 next = state.program_counter_;
+		if ((opcode == E_BEQ || opcode == E_JMA || opcode == E_JMBE) && next <= pc)
+		{
+			if (tier.counts_[next]++ == 0)
+				tier.counted_.push_back(next);
+			if (tier.counts_[next] == tier.threshold_)
+				emu_tier_up(tier, state, next, pc);
+		}
+	}
+
+	// the budget may run out right on the halt
+	if (status == EEXEC_BUDGET && state.halt_)
+		status = EEXEC_HALTED;
+
+	if (steps)
+		*steps += retired;
+
+	return status;
+}
+
+template <u32 RAM_WORDS, u32 REG_COUNT>
+EExecStatus
+emu_execute_tiered_until(
+	EStateT<RAM_WORDS, REG_COUNT>& state,
+	ETierT<RAM_WORDS>& tier,
+	std::chrono::steady_clock::time_point deadline,
+	u64* steps = nullptr)
+{
+	return emu_execute_sliced(deadline, [&](u64 slice) { return emu_execute_tiered_for(state, tier, slice, steps); });
+}
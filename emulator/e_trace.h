@@ -0,0 +1,399 @@
+#pragma once
+#include "e_base.h"
+#include "e_predecode.h"
+#include "e_disasm.h"
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+ * EXECUTION TRACE:
+ *   - emu_execute_traced runs like emu_execute and pushes one ETraceRecord per retired
+ *     instruction (pc, raw word, written register and its new value, ram word touched)
+ *   - records go through a single producer / single consumer lock-free ring, the emulator
+ *     only copies 16 bytes and bumps an index, a writer thread encodes and writes them
+ *     (a full ring makes the emulator wait, nothing is dropped)
+ *   - file: "E16T" magic, version, then one record after another:
+ *       header byte: bit 0 pc is previous pc + 1, bit 1 word is the one last seen at this pc,
+ *                    bit 2 a register is written, bit 3 ram is touched, bits 4..7 the register
+ *       zigzag varint pc delta      (unless bit 0)
+ *       varint word                 (unless bit 1)
+ *       zigzag varint value delta   (bit 2, against the last traced value of that register)
+ *       zigzag varint address delta (bit 3, against the last traced address)
+ *     a loop body costs ~2 bytes per instruction
+ *   - ETraceReader decodes the file back, emu_trace_format prints a record through
+ *     emu_disasm_word
+ */
+
+#define EMU_TRACE_MAGIC 0x54363145 // "E16T"
+#define EMU_TRACE_VERSION 1
+#define EMU_TRACE_RING (1u << 16)
+#define EMU_TRACE_WORD_CACHE 4096
+#define EMU_TRACE_FLUSH (1u << 16)
+
+enum ETraceFlags
+{
+	ETRACE_SEQUENTIAL = 1 << 0,
+	ETRACE_CACHED_WORD = 1 << 1,
+	ETRACE_REGISTER = 1 << 2,
+	ETRACE_MEMORY = 1 << 3
+};
+
+struct ETraceRecord
+{
+	u32 pc_;
+	u32 word_;
+	u32 mem_addr_;   // EMU_NO_ADDRESS if none
+	u16 dest_value_;
+	u8 dest_reg_;    // EMU_NO_REGISTER if none
+};
+
+struct ETraceRing
+{
+	alignas(64) std::atomic<u64> head_ = 0; // next slot the producer writes
+	alignas(64) std::atomic<u64> tail_ = 0; // next slot the consumer reads
+	alignas(64) ETraceRecord records_[EMU_TRACE_RING];
+};
+
+// what encoder and decoder both remember, they have to stay in step
+struct ETraceCodec
+{
+	u32 pc_ = UINT32_MAX;
+	u32 mem_addr_ = 0;
+	u16 r_[16] = {};
+	u32 cache_pc_[EMU_TRACE_WORD_CACHE];
+	u32 cache_word_[EMU_TRACE_WORD_CACHE];
+
+	ETraceCodec()
+	{
+		std::fill(std::begin(cache_pc_), std::end(cache_pc_), UINT32_MAX);
+	}
+};
+
+struct ETraceWriter
+{
+	ETraceRing ring_;
+	ETraceCodec codec_;
+	FILE* file_ = nullptr;
+	std::vector<u8> out_;
+	std::thread thread_;
+	std::atomic<bool> done_ = false;
+	u64 records_ = 0;
+};
+
+struct ETraceReader
+{
+	ETraceCodec codec_;
+	std::vector<u8> data_;
+	size_t pos_ = 0;
+};
+
+[[nodiscard]] inline u64
+emu_trace_zigzag(
+	i64 v)
+{
+	return ((u64)v << 1) ^ (u64)(v >> 63);
+}
+
+[[nodiscard]] inline i64
+emu_trace_unzigzag(
+	u64 v)
+{
+	return (i64)(v >> 1) ^ -(i64)(v & 1);
+}
+
+inline void
+emu_trace_put_varint(
+	std::vector<u8>& out,
+	u64 v)
+{
+	while (v >= 0x80)
+	{
+		out.push_back((u8)(v | 0x80));
+		v >>= 7;
+	}
+	out.push_back((u8)v);
+}
+
+[[nodiscard]] inline bool
+emu_trace_get_varint(
+	ETraceReader& reader,
+	u64& v)
+{
+	v = 0;
+	for (u32 shift = 0; shift < 64; shift += 7)
+	{
+		if (reader.pos_ >= reader.data_.size())
+			return false;
+		u8 byte = reader.data_[reader.pos_++];
+		v |= (u64)(byte & 0x7F) << shift;
+		if (!(byte & 0x80))
+			return true;
+	}
+	return false;
+}
+
+inline void
+emu_trace_encode(
+	ETraceCodec& codec,
+	const ETraceRecord& r,
+	std::vector<u8>& out)
+{
+	u32 slot = r.pc_ % EMU_TRACE_WORD_CACHE;
+	bool sequential = r.pc_ == codec.pc_ + 1;
+	bool cached = codec.cache_pc_[slot] == r.pc_ && codec.cache_word_[slot] == r.word_;
+	bool reg = r.dest_reg_ != EMU_NO_REGISTER;
+	bool mem = r.mem_addr_ != EMU_NO_ADDRESS;
+
+	out.push_back((u8)((sequential ? ETRACE_SEQUENTIAL : 0) | (cached ? ETRACE_CACHED_WORD : 0)
+		| (reg ? ETRACE_REGISTER | (r.dest_reg_ << 4) : 0) | (mem ? ETRACE_MEMORY : 0)));
+
+	if (!sequential)
+		emu_trace_put_varint(out, emu_trace_zigzag((i64)r.pc_ - (i64)codec.pc_));
+	if (!cached)
+		emu_trace_put_varint(out, r.word_);
+	if (reg)
+	{
+		emu_trace_put_varint(out, emu_trace_zigzag((i16)(r.dest_value_ - codec.r_[r.dest_reg_])));
+		codec.r_[r.dest_reg_] = r.dest_value_;
+	}
+	if (mem)
+	{
+		emu_trace_put_varint(out, emu_trace_zigzag((i64)r.mem_addr_ - (i64)codec.mem_addr_));
+		codec.mem_addr_ = r.mem_addr_;
+	}
+
+	codec.pc_ = r.pc_;
+	codec.cache_pc_[slot] = r.pc_;
+	codec.cache_word_[slot] = r.word_;
+}
+
+inline void
+emu_trace_flush(
+	ETraceWriter& writer)
+{
+	if (!writer.out_.empty())
+		fwrite(writer.out_.data(), 1, writer.out_.size(), writer.file_);
+	writer.out_.clear();
+}
+
+inline void
+emu_trace_writer_loop(
+	ETraceWriter& writer)
+{
+	ETraceRing& ring = writer.ring_;
+	for (;;)
+	{
+		// done_ is read before head_, so every record pushed before close is seen
+		bool done = writer.done_.load(std::memory_order_acquire);
+		u64 tail = ring.tail_.load(std::memory_order_relaxed);
+		u64 head = ring.head_.load(std::memory_order_acquire);
+
+		if (tail == head)
+		{
+			if (done)
+				break;
+			std::this_thread::sleep_for(std::chrono::microseconds(50));
+			continue;
+		}
+
+		for (u64 i = tail; i != head; i++)
+			emu_trace_encode(writer.codec_, ring.records_[i % EMU_TRACE_RING], writer.out_);
+		ring.tail_.store(head, std::memory_order_release);
+
+		if (writer.out_.size() >= EMU_TRACE_FLUSH)
+			emu_trace_flush(writer);
+	}
+
+	emu_trace_flush(writer);
+}
+
+Status
+emu_trace_open(
+	ETraceWriter& writer,
+	const char* filepath)
+{
+	writer.file_ = fopen(filepath, "wb");
+	if (!writer.file_)
+	{
+		LOG("Can't create trace: %s", filepath);
+		return FILE_NOT_FOUND;
+	}
+
+	const u32 header[2] = { EMU_TRACE_MAGIC, EMU_TRACE_VERSION };
+	fwrite(header, sizeof(header), 1, writer.file_);
+
+	writer.out_.reserve(EMU_TRACE_FLUSH + 64);
+	writer.thread_ = std::thread(emu_trace_writer_loop, std::ref(writer));
+	return SUCCESS;
+}
+
+// producer side, only ever called from the emulator thread
+inline void
+emu_trace_push(
+	ETraceWriter& writer,
+	const ETraceRecord& record)
+{
+	ETraceRing& ring = writer.ring_;
+	u64 head = ring.head_.load(std::memory_order_relaxed);
+	while (head - ring.tail_.load(std::memory_order_acquire) >= EMU_TRACE_RING)
+		std::this_thread::yield();
+
+	ring.records_[head % EMU_TRACE_RING] = record;
+	ring.head_.store(head + 1, std::memory_order_release);
+	writer.records_++;
+}
+
+Status
+emu_trace_close(
+	ETraceWriter& writer)
+{
+	if (!writer.file_)
+		return FAILURE;
+
+	writer.done_.store(true, std::memory_order_release);
+	writer.thread_.join();
+	fclose(writer.file_);
+	writer.file_ = nullptr;
+	return SUCCESS;
+}
+
+template <u32 RAM_WORDS, u32 REG_COUNT>
+Status
+emu_execute_traced(
+	EStateT<RAM_WORDS, REG_COUNT>& state,
+	ETraceWriter& writer)
+{
+	while (!state.halt_)
+	{
+		EStepEffects effects = emu_step_effects(state);
+		if (effects.fault_)
+			return FAILURE;
+
+		ETraceRecord record = {};
+		record.pc_ = state.program_counter_;
+		record.word_ = state.ram_[state.program_counter_].data;
+		record.mem_addr_ = effects.mem_write_ != EMU_NO_ADDRESS ? effects.mem_write_ : effects.mem_read_;
+		record.dest_reg_ = effects.dest_reg_;
+
+		emu_load_next(state);
+		emu_process(state);
+
+		if (record.dest_reg_ != EMU_NO_REGISTER)
+			record.dest_value_ = state.r_[record.dest_reg_];
+		emu_trace_push(writer, record);
+	}
+
+	return SUCCESS;
+}
+
+Status
+emu_trace_read_open(
+	ETraceReader& reader,
+	const char* filepath)
+{
+	FILE* f = fopen(filepath, "rb");
+	if (!f)
+		return FILE_NOT_FOUND;
+
+	reader.data_.resize(get_file_size(f));
+	size_t read = fread(reader.data_.data(), 1, reader.data_.size(), f);
+	fclose(f);
+
+	u32 header[2] = {};
+	if (read != reader.data_.size() || read < sizeof(header))
+		return INVALID_FILE;
+
+	std::memcpy(header, reader.data_.data(), sizeof(header));
+	if (header[0] != EMU_TRACE_MAGIC || header[1] != EMU_TRACE_VERSION)
+		return INVALID_FILE;
+
+	reader.pos_ = sizeof(header);
+	return SUCCESS;
+}
+
+// false at the end of the trace (or on a truncated record)
+[[nodiscard]] bool
+emu_trace_next(
+	ETraceReader& reader,
+	ETraceRecord& r)
+{
+	if (reader.pos_ >= reader.data_.size())
+		return false;
+
+	ETraceCodec& codec = reader.codec_;
+	u8 header = reader.data_[reader.pos_++];
+	u64 v = 0;
+
+	r = {};
+	r.pc_ = codec.pc_ + 1;
+	if (!(header & ETRACE_SEQUENTIAL))
+	{
+		if (!emu_trace_get_varint(reader, v))
+			return false;
+		r.pc_ = (u32)((i64)codec.pc_ + emu_trace_unzigzag(v));
+	}
+
+	u32 slot = r.pc_ % EMU_TRACE_WORD_CACHE;
+	if (header & ETRACE_CACHED_WORD)
+		r.word_ = codec.cache_word_[slot];
+	else
+	{
+		if (!emu_trace_get_varint(reader, v))
+			return false;
+		r.word_ = (u32)v;
+	}
+
+	r.dest_reg_ = EMU_NO_REGISTER;
+	if (header & ETRACE_REGISTER)
+	{
+		if (!emu_trace_get_varint(reader, v))
+			return false;
+		r.dest_reg_ = header >> 4;
+		r.dest_value_ = (u16)(codec.r_[r.dest_reg_] + emu_trace_unzigzag(v));
+		codec.r_[r.dest_reg_] = r.dest_value_;
+	}
+
+	r.mem_addr_ = EMU_NO_ADDRESS;
+	if (header & ETRACE_MEMORY)
+	{
+		if (!emu_trace_get_varint(reader, v))
+			return false;
+		r.mem_addr_ = (u32)((i64)codec.mem_addr_ + emu_trace_unzigzag(v));
+		codec.mem_addr_ = r.mem_addr_;
+	}
+
+	codec.pc_ = r.pc_;
+	codec.cache_pc_[slot] = r.pc_;
+	codec.cache_word_[slot] = r.word_;
+	return true;
+}
+
+// "0004: beq r0 $w1 -3", then "r2=5" / "[12]" for what the instruction wrote or touched
+[[nodiscard]] std::string
+emu_trace_format(
+	const ETraceRecord& r)
+{
+	EInstruction i = {};
+	i.data = r.word_;
+
+	char buffer[EMU_DISASM_LINE + 16];
+	u32 length = (u32)snprintf(buffer, sizeof(buffer), "%04u: ", r.pc_);
+	emu_disasm_word(i, buffer + length);
+
+	std::string line = buffer;
+	if (r.dest_reg_ != EMU_NO_REGISTER)
+	{
+		snprintf(buffer, sizeof(buffer), "  r%u=%u", r.dest_reg_, r.dest_value_);
+		line += buffer;
+	}
+	if (r.mem_addr_ != EMU_NO_ADDRESS)
+	{
+		snprintf(buffer, sizeof(buffer), "  [%u]", r.mem_addr_);
+		line += buffer;
+	}
+	return line;
+}
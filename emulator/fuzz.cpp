@@ -0,0 +1,95 @@
+#include "e_base.h"
+#include "e_fuzz.h"
+
+#include <cstdlib>
+#include <vector>
+
+/*
+ * FUZZER:
+ *   - libFuzzer entry point over emu_fuzz_one, a mismatch prints the EFuzzReport and aborts
+ *     so libFuzzer keeps the input
+ *   - EMULATOR_FUZZ=ON (clang) links it with -fsanitize=fuzzer,address, otherwise main below is a
+ *     standalone driver: emulator_fuzz [--runs <n>] [--seed <n>] [input files...]
+ *     files are replayed (crash reproducers), without files it runs random inputs
+ */
+
+extern "C" int
+LLVMFuzzerTestOneInput(
+	const uint8_t* data,
+	size_t size)
+{
+	EFuzzReport report;
+	if (emu_fuzz_one(data, size, report) != SUCCESS)
+	{
+		LOG("%s differs from emu_process at step %llu: %s", report.engine_.c_str(), (unsigned long long)report.step_, report.diff_.c_str());
+		abort();
+	}
+	return 0;
+}
+
+#if !EMU_FUZZ_LIBFUZZER
+
+i32
+main(
+	i32 argc,
+	char** argv)
+{
+	u64 runs = 100'000;
+	u64 seed = 1;
+	std::vector<const char*> files;
+	for (i32 i = 1; i < argc; i++)
+	{
+		std::string_view arg = argv[i];
+		if (arg == "--runs" && i + 1 < argc)
+			runs = strtoull(argv[++i], nullptr, 10);
+		else if (arg == "--seed" && i + 1 < argc)
+			seed = strtoull(argv[++i], nullptr, 10);
+		else if (arg.starts_with("--"))
+		{
+			LOG("usage: %s [--runs <n>] [--seed <n>] [input files...]", argv[0]);
+			return -1;
+		}
+		else
+			files.push_back(argv[i]);
+	}
+
+	for (const char* path : files)
+	{
+		FILE* f = fopen(path, "rb");
+		if (!f)
+		{
+			LOG("Can't open file: %s", path);
+			return -1;
+		}
+		std::vector<u8> input(get_file_size(f));
+		size_t read = fread(input.data(), 1, input.size(), f);
+		fclose(f);
+		LLVMFuzzerTestOneInput(input.data(), read);
+	}
+
+	if (!files.empty())
+		return 0;
+
+	// xorshift64*, inputs of 0..1k bytes
+	u64 x = seed * 0x9E3779B97F4A7C15ull | 1;
+	const auto next = [&]() {
+		x ^= x >> 12;
+		x ^= x << 25;
+		x ^= x >> 27;
+		return x * 0x2545F4914F6CDD1Dull;
+	};
+
+	std::vector<u8> input;
+	for (u64 run = 0; run < runs; run++)
+	{
+		input.resize(next() % 1024);
+		for (auto& byte : input)
+			byte = (u8)next();
+		LLVMFuzzerTestOneInput(input.data(), input.size());
+	}
+
+	LOG("%llu runs, every engine matches emu_process", (unsigned long long)runs);
+	return 0;
+}
+
+#endif
@@ -1,47 +1,108 @@
 ﻿#include "e_base.h"
 #include "e_asm.h"
+#include "e_asm_stream.h"
+#include "e_image.h"
+#include "e_gdb.h"
 
 #include "e_tests.h"
 
-#define RUN_TESTS 1
+/*
+ * COMMAND LINE:
+ *   emulator                                  runs the tests
+ *   emulator assemble <in.s | -> -o <out.img> streams the source (- is stdin) through
+ *                                             emu_asm_stream_file and writes an e_image.h image
+ *   emulator gdb <image> <port | socket path> loads the image and serves one gdb client on
+ *                                             127.0.0.1:port or a unix socket (e_gdb.h)
+ */
 
-#ifdef RUN_TESTS
-	UTEST_MAIN();
-#else
-	i32
-	main(
-		i32 argc,
-		char **argv)
+UTEST_STATE();
+
+i32
+emu_main_assemble(
+	i32 argc,
+	const char* const argv[])
+{
+	const char* in = nullptr;
+	const char* out = nullptr;
+	for (i32 i = 2; i < argc; i++)
 	{
-		// if (argc < 2)
-		// 	 return -1;
+		std::string_view arg = argv[i];
+		if (arg == "-o" && i + 1 < argc)
+			out = argv[++i];
+		else if (!in && (arg == "-" || !arg.starts_with("-")))
+			in = argv[i];
+		else
+		{
+			in = nullptr;
+			break;
+		}
+	}
+
+	if (!in || !out)
+	{
+		LOG("usage: %s assemble <in.s | -> -o <out.img>", argv[0]);
+		return -1;
+	}
 
+	auto compiller_data = std::make_unique<EAsmCompillerData>();
+	Status status = emu_asm_stream_file(*compiller_data, in);
+	for (const auto& d : compiller_data->diagnostics_)
+		fprintf(stderr, "%s:%u:%u: %s\n", in, d.line_, d.column_, d.message_.c_str());
+	if (status != SUCCESS)
+		return 1;
 
+	return emu_image_write(out, *compiller_data) == SUCCESS ? 0 : 1;
+}
 
-		EAsmCompillerData compiller_data = {};
-		emu_asm(compiller_data, R"(
-			lw r0 $first 0
-			inc r0
-			halt
-			$first .fill dec 10
-		)");
+#if EMU_GDB_AVAILABLE
 
-		EState state = {};
+i32
+emu_main_gdb(
+	i32 argc,
+	const char* const argv[])
+{
+	if (argc != 4)
+	{
+		LOG("usage: %s gdb <image> <port | socket path>", argv[0]);
+		return -1;
+	}
 
-		std::memcpy(state.ram_, compiller_data.compilled_code, RAM_SIZE);
+	EImageMap image;
+	auto state = std::make_unique<EState>();
+	if (emu_image_open(image, argv[2]) != SUCCESS || emu_image_load(*state, image) != SUCCESS)
+		return 1;
 
-		emu_execute(state);
+	const std::string_view where = argv[3];
+	const bool is_port = !where.empty() && where.find_first_not_of("0123456789") == std::string_view::npos;
+	const i32 listen_fd = is_port ? emu_gdb_listen_tcp((u16)atoi(argv[3])) : emu_gdb_listen_unix(argv[3]);
+	if (listen_fd < 0)
+		return 1;
 
-		emu_show_state(state);
-		// const char* image_filepath = "image.img"; // argv[2];
-		// if (emu_load_image(state, image_filepath) != SUCCESS)
-		// {
-		// 	LOG("Failed to read image: %s", image_filepath);
-		// 	ASSERT(false);
-		// 	return -1;
-		// }
+	LOG("Waiting for gdb on %s", argv[3]);
+	const i32 fd = emu_gdb_accept(listen_fd);
+	close(listen_fd);
+	if (fd < 0)
+		return 1;
 
+	auto debug = std::make_unique<EDebug>();
+	Status status = emu_gdb_serve(*state, *debug, fd);
+	close(fd);
+	return status == SUCCESS ? 0 : 1;
+}
 
-		return 0;
-	}
-#endif
\ No newline at end of file
+#endif
+
+i32
+main(
+	i32 argc,
+	const char* const argv[])
+{
+	if (argc > 1 && std::string_view(argv[1]) == "assemble")
+		return emu_main_assemble(argc, argv);
+#if EMU_GDB_AVAILABLE
+	if (argc > 1 && std::string_view(argv[1]) == "gdb")
+		return emu_main_gdb(argc, argv);
+#endif
+
+	return utest_main(argc, argv);
+}